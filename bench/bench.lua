@@ -0,0 +1,434 @@
+-- Throughput benchmark for lua-lz4.
+--
+-- usage: lua bench.lua [--max size] [--sizes size,...] [--corpus name,...] [--function pattern] [--time seconds]
+--                      [--disable feature,...]
+--
+-- Sizes accept K, M suffixes. Results are printed as CSV, one line per
+-- function, corpus and size:
+--   function,corpus,size,ratio,mb_s
+-- `ratio` is input size / compressed size, `mb_s` is MB (10^6 bytes) of
+-- uncompressed data processed per second of CPU time (os.clock), or of wall
+-- time for the functions running on several threads (luasocket or date).
+-- `--disable avx2,sse2` runs the variants selected without these CPU features,
+-- see lz4.cpu_features().
+
+local lz4 = require("lz4")
+
+local clock = os.clock
+
+-- CPU time adds up the threads of a call and misses the workers of a pool
+local wall_clock = (function()
+  local ok, socket = pcall(require, "socket")
+  if ok and type(socket) == "table" and socket.gettime then return socket.gettime end
+  local function date()
+    local p = io.popen and io.popen("date +%s.%N 2>/dev/null")
+    local t = p and tonumber(p:read("*l"))
+    if p then p:close() end
+    return t
+  end
+  local ok_date, t = pcall(date)
+  if ok_date and t and t % 1 ~= 0 then return date end
+  io.stderr:write("no wall clock, threaded functions are measured in CPU time\n")
+  return os.clock
+end)()
+
+local options = {
+  sizes = { 64, 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 256 * 1024 * 1024 },
+  max = 16 * 1024 * 1024,
+  corpus = nil,
+  pattern = nil,
+  time = 0.2,
+}
+
+local function parse_size(s)
+  local n, unit = s:match("^(%d+)([KkMm]?)$")
+  if not n then error("invalid size: " .. s) end
+  n = tonumber(n)
+  if unit == "K" or unit == "k" then n = n * 1024 end
+  if unit == "M" or unit == "m" then n = n * 1024 * 1024 end
+  return n
+end
+
+local function split(s)
+  local t = {}
+  for item in s:gmatch("[^,]+") do t[#t + 1] = item end
+  return t
+end
+
+do
+  local args = arg or {}
+  local i = 1
+  while i <= #args do
+    local name, value = args[i], args[i + 1]
+    if name == "--max" then
+      options.max = parse_size(value)
+    elseif name == "--sizes" then
+      options.sizes = {}
+      for _, s in ipairs(split(value)) do options.sizes[#options.sizes + 1] = parse_size(s) end
+      options.max = math.huge
+    elseif name == "--corpus" then
+      options.corpus = {}
+      for _, s in ipairs(split(value)) do options.corpus[s] = true end
+    elseif name == "--function" then
+      options.pattern = value
+    elseif name == "--time" then
+      options.time = tonumber(value)
+    elseif name == "--disable" then
+      local features = {}
+      for _, s in ipairs(split(value)) do features[s] = false end
+      lz4.cpu_features(features)
+    else
+      error("unknown option: " .. tostring(name))
+    end
+    i = i + 2
+  end
+end
+
+--
+-- Corpora
+--
+-- Every corpus builds a 1MB base deterministically and repeats it. The base is
+-- larger than the 64KB LZ4 window, so repeating it does not change the ratio.
+--
+
+local BASE_SIZE = 1024 * 1024
+
+-- Park-Miller generator, exact with doubles on every Lua version
+local function rng(seed)
+  local x = seed
+  return function(n)
+    x = (x * 16807) % 2147483647
+    return x % n
+  end
+end
+
+local function repeat_base(base, size)
+  if size <= #base then return base:sub(1, size) end
+  return base:rep(math.floor(size / #base)) .. base:sub(1, size % #base)
+end
+
+local words = {
+  "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with",
+  "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which",
+  "but", "have", "an", "had", "they", "you", "were", "their", "one", "all", "we",
+  "compression", "algorithm", "buffer", "stream", "frame", "block", "dictionary",
+  "fast", "memory", "decoder", "encoder", "throughput", "latency", "window",
+}
+
+local generators = {}
+
+generators.repetitive = function()
+  return ("0123456789"):rep(BASE_SIZE / 8):sub(1, BASE_SIZE)
+end
+
+generators.text = function()
+  local random = rng(1)
+  local t, n, column = {}, 0, 0
+  while n < BASE_SIZE do
+    local w = words[random(#words) + 1]
+    column = column + #w + 1
+    if column > 72 then
+      w = w .. (random(8) == 0 and ".\n" or "\n")
+      column = 0
+    else
+      w = w .. " "
+    end
+    t[#t + 1] = w
+    n = n + #w
+  end
+  return table.concat(t):sub(1, BASE_SIZE)
+end
+
+generators.random = function()
+  local random = rng(2)
+  local t = {}
+  for i = 1, BASE_SIZE / 4 do
+    t[i] = string.char(random(256), random(256), random(256), random(256))
+  end
+  return table.concat(t)
+end
+
+-- JSON like messages of 64 to 1024 bytes, what message brokers typically carry
+generators.small = function()
+  local random = rng(3)
+  local t, n = {}, 0
+  while n < BASE_SIZE do
+    local fields = {}
+    local target = 64 + random(960)
+    local len = 2
+    while len < target do
+      local f = string.format('"%s":"%s-%d"', words[random(#words) + 1], words[random(#words) + 1], random(100000))
+      fields[#fields + 1] = f
+      len = len + #f + 1
+    end
+    local m = "{" .. table.concat(fields, ",") .. "}\n"
+    t[#t + 1] = m
+    n = n + #m
+  end
+  return table.concat(t):sub(1, BASE_SIZE)
+end
+
+local corpus_names = { "repetitive", "text", "random", "small" }
+
+--
+-- Functions
+--
+-- prepare(s) returns the function to time, the compressed size and, when a
+-- call does not process the whole of s, the uncompressed size it processes.
+-- Functions running on several threads are marked `wall`.
+--
+
+local CHUNK = 64 * 1024
+
+local function chunks(s)
+  local t = {}
+  for i = 1, #s, CHUNK do t[#t + 1] = s:sub(i, i + CHUNK - 1) end
+  if #t == 0 then t[1] = "" end
+  return t
+end
+
+local function stream_compress(cs, parts)
+  local n = 0
+  cs:reset()
+  for i = 1, #parts do n = n + #cs:compress(parts[i]) end
+  return n
+end
+
+-- shared by the async functions, its threads start on first use
+local pool
+local function shared_pool()
+  pool = pool or lz4.pool(4)
+  return pool
+end
+
+local function stream_encode(cs, parts)
+  local e = {}
+  cs:reset()
+  for i = 1, #parts do e[i] = cs:compress(parts[i]) end
+  return e
+end
+
+local functions = {
+  { "compress", function(s)
+    local e = lz4.compress(s)
+    return function() lz4.compress(s) end, #e
+  end },
+  { "compress_hc", function(s)
+    local o = { compression_level = 9 }
+    local e = lz4.compress(s, o)
+    return function() lz4.compress(s, o) end, #e
+  end },
+  { "compress_dict", function(s)
+    local o = { dictionary = lz4.new_dictionary(s:sub(1, 1024)) }
+    local e = lz4.compress(s, o)
+    return function() lz4.compress(s, o) end, #e
+  end },
+  { "compress_hc_async", function(s)
+    local pool, parts, o = shared_pool(), chunks(s), { compression_level = 9 }
+    local function run()
+      local jobs, n = {}, 0
+      for i = 1, #parts do jobs[i] = pool:compress_async(parts[i], o) end
+      for i = 1, #parts do n = n + #jobs[i]:wait() end
+      return n
+    end
+    return run, run()
+  end, wall = true },
+  { "decompress", function(s)
+    local e = lz4.compress(s)
+    return function() lz4.decompress(e) end, #e
+  end },
+  { "decompress_threads", function(s)
+    local e, o = lz4.compress(s, { block_independent = true }), { threads = 4 }
+    return function() lz4.decompress(e, o) end, #e
+  end, wall = true },
+  { "compress_into", function(s)
+    local buf = lz4.new_buffer()
+    local n = lz4.compress_into(buf, s)
+    return function() lz4.compress_into(buf, s) end, n
+  end },
+  { "decompress_into", function(s)
+    local buf = lz4.new_buffer()
+    local e = lz4.compress(s)
+    return function() lz4.decompress_into(buf, e) end, #e
+  end },
+  { "frame_compressor", function(s)
+    local fc = lz4.new_frame_compressor()
+    local parts = chunks(s)
+    local function run()
+      local n = #fc:begin()
+      for i = 1, #parts do n = n + #fc:update(parts[i]) end
+      return n + #fc:finish()
+    end
+    return run, run()
+  end },
+  { "frame_decompressor", function(s)
+    local fd = lz4.new_frame_decompressor()
+    local e = lz4.compress(s)
+    local parts = chunks(e)
+    return function()
+      for i = 1, #parts do fd:decompress(parts[i]) end
+    end, #e
+  end },
+  { "block_compress", function(s)
+    local e = lz4.block_compress(s)
+    return function() lz4.block_compress(s) end, #e
+  end },
+  { "block_compress_hc", function(s)
+    local e = lz4.block_compress_hc(s)
+    return function() lz4.block_compress_hc(s) end, #e
+  end },
+  { "block_compress_hc_opt", function(s)
+    local e = lz4.block_compress_hc(s, 17)
+    return function() lz4.block_compress_hc(s, 17) end, #e
+  end },
+  { "block_decompress_safe", function(s)
+    local e, n = lz4.block_compress(s), #s
+    return function() lz4.block_decompress_safe(e, n) end, #e
+  end },
+  { "block_decompress_fast", function(s)
+    local e, n = lz4.block_compress(s), #s
+    return function() lz4.block_decompress_fast(e, n) end, #e
+  end },
+  { "block_decompress_safe_partial", function(s)
+    -- the first 4KB, a header or a preview, at the ratio of the whole block
+    local e, n, target = lz4.block_compress(s), #s, math.min(#s, 4096)
+    return function() lz4.block_decompress_safe_partial(e, target, n) end, #e * target / n, target
+  end },
+  { "block_compress_into", function(s)
+    local buf = lz4.new_buffer()
+    local n = lz4.block_compress_into(buf, s)
+    return function() lz4.block_compress_into(buf, s) end, n
+  end },
+  { "block_decompress_into", function(s)
+    local buf, e, n = lz4.new_buffer(), lz4.block_compress(s), #s
+    return function() lz4.block_decompress_into(buf, e, n) end, #e
+  end },
+  { "block_compress_dest_size", function(s)
+    -- a 1400 bytes datagram
+    local e, consumed = lz4.block_compress_dest_size(s, 1400)
+    return function() lz4.block_compress_dest_size(s, 1400) end, #e, consumed
+  end },
+  { "block_compress_batch", function(s)
+    local parts, n = chunks(s), 0
+    for _, e in ipairs(lz4.block_compress_batch(parts)) do n = n + #e end
+    return function() lz4.block_compress_batch(parts) end, n
+  end },
+  { "block_decompress_batch", function(s)
+    local parts, sizes, n = chunks(s), {}, 0
+    local e = lz4.block_compress_batch(parts)
+    for i = 1, #parts do sizes[i] = #parts[i]; n = n + #e[i] end
+    return function() lz4.block_decompress_batch(e, sizes) end, n
+  end },
+  { "block_compress_slices", function(s)
+    local blocks, n = lz4.block_compress_slices(s, 1400), 0
+    for i = 1, #blocks do n = n + #blocks[i] end
+    return function() lz4.block_compress_slices(s, 1400) end, n
+  end },
+  { "block_compress_dict", function(s)
+    local dict = lz4.new_dictionary(s:sub(1, 1024))
+    local e = lz4.block_compress_dict(s, dict)
+    return function() lz4.block_compress_dict(s, dict) end, #e
+  end },
+  { "block_decompress_safe_dict", function(s)
+    local dict = lz4.new_dictionary(s:sub(1, 1024))
+    local e, n = lz4.block_compress_dict(s, dict), #s
+    return function() lz4.block_decompress_safe_dict(e, n, dict) end, #e
+  end },
+  { "compression_stream", function(s)
+    local cs, parts = lz4.new_compression_stream(), chunks(s)
+    return function() stream_compress(cs, parts) end, stream_compress(cs, parts)
+  end },
+  { "compression_stream_writable", function(s)
+    local cs, parts = lz4.new_compression_stream(), chunks(s)
+    local function run()
+      local n = 0
+      cs:reset()
+      for i = 1, #parts do
+        cs:writable(#parts[i]):write(parts[i])
+        n = n + #cs:commit()
+      end
+      return n
+    end
+    return run, run()
+  end },
+  { "compression_stream_hc", function(s)
+    local cs, parts = lz4.new_compression_stream_hc(), chunks(s)
+    return function() stream_compress(cs, parts) end, stream_compress(cs, parts)
+  end },
+  { "decompression_stream_safe", function(s)
+    local ds, parts = lz4.new_decompression_stream(), chunks(s)
+    local e, n = stream_encode(lz4.new_compression_stream(), parts), 0
+    for i = 1, #e do n = n + #e[i] end
+    return function()
+      ds:reset()
+      for i = 1, #e do ds:decompress_safe(e[i], #parts[i]) end
+    end, n
+  end },
+  { "decompression_stream_safe_view", function(s)
+    local ds, parts = lz4.new_decompression_stream(), chunks(s)
+    local e, n = stream_encode(lz4.new_compression_stream(), parts), 0
+    for i = 1, #e do n = n + #e[i] end
+    return function()
+      ds:reset()
+      for i = 1, #e do ds:decompress_safe_view(e[i], #parts[i]) end
+    end, n
+  end },
+  { "decompression_stream_fast", function(s)
+    local ds, parts = lz4.new_decompression_stream(), chunks(s)
+    local e, n = stream_encode(lz4.new_compression_stream(), parts), 0
+    for i = 1, #e do n = n + #e[i] end
+    return function()
+      ds:reset()
+      for i = 1, #e do ds:decompress_fast(e[i], #parts[i]) end
+    end, n
+  end },
+}
+
+-- the HC ratio / speed curve, compression_stream_hc_<max_attempts>_<chain_log>
+for _, o in ipairs({ { 1, 16 }, { 4, 16 }, { 16, 16 }, { 256, 16 }, { 4096, 16 }, { 65536, 16 }, { 16, 12 }, { 256, 12 } }) do
+  functions[#functions + 1] = { "compression_stream_hc_" .. o[1] .. "_" .. o[2], function(s)
+    local cs, parts = lz4.new_compression_stream_hc(nil, nil, { max_attempts = o[1], chain_log = o[2] }), chunks(s)
+    return function() stream_compress(cs, parts) end, stream_compress(cs, parts)
+  end }
+end
+
+--
+-- Runner
+--
+
+-- seconds per call, calls are batched so the clock resolution does not matter
+local function measure(fn, clock)
+  local calls, batch, elapsed = 0, 1, 0
+  local start = clock()
+  repeat
+    for _ = 1, batch do fn() end
+    calls = calls + batch
+    batch = batch * 2
+    elapsed = clock() - start
+  until elapsed >= options.time
+  return elapsed / calls
+end
+
+print("function,corpus,size,ratio,mb_s")
+for _, corpus in ipairs(corpus_names) do
+  if not options.corpus or options.corpus[corpus] then
+    local base = generators[corpus]()
+    for _, size in ipairs(options.sizes) do
+      if size <= options.max then
+        local s = repeat_base(base, size)
+        for _, f in ipairs(functions) do
+          local name, prepare = f[1], f[2]
+          if not options.pattern or name:find(options.pattern) then
+            local fn, compressed, processed = prepare(s)
+            local seconds = measure(fn, f.wall and wall_clock or clock)
+            processed = processed or size
+            print(string.format("%s,%s,%d,%.3f,%.1f", name, corpus, size, processed / compressed, processed / seconds / 1e6))
+            io.stdout:flush()
+          end
+        end
+        s = nil
+        collectgarbage()
+      end
+    end
+  end
+end
@@ -1,25 +1,40 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
 
 #include "lz4/lz4frame.h"
+#include "lz4/lz4frame_static.h"
 
 #include "lz4/lz4.h"
 #include "lz4/lz4hc.h"
+#include "lz4/xxhash.h"
+#include "lz4/lz4cpu.h"
 
 
 #define LZ4_DICTSIZE      65536
 #define DEF_BUFSIZE       65536
 #define MIN_BUFFSIZE      1024
+#define FRAME_HEADER_SIZE 19  // maximum frame header size
 
 #if LUA_VERSION_NUM < 502
 #define luaL_newlib(L, function_table) do { \
   lua_newtable(L);                          \
   luaL_register(L, NULL, function_table);   \
   } while (0)
+#define lua_rawlen(L, index) lua_objlen(L, index)
+#define lua_setuservalue(L, index) lua_setfenv(L, index)
+#define lua_getuservalue(L, index) lua_getfenv(L, index)
 #endif
 
 #if LUA_VERSION_NUM >= 502
@@ -84,713 +99,3884 @@ static int _lua_table_optboolean(lua_State *L, int table_index, const char *fiel
 }
 
 /*****************************************************************************
- * Frame
+ * Buffer
  ****************************************************************************/
 
-static int lz4_compress(lua_State *L)
+typedef struct
 {
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  size_t bound, r;
+  size_t length;
+  size_t capacity;
+  char *data;
+  int view;  // data belongs to another object, capacity is fixed
+} lz4_buffer_t;
 
-  LZ4F_preferences_t stack_settings;
-  LZ4F_preferences_t *settings = NULL;
+static lz4_buffer_t *_checkbuffer(lua_State *L, int index)
+{
+  return (lz4_buffer_t *)luaL_checkudata(L, index, "lz4.buffer");
+}
 
-  if (lua_type(L, 2) == LUA_TTABLE)
+static char *_lz4_buffer_reserve(lua_State *L, lz4_buffer_t *buf, size_t size)
+{
+  if (size > buf->capacity)
   {
-    memset(&stack_settings, 0, sizeof(stack_settings));
-    settings = &stack_settings;
-    settings->compressionLevel = _lua_table_optinteger(L, 2, "compression_level", 0);
-    settings->autoFlush = _lua_table_optboolean(L, 2, "auto_flush", 0);
-    settings->frameInfo.blockSizeID = _lua_table_optinteger(L, 2, "block_size", 0);
-    settings->frameInfo.blockMode = _lua_table_optboolean(L, 2, "block_independent", 0) ? LZ4F_blockIndependent : LZ4F_blockLinked;
-    settings->frameInfo.contentChecksumFlag = _lua_table_optboolean(L, 2, "content_checksum", 0) ? LZ4F_contentChecksumEnabled : LZ4F_noContentChecksum;
+    char *data;
+    if (buf->view) luaL_error(L, "buffer view capacity exceeded");
+    data = realloc(buf->data, size);
+    if (data == NULL) luaL_error(L, "out of memory");
+    buf->data = data;
+    buf->capacity = size;
   }
+  return buf->data;
+}
 
-  bound = LZ4F_compressFrameBound(in_len, settings);
+static size_t _lz4_buffer_optoffset(lua_State *L, int index, lz4_buffer_t *buf)
+{
+  lua_Integer offset = luaL_optinteger(L, index, 0);
+  luaL_argcheck(L, offset >= 0 && (size_t)offset <= buf->length, index, "offset out of range");
+  return (size_t)offset;
+}
 
+/* input of *_into functions can be a string or a lz4.buffer */
+static const char *_checkinput(lua_State *L, int index, size_t *len)
+{
+  if (lua_type(L, index) == LUA_TUSERDATA)
   {
-    LUABUFF_NEW(b, out, bound)
-    r = LZ4F_compressFrame(out, bound, in, in_len, settings);
-    if (LZ4F_isError(r))
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
-    }
-    LUABUFF_PUSH(b, out, r)
+    lz4_buffer_t *buf = _checkbuffer(L, index);
+    *len = buf->length;
+    return buf->data != NULL ? buf->data : "";
   }
+  return luaL_checklstring(L, index, len);
+}
 
+static int lz4_buffer_len(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  lua_pushinteger(L, buf->length);
   return 1;
 }
 
-static int lz4_decompress(lua_State *L)
+static int lz4_buffer_capacity(lua_State *L)
 {
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  const char *p = in;
-  size_t p_len = in_len;
-
-  LZ4F_decompressionContext_t ctx = NULL;
-  LZ4F_frameInfo_t info;
-  LZ4F_errorCode_t code;
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  lua_pushinteger(L, buf->capacity);
+  return 1;
+}
 
-  code = LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION);
-  if (LZ4F_isError(code)) goto decompression_failed;
+static int lz4_buffer_reserve(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  lua_Integer size = luaL_checkinteger(L, 2);
+  if (size > 0) _lz4_buffer_reserve(L, buf, (size_t)size);
+  lua_pushinteger(L, buf->capacity);
+  return 1;
+}
 
-  {
-    luaL_Buffer b;
-    luaL_buffinit(L, &b);
-    while (1)
-    {
-#if LUA_VERSION_NUM >= 502
-      size_t out_len = 65536;
-      char *out = luaL_prepbuffsize(&b, out_len);
-#else
-      size_t out_len = LUAL_BUFFERSIZE;
-      char *out = luaL_prepbuffer(&b);
-#endif
-      size_t advance = p_len;
-      code = LZ4F_decompress(ctx, out, &out_len, p, &advance, NULL);
-      if (LZ4F_isError(code)) goto decompression_failed;
-      if (out_len == 0) break;
-      p += advance;
-      p_len -= advance;
-      luaL_addsize(&b, out_len);
-    }
-    luaL_pushresult(&b);
-  }
+static int lz4_buffer_clear(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  buf->length = 0;
+  return 0;
+}
 
-  LZ4F_freeDecompressionContext(ctx);
+static int lz4_buffer_sub(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  lua_Integer len = (lua_Integer)buf->length;
+  lua_Integer i = luaL_optinteger(L, 2, 1);
+  lua_Integer j = luaL_optinteger(L, 3, -1);
+
+  // same rules as string.sub
+  if (i < 0) i = len + i + 1;
+  if (j < 0) j = len + j + 1;
+  if (i < 1) i = 1;
+  if (j > len) j = len;
+
+  if (i > j)
+    lua_pushliteral(L, "");
+  else
+    lua_pushlstring(L, buf->data + i - 1, (size_t)(j - i + 1));
 
   return 1;
-
-decompression_failed:
-  if (ctx != NULL) LZ4F_freeDecompressionContext(ctx);
-  return luaL_error(L, "decompression failed: %s", LZ4F_getErrorName(code));
 }
 
-/*****************************************************************************
- * Block
- ****************************************************************************/
-
-static int lz4_block_compress(lua_State *L)
+static int lz4_buffer_write(lua_State *L)
 {
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
   size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  int accelerate = luaL_optinteger(L, 2, 0);
-  int bound, r;
-
-  if (in_len > LZ4_MAX_INPUT_SIZE)
-    return luaL_error(L, "input longer than %d", LZ4_MAX_INPUT_SIZE);
+  size_t offset = buf->length;
 
-  bound = LZ4_compressBound(in_len);
+  _checkinput(L, 2, &in_len);
+  if (!lua_isnoneornil(L, 3)) offset = _lz4_buffer_optoffset(L, 3, buf);
+  _lz4_buffer_reserve(L, buf, offset + in_len);
+  if (in_len > 0) memmove(buf->data + offset, _checkinput(L, 2, &in_len), in_len);  // input may be this buffer, reserve moved it
+  buf->length = offset + in_len;
 
-  {
-    LUABUFF_NEW(b, out, bound)
-    r = LZ4_compress_fast(in, out, in_len, bound, accelerate);
-    if (r == 0)
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed");
-    }
-    LUABUFF_PUSH(b, out, r)
-  }
+  lua_pushinteger(L, buf->length);
+  return 1;
+}
 
+static int lz4_buffer_tostring(lua_State *L)
+{
+  lz4_buffer_t *p = _checkbuffer(L, 1);
+  lua_pushfstring(L, "lz4.buffer (%p)", p);
   return 1;
 }
 
-static int lz4_block_compress_hc(lua_State *L)
+static int lz4_buffer_gc(lua_State *L)
 {
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  int level = luaL_optinteger(L, 2, 0);
-  int bound, r;
+  lz4_buffer_t *p = _checkbuffer(L, 1);
+  if (!p->view) free(p->data);
+  p->data = NULL;
+  return 0;
+}
 
-  if (in_len > LZ4_MAX_INPUT_SIZE)
-    return luaL_error(L, "input longer than %d", LZ4_MAX_INPUT_SIZE);
+static const luaL_Reg buffer_functions[] = {
+  { "len",      lz4_buffer_len },
+  { "capacity", lz4_buffer_capacity },
+  { "reserve",  lz4_buffer_reserve },
+  { "clear",    lz4_buffer_clear },
+  { "sub",      lz4_buffer_sub },
+  { "write",    lz4_buffer_write },
+  { NULL,       NULL },
+};
 
-  bound = LZ4_compressBound(in_len);
+static lz4_buffer_t *_lz4_new_buffer(lua_State *L)
+{
+  lz4_buffer_t *p = lua_newuserdata(L, sizeof(lz4_buffer_t));
+  p->length = 0;
+  p->capacity = 0;
+  p->data = NULL;
+  p->view = 0;
 
+  if (luaL_newmetatable(L, "lz4.buffer"))
   {
-    LUABUFF_NEW(b, out, bound)
-    r = LZ4_compress_HC(in, out, in_len, bound, level);
-    if (r == 0)
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed");
-    }
-    LUABUFF_PUSH(b, out, r)
+    // new method table
+    luaL_newlib(L, buffer_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__len
+    lua_pushcfunction(L, lz4_buffer_len);
+    lua_setfield(L, -2, "__len");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_buffer_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    // metatable.__gc
+    lua_pushcfunction(L, lz4_buffer_gc);
+    lua_setfield(L, -2, "__gc");
   }
+  lua_setmetatable(L, -2);
 
-  return 1;
+  return p;
 }
 
-static int lz4_block_decompress_safe(lua_State *L)
+static int lz4_new_buffer(lua_State *L)
 {
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  int out_len = luaL_checkinteger(L, 2);
-  int r;
+  lua_Integer capacity = luaL_optinteger(L, 1, 0);
+  lz4_buffer_t *p;
 
-  LUABUFF_NEW(b, out, out_len)
-  r = LZ4_decompress_safe(in, out, in_len, out_len);
-  if (r < 0)
-  {
-    LUABUFF_FREE(out)
-    return luaL_error(L, "corrupt input or need more output space");
-  }
-  LUABUFF_PUSH(b, out, r)
+  luaL_argcheck(L, capacity >= 0, 1, "negative capacity");
+
+  p = _lz4_new_buffer(L);
+  if (capacity > 0) _lz4_buffer_reserve(L, p, (size_t)capacity);
 
   return 1;
 }
 
-static int lz4_block_decompress_fast(lua_State *L)
+/*****************************************************************************
+ * Threads
+ ****************************************************************************/
+
+/*
+ * Minimal native thread shim used by the parallel frame functions and the
+ * pool. Worker functions never touch the lua_State, all Lua interaction
+ * happens before the threads are started and after they have been joined.
+ */
+
+#define MAX_THREADS 64
+
+typedef void (*lz4_thread_fn)(void *arg, int thread);
+
+typedef struct
 {
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  int out_len = luaL_checkinteger(L, 2);
+  lz4_thread_fn fn;
+  void *arg;
+  int thread;
+} lz4_thread_arg_t;
 
-  {
-    int r;
-    LUABUFF_NEW(b, out, out_len)
-    r = LZ4_decompress_fast(in, out, out_len);
-    if (r < 0)
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "corrupt input or incorrect output length");
-    }
-    LUABUFF_PUSH(b, out, out_len)
-  }
+#ifdef _WIN32
+typedef HANDLE lz4_thread_t;
 
-  return 1;
+static DWORD WINAPI _lz4_thread_main(LPVOID p)
+{
+  lz4_thread_arg_t *t = (lz4_thread_arg_t *)p;
+  t->fn(t->arg, t->thread);
+  return 0;
 }
 
-static int lz4_block_decompress_safe_partial(lua_State *L)
+static int _lz4_thread_create(lz4_thread_t *handle, lz4_thread_arg_t *arg)
 {
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 1, &in_len);
-  int target_len = luaL_checkinteger(L, 2);
-  int out_len = luaL_checkinteger(L, 3);
-  int r;
+  *handle = CreateThread(NULL, 0, _lz4_thread_main, arg, 0, NULL);
+  return *handle != NULL;
+}
 
-  LUABUFF_NEW(b, out, out_len)
-  r = LZ4_decompress_safe_partial(in, out, in_len, target_len, out_len);
-  if (r < 0)
+static void _lz4_thread_join(lz4_thread_t handle)
+{
+  WaitForSingleObject(handle, INFINITE);
+  CloseHandle(handle);
+}
+
+typedef CRITICAL_SECTION lz4_mutex_t;
+typedef CONDITION_VARIABLE lz4_cond_t;
+
+static void _lz4_mutex_init(lz4_mutex_t *m) { InitializeCriticalSection(m); }
+static void _lz4_mutex_destroy(lz4_mutex_t *m) { DeleteCriticalSection(m); }
+static void _lz4_mutex_lock(lz4_mutex_t *m) { EnterCriticalSection(m); }
+static void _lz4_mutex_unlock(lz4_mutex_t *m) { LeaveCriticalSection(m); }
+static void _lz4_cond_init(lz4_cond_t *c) { InitializeConditionVariable(c); }
+static void _lz4_cond_destroy(lz4_cond_t *c) { (void)c; }
+static void _lz4_cond_wait(lz4_cond_t *c, lz4_mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void _lz4_cond_broadcast(lz4_cond_t *c) { WakeAllConditionVariable(c); }
+
+typedef LONG lz4_atomic_t;
+
+static void _lz4_atomic_add(lz4_atomic_t *v, LONG n) { InterlockedExchangeAdd(v, n); }
+static LONG _lz4_atomic_load(lz4_atomic_t *v) { return InterlockedCompareExchange(v, 0, 0); }
+#else
+typedef pthread_t lz4_thread_t;
+
+static void *_lz4_thread_main(void *p)
+{
+  lz4_thread_arg_t *t = (lz4_thread_arg_t *)p;
+  t->fn(t->arg, t->thread);
+  return NULL;
+}
+
+static int _lz4_thread_create(lz4_thread_t *handle, lz4_thread_arg_t *arg)
+{
+  return pthread_create(handle, NULL, _lz4_thread_main, arg) == 0;
+}
+
+static void _lz4_thread_join(lz4_thread_t handle)
+{
+  pthread_join(handle, NULL);
+}
+
+typedef pthread_mutex_t lz4_mutex_t;
+typedef pthread_cond_t lz4_cond_t;
+
+static void _lz4_mutex_init(lz4_mutex_t *m) { pthread_mutex_init(m, NULL); }
+static void _lz4_mutex_destroy(lz4_mutex_t *m) { pthread_mutex_destroy(m); }
+static void _lz4_mutex_lock(lz4_mutex_t *m) { pthread_mutex_lock(m); }
+static void _lz4_mutex_unlock(lz4_mutex_t *m) { pthread_mutex_unlock(m); }
+static void _lz4_cond_init(lz4_cond_t *c) { pthread_cond_init(c, NULL); }
+static void _lz4_cond_destroy(lz4_cond_t *c) { pthread_cond_destroy(c); }
+static void _lz4_cond_wait(lz4_cond_t *c, lz4_mutex_t *m) { pthread_cond_wait(c, m); }
+static void _lz4_cond_broadcast(lz4_cond_t *c) { pthread_cond_broadcast(c); }
+
+typedef long lz4_atomic_t;
+
+static void _lz4_atomic_add(lz4_atomic_t *v, long n) { __atomic_add_fetch(v, n, __ATOMIC_SEQ_CST); }
+static long _lz4_atomic_load(lz4_atomic_t *v) { return __atomic_load_n(v, __ATOMIC_SEQ_CST); }
+#endif
+
+// running `threads` calls and open pools of every lua_State, lz4.cpu_features() waits for none
+static lz4_atomic_t _lz4_busy_workers = 0;
+
+/*
+ * Runs fn(arg, t) for every t in [0, threads) and waits for all of them.
+ * t = 0 runs on the calling thread; if a thread can not be created its share
+ * of the work is run on the calling thread as well.
+ */
+static void _lz4_run_threads(int threads, lz4_thread_fn fn, void *arg)
+{
+  lz4_thread_arg_t args[MAX_THREADS + 1];
+  lz4_thread_t handles[MAX_THREADS + 1];
+  int started[MAX_THREADS + 1];
+  int i;
+
+  if (threads > MAX_THREADS + 1) threads = MAX_THREADS + 1;
+  _lz4_atomic_add(&_lz4_busy_workers, 1);
+  for (i = 1; i < threads; i++)
   {
-    LUABUFF_FREE(out)
-    return luaL_error(L, "corrupt input or need more output space");
+    args[i].fn = fn;
+    args[i].arg = arg;
+    args[i].thread = i;
+    started[i] = _lz4_thread_create(&handles[i], &args[i]);
   }
-  if (target_len < r) r = target_len;
-  LUABUFF_PUSH(b, out, r)
-
-  return 1;
+  fn(arg, 0);
+  for (i = 1; i < threads; i++)
+  {
+    if (started[i])
+      _lz4_thread_join(handles[i]);
+    else
+      fn(arg, i);
+  }
+  _lz4_atomic_add(&_lz4_busy_workers, -1);
 }
 
 /*****************************************************************************
- * Compression Stream
+ * Frame
  ****************************************************************************/
 
+/*
+ * Frame contexts are cached per lua_State and reused by lz4.compress and
+ * lz4.decompress, so warm calls do not allocate any LZ4 state.
+ */
 typedef struct
 {
-  LZ4_stream_t handle;
-  int accelerate;
-  int buffer_size;
-  int buffer_position;
-  char *buffer;
-} lz4_compress_stream_t;
+  LZ4F_compressionContext_t cctx;
+  LZ4F_decompressionContext_t dctx;
+} lz4_frame_context_t;
 
-static lz4_compress_stream_t *_checkcompressionstream(lua_State *L, int index)
+static int _lz4_frame_context_gc(lua_State *L)
 {
-  return (lz4_compress_stream_t *)luaL_checkudata(L, index, "lz4.compression_stream");
+  lz4_frame_context_t *p = (lz4_frame_context_t *)lua_touserdata(L, 1);
+  LZ4F_freeCompressionContext(p->cctx);
+  LZ4F_freeDecompressionContext(p->dctx);
+  p->cctx = NULL;
+  p->dctx = NULL;
+  return 0;
 }
 
-static int lz4_cs_reset(lua_State *L)
+static lz4_frame_context_t *_frame_context(lua_State *L)
 {
-  lz4_compress_stream_t *cs = _checkcompressionstream(L, 1);
-  size_t in_len = 0;
-  const char *in = luaL_optlstring(L, 2, NULL, &in_len);
+  lz4_frame_context_t *p;
 
-  if (in != NULL && in_len > 0)
-  {
-    int limit_len = LZ4_DICTSIZE;
-    if (limit_len > cs->buffer_size) limit_len = cs->buffer_size;
-    if (in_len > limit_len)
-    {
-      in = in + in_len - limit_len;
-      in_len = limit_len;
-    }
-    memcpy(cs->buffer, in, in_len);
-    cs->buffer_position = LZ4_loadDict(&cs->handle, cs->buffer, in_len);
-  }
-  else
+  lua_getfield(L, LUA_REGISTRYINDEX, "lz4.frame_context");
+  p = (lz4_frame_context_t *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+
+  if (p == NULL)
   {
-    LZ4_resetStream(&cs->handle);
-    cs->buffer_position = 0;
+    p = lua_newuserdata(L, sizeof(lz4_frame_context_t));
+    memset(p, 0, sizeof(lz4_frame_context_t));
+    lua_newtable(L);
+    lua_pushcfunction(L, _lz4_frame_context_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&p->cctx, LZ4F_VERSION)))
+      p->cctx = NULL;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&p->dctx, LZ4F_VERSION)))
+      p->dctx = NULL;
+    if (p->cctx == NULL || p->dctx == NULL) luaL_error(L, "out of memory");
+
+    lua_setfield(L, LUA_REGISTRYINDEX, "lz4.frame_context");
   }
 
-  lua_pushinteger(L, cs->buffer_position);
+  return p;
+}
 
-  return 1;
+static void _lua_table_preferences(lua_State *L, int table_index, LZ4F_preferences_t *settings)
+{
+  memset(settings, 0, sizeof(*settings));
+  settings->compressionLevel = _lua_table_optinteger(L, table_index, "compression_level", 0);
+  settings->autoFlush = _lua_table_optboolean(L, table_index, "auto_flush", 0);
+  settings->frameInfo.blockSizeID = _lua_table_optinteger(L, table_index, "block_size", 0);
+  settings->frameInfo.blockMode = _lua_table_optboolean(L, table_index, "block_independent", 0) ? LZ4F_blockIndependent : LZ4F_blockLinked;
+  settings->frameInfo.contentChecksumFlag = _lua_table_optboolean(L, table_index, "content_checksum", 0) ? LZ4F_contentChecksumEnabled : LZ4F_noContentChecksum;
 }
 
-static int lz4_cs_compress(lua_State *L)
+static void _write_le32(char *p, unsigned int value)
 {
-  lz4_compress_stream_t *cs = _checkcompressionstream(L, 1);
+  unsigned char *d = (unsigned char *)p;
+  d[0] = (unsigned char)value;
+  d[1] = (unsigned char)(value >> 8);
+  d[2] = (unsigned char)(value >> 16);
+  d[3] = (unsigned char)(value >> 24);
+}
+
+typedef struct
+{
+  const char *in;
   size_t in_len;
-  const char *in = luaL_checklstring(L, 2, &in_len);
-  size_t bound = LZ4_compressBound(in_len);
-  int policy = _ring_policy(cs->buffer_size, cs->buffer_position, in_len);
-  int r;
+  char *out;              // block i is written at out + i * slot_size
+  size_t block_size;
+  size_t slot_size;
+  size_t *block_len;      // compressed length of each block, block header included
+  int blocks;
+  int threads;            // compression threads, thread `threads` computes the checksum
+  int level;
+  unsigned int checksum;
+} lz4_mt_compress_t;
 
-  LUABUFF_NEW(b, out, bound)
+static void _lz4_mt_compress_blocks(void *arg, int thread)
+{
+  lz4_mt_compress_t *job = (lz4_mt_compress_t *)arg;
+  int hc = job->level >= 3;
+  void *state;
+  int i;
 
-  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  if (thread == job->threads)
   {
-    char *ring;
-    if (policy == RING_POLICY_APPEND)
+    job->checksum = XXH32(job->in, job->in_len, 0);
+    return;
+  }
+
+  // a missing state only makes the blocks be stored uncompressed
+  state = malloc(hc ? LZ4_sizeofStateHC() : LZ4_sizeofState());
+  for (i = thread; i < job->blocks; i += job->threads)
+  {
+    const char *src = job->in + (size_t)i * job->block_size;
+    char *dst = job->out + (size_t)i * job->slot_size;
+    int src_len = (int)(i == job->blocks - 1 ? job->in_len - (size_t)i * job->block_size : job->block_size);
+    int r = 0;
+
+    if (state != NULL)
+    {
+      if (hc)
+        r = LZ4_compress_HC_extStateHC(state, src, dst + 4, src_len, src_len - 1, job->level);
+      else
+        r = LZ4_compress_fast_extState(state, src, dst + 4, src_len, src_len - 1, 1);
+    }
+    if (r > 0)
+      _write_le32(dst, (unsigned int)r);
+    else
+    {
+      // incompressible block, stored as is
+      r = src_len;
+      _write_le32(dst, (unsigned int)r | 0x80000000U);
+      memcpy(dst + 4, src, r);
+    }
+    job->block_len[i] = 4 + (size_t)r;
+  }
+  free(state);
+}
+
+/*
+ * Compresses a frame of independent blocks with `threads` worker threads and
+ * pushes it. Every block is compressed into its own worst case slot of the
+ * output buffer, the slots are then compacted behind the frame header.
+ */
+static int _lz4_compress_parallel(lua_State *L, lz4_frame_context_t *ctx, const char *in, size_t in_len, LZ4F_preferences_t *settings, int threads)
+{
+  static const size_t block_sizes[] = { 65536, 262144, 1048576, 4194304 };
+  lz4_mt_compress_t job;
+  size_t header_len, bound, out_len;
+  char trailer[8];
+  int i;
+
+  settings->autoFlush = 1;
+  settings->frameInfo.blockMode = LZ4F_blockIndependent;
+  if (settings->frameInfo.blockSizeID == LZ4F_default) settings->frameInfo.blockSizeID = LZ4F_max64KB;
+  if (settings->frameInfo.blockSizeID < LZ4F_max64KB || settings->frameInfo.blockSizeID > LZ4F_max4MB)
+    return luaL_error(L, "compression failed: %s", LZ4F_getErrorName((size_t)-LZ4F_ERROR_maxBlockSize_invalid));
+  if (settings->frameInfo.contentSize) settings->frameInfo.contentSize = in_len;
+
+  job.in = in;
+  job.in_len = in_len;
+  job.block_size = block_sizes[settings->frameInfo.blockSizeID - LZ4F_max64KB];
+  job.slot_size = 4 + job.block_size;
+  job.blocks = (int)((in_len + job.block_size - 1) / job.block_size);
+  job.threads = threads < job.blocks ? threads : job.blocks;
+  job.level = settings->compressionLevel;
+  job.checksum = 0;
+
+  // all temporary memory is owned by userdata, nothing leaks on error
+  job.block_len = (size_t *)lua_newuserdata(L, (job.blocks > 0 ? job.blocks : 1) * sizeof(size_t));
+
+  bound = FRAME_HEADER_SIZE + job.blocks * job.slot_size + 8;
+  {
+    LUABUFF_NEW(b, out, bound)
+    header_len = LZ4F_compressBegin(ctx->cctx, out, bound, settings);
+    // the blocks bypass the context, end the empty frame to return it to its idle stage
+    if (!LZ4F_isError(header_len)) LZ4F_compressEnd(ctx->cctx, trailer, sizeof(trailer), NULL);
+    if (LZ4F_isError(header_len))
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(header_len));
+    }
+    job.out = out + header_len;
+
+    _lz4_run_threads(job.threads + (settings->frameInfo.contentChecksumFlag ? 1 : 0), _lz4_mt_compress_blocks, &job);
+
+    out_len = header_len;
+    for (i = 0; i < job.blocks; i++)
+    {
+      memmove(out + out_len, job.out + (size_t)i * job.slot_size, job.block_len[i]);
+      out_len += job.block_len[i];
+    }
+
+    _write_le32(out + out_len, 0);  // end mark
+    out_len += 4;
+    if (settings->frameInfo.contentChecksumFlag)
+    {
+      _write_le32(out + out_len, job.checksum);
+      out_len += 4;
+    }
+    LUABUFF_PUSH(b, out, out_len)
+  }
+  lua_remove(L, -2);  // the block lengths
+  return 1;
+}
+
+// frame dictionaries, defined in the Dictionary section
+static const char *_lz4_frame_dictionary(lua_State *L, int table_index, unsigned int *id, size_t *len);
+static const char *_lz4_registered_dictionary(lua_State *L, unsigned int id, size_t *len);
+static const char *_lz4_next_frame_dictionary(lua_State *L, const char *p, size_t p_len, size_t *len);
+
+static int lz4_compress(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  lz4_frame_context_t *ctx = _frame_context(L);
+  const char *dict = NULL;
+  size_t dict_len = 0;
+  size_t bound, r;
+  int threads;
+
+  LZ4F_preferences_t stack_settings;
+  LZ4F_preferences_t *settings = NULL;
+
+  if (lua_type(L, 2) == LUA_TTABLE)
+  {
+    settings = &stack_settings;
+    _lua_table_preferences(L, 2, settings);
+    // any non-zero value is replaced by the input length
+    settings->frameInfo.contentSize = _lua_table_optboolean(L, 2, "content_size", 0);
+    threads = _lua_table_optinteger(L, 2, "threads", 1);
+    luaL_argcheck(L, threads >= 1 && threads <= MAX_THREADS, 2, "threads out of range");
+    dict = _lz4_frame_dictionary(L, 2, &settings->frameInfo.dictID, &dict_len);
+    if (threads > 1 && in_len > 65536 && dict == NULL) return _lz4_compress_parallel(L, ctx, in, in_len, settings, threads);
+  }
+
+  bound = LZ4F_compressFrameBound(in_len, settings);
+
+  {
+    LUABUFF_NEW(b, out, bound)
+    r = LZ4F_compressFrame_usingDict(ctx->cctx, out, bound, in, in_len, dict, dict_len, settings);
+    if (LZ4F_isError(r))
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
+    }
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static unsigned int _read_le32(const char *p)
+{
+  const unsigned char *s = (const unsigned char *)p;
+  return (unsigned int)s[0] | ((unsigned int)s[1] << 8) | ((unsigned int)s[2] << 16) | ((unsigned int)s[3] << 24);
+}
+
+// dictionary ID of the frame header at p, 0 for none, skippable frames and incomplete headers
+static unsigned int _lz4_frame_dict_id(const char *p, size_t p_len)
+{
+  size_t offset;
+  if (p_len < 7 || _read_le32(p) != 0x184D2204U || !(p[4] & 0x01)) return 0;
+  offset = 6 + ((p[4] & 0x08) ? 8 : 0);
+  return p_len < offset + 4 ? 0 : _read_le32(p + offset);
+}
+
+typedef struct
+{
+  const char *src;
+  int src_len;
+  int stored;             // block is stored uncompressed
+  size_t dst_offset;      // slot of the block in the output buffer
+  int dst_capacity;
+  int dst_len;            // decompressed length, negative on error
+} lz4_mt_block_t;
+
+typedef struct
+{
+  lz4_mt_block_t *block;
+  char *out;
+  int blocks;
+  int threads;
+} lz4_mt_decompress_t;
+
+static void _lz4_mt_decompress_blocks(void *arg, int thread)
+{
+  lz4_mt_decompress_t *job = (lz4_mt_decompress_t *)arg;
+  int i;
+
+  for (i = thread; i < job->blocks; i += job->threads)
+  {
+    lz4_mt_block_t *block = &job->block[i];
+    char *dst = job->out + block->dst_offset;
+    if (block->stored)
+    {
+      memcpy(dst, block->src, block->src_len);
+      block->dst_len = block->src_len;
+    }
+    else
+      block->dst_len = LZ4_decompress_safe(block->src, dst, block->src_len, block->dst_capacity);
+  }
+}
+
+/*
+ * Decompresses a single frame of independent blocks with `threads` worker
+ * threads and pushes it. The block headers are scanned first, every block is
+ * then decoded into its own slot of the output buffer and the slots are
+ * compacted. Returns 0 without pushing anything if the input is not a single
+ * well formed frame, leaving the serial path to decode it or report the error.
+ */
+static int _lz4_decompress_parallel(lua_State *L, const char *in, size_t in_len, LZ4F_frameInfo_t *info, int threads)
+{
+  static const size_t block_sizes[] = { 65536, 262144, 1048576, 4194304 };
+  size_t block_size, header_len, pos, out_len, total = 0;
+  lz4_mt_decompress_t job;
+  int i, ok = 1;
+
+  if (info->blockSizeID < LZ4F_max64KB || info->blockSizeID > LZ4F_max4MB) return 0;
+  block_size = block_sizes[info->blockSizeID - LZ4F_max64KB];
+  header_len = 7 + ((in[4] & 0x08) ? 8 : 0) + ((in[4] & 0x01) ? 4 : 0);
+
+  // count the blocks and check that the frame ends exactly at the end of input
+  job.blocks = 0;
+  for (pos = header_len; pos + 4 <= in_len; )
+  {
+    size_t src_len = _read_le32(in + pos) & 0x7FFFFFFFU;
+    pos += 4;
+    if (src_len == 0) break;
+    if (src_len > block_size || src_len > in_len - pos) return 0;
+    pos += src_len;
+    job.blocks++;
+  }
+  if (info->contentChecksumFlag) pos += 4;
+  if (pos != in_len || job.blocks < 2) return 0;
+
+  // all temporary memory is owned by userdata, nothing leaks on error
+  job.block = (lz4_mt_block_t *)lua_newuserdata(L, job.blocks * sizeof(lz4_mt_block_t));
+  pos = header_len;
+  for (i = 0; i < job.blocks; i++)
+  {
+    lz4_mt_block_t *block = &job.block[i];
+    unsigned int header = _read_le32(in + pos);
+    block->src = in + pos + 4;
+    block->src_len = (int)(header & 0x7FFFFFFFU);
+    block->stored = (header & 0x80000000U) != 0;
+    block->dst_offset = total;
+    // LZ4 can not expand data more than 255 times
+    block->dst_capacity = block->stored ? block->src_len : (int)(block_size / 256 < (size_t)block->src_len ? block_size : (size_t)block->src_len * 256);
+    if (info->contentSize > 0)
+    {
+      // a content size in the header bounds the output, do not reserve more
+      if (total >= info->contentSize || (block->stored && (unsigned long long)block->src_len > info->contentSize - total))
+      {
+        lua_pop(L, 1);
+        return 0;
+      }
+      if ((unsigned long long)block->dst_capacity > info->contentSize - total) block->dst_capacity = (int)(info->contentSize - total);
+    }
+    total += block->dst_capacity;
+    pos += 4 + block->src_len;
+  }
+  job.threads = threads < job.blocks ? threads : job.blocks;
+
+  {
+    LUABUFF_NEW(b, out, total)
+    job.out = out;
+    _lz4_run_threads(job.threads, _lz4_mt_decompress_blocks, &job);
+
+    out_len = 0;
+    for (i = 0; i < job.blocks && ok; i++)
+    {
+      lz4_mt_block_t *block = &job.block[i];
+      if (block->dst_len < 0)
+        ok = 0;
+      else
+      {
+        if (block->dst_offset != out_len) memmove(out + out_len, out + block->dst_offset, block->dst_len);
+        out_len += block->dst_len;
+      }
+    }
+
+    if (ok && info->contentSize > 0 && info->contentSize != out_len) ok = 0;
+    if (ok && info->contentChecksumFlag && XXH32(out, out_len, 0) != _read_le32(in + in_len - 4)) ok = 0;
+    LUABUFF_PUSH(b, out, ok ? out_len : 0)
+  }
+  if (ok)
+    lua_remove(L, -2);  // the block table
+  else
+    lua_pop(L, 2);
+  return ok;
+}
+
+static int lz4_decompress(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  const char *p = in;
+  size_t p_len = in_len;
+
+  lz4_frame_context_t *ctx = _frame_context(L);
+  LZ4F_frameInfo_t info;
+  LZ4F_errorCode_t code;
+  const char *dict = NULL;
+  size_t dict_len = 0;
+  unsigned int dict_id;
+  size_t advance;
+  int threads = 1;
+  int dict_given;
+
+  if (lua_type(L, 2) == LUA_TTABLE)
+  {
+    threads = _lua_table_optinteger(L, 2, "threads", 1);
+    luaL_argcheck(L, threads >= 1 && threads <= MAX_THREADS, 2, "threads out of range");
+    dict = _lz4_frame_dictionary(L, 2, &dict_id, &dict_len);
+  }
+  dict_given = dict != NULL;
+
+  LZ4F_resetDecompressionContext(ctx->dctx);
+
+  advance = p_len;
+  code = LZ4F_getFrameInfo(ctx->dctx, &info, p, &advance);
+  if (LZ4F_isError(code)) info.contentSize = 0; // let LZ4F_decompress() complete the header or report the error
+  else if (dict == NULL && info.dictID != 0)
+    dict = _lz4_registered_dictionary(L, info.dictID, &dict_len);
+  if (!LZ4F_isError(code) && threads > 1 && dict == NULL && info.frameType == LZ4F_frame
+      && info.blockMode == LZ4F_blockIndependent && _lz4_decompress_parallel(L, in, in_len, &info, threads))
+    return 1;
+  p += advance;
+  p_len -= advance;
+
+  {
+    // all temporary memory is owned by userdata, nothing leaks on error
+    lz4_buffer_t *buf = _lz4_new_buffer(L);
+    // LZ4 can not expand data more than 255 times, do not trust a larger content size
+    if (info.contentSize > 0 && info.contentSize / 255 <= in_len && (size_t)info.contentSize == info.contentSize)
+      _lz4_buffer_reserve(L, buf, (size_t)info.contentSize);
+    while (1)
+    {
+      size_t out_len;
+      if (buf->length == buf->capacity) // grow geometrically
+        _lz4_buffer_reserve(L, buf, buf->length + (buf->length > 65536 ? buf->length : 65536));
+      out_len = buf->capacity - buf->length;
+      advance = p_len;
+      code = LZ4F_decompress_usingDict(ctx->dctx, buf->data + buf->length, &out_len, p, &advance, dict, dict_len, NULL);
+      if (LZ4F_isError(code)) goto decompression_failed;
+      if (out_len == 0 && advance == 0) break; // truncated input
+      p += advance;
+      p_len -= advance;
+      buf->length += out_len;
+      if (code == 0 && p_len == 0) break; // end of last frame
+      // the context is at a frame boundary, go on with the next frame
+      if (code == 0 && !dict_given) dict = _lz4_next_frame_dictionary(L, p, p_len, &dict_len);
+    }
+    lua_pushlstring(L, buf->data != NULL ? buf->data : "", buf->length);
+    // release the block now rather than at the next collection
+    free(buf->data);
+    buf->data = NULL;
+    buf->capacity = 0;
+  }
+
+  return 1;
+
+decompression_failed:
+  LZ4F_resetDecompressionContext(ctx->dctx);
+  return luaL_error(L, "decompression failed: %s", LZ4F_getErrorName(code));
+}
+
+static int lz4_compress_into(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  size_t in_len;
+  const char *in = _checkinput(L, 2, &in_len);
+  size_t offset = _lz4_buffer_optoffset(L, 3, buf);
+  lz4_frame_context_t *ctx = _frame_context(L);
+  const char *dict = NULL;
+  size_t dict_len = 0;
+  size_t bound, r;
+
+  LZ4F_preferences_t stack_settings;
+  LZ4F_preferences_t *settings = NULL;
+
+  luaL_argcheck(L, !lua_rawequal(L, 1, 2), 2, "input must not be the output buffer");
+
+  if (lua_type(L, 4) == LUA_TTABLE)
+  {
+    settings = &stack_settings;
+    _lua_table_preferences(L, 4, settings);
+    settings->frameInfo.contentSize = _lua_table_optboolean(L, 4, "content_size", 0);
+    dict = _lz4_frame_dictionary(L, 4, &settings->frameInfo.dictID, &dict_len);
+  }
+
+  bound = LZ4F_compressFrameBound(in_len, settings);
+  _lz4_buffer_reserve(L, buf, offset + bound);
+
+  r = LZ4F_compressFrame_usingDict(ctx->cctx, buf->data + offset, bound, in, in_len, dict, dict_len, settings);
+  if (LZ4F_isError(r)) return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
+  buf->length = offset + r;
+
+  lua_pushinteger(L, r);
+
+  return 1;
+}
+
+static int lz4_decompress_into(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  size_t in_len;
+  const char *p = _checkinput(L, 2, &in_len);
+  size_t p_len = in_len;
+  size_t offset = _lz4_buffer_optoffset(L, 3, buf);
+  size_t length = offset;
+  lz4_frame_context_t *ctx = _frame_context(L);
+  LZ4F_frameInfo_t info;
+  LZ4F_errorCode_t code;
+  const char *dict = NULL;
+  size_t dict_len = 0;
+  size_t advance = p_len;
+
+  luaL_argcheck(L, !lua_rawequal(L, 1, 2), 2, "input must not be the output buffer");
+
+  LZ4F_resetDecompressionContext(ctx->dctx);
+
+  code = LZ4F_getFrameInfo(ctx->dctx, &info, p, &advance);
+  if (LZ4F_isError(code)) info.contentSize = 0; // let LZ4F_decompress() complete the header or report the error
+  else if (info.dictID != 0)
+    dict = _lz4_registered_dictionary(L, info.dictID, &dict_len);
+  p += advance;
+  p_len -= advance;
+
+  // LZ4 can not expand data more than 255 times, do not trust a larger content size
+  if (info.contentSize > 0 && info.contentSize / 255 <= in_len && (size_t)info.contentSize == info.contentSize)
+    _lz4_buffer_reserve(L, buf, offset + (size_t)info.contentSize);
+
+  while (1)
+  {
+    size_t out_len;
+    if (buf->capacity - length < 65536) // grow geometrically
+      _lz4_buffer_reserve(L, buf, length + (length > 65536 ? length : 65536));
+    out_len = buf->capacity - length;
+    advance = p_len;
+    code = LZ4F_decompress_usingDict(ctx->dctx, buf->data + length, &out_len, p, &advance, dict, dict_len, NULL);
+    if (LZ4F_isError(code))
+    {
+      LZ4F_resetDecompressionContext(ctx->dctx);
+      return luaL_error(L, "decompression failed: %s", LZ4F_getErrorName(code));
+    }
+    if (out_len == 0) break;
+    p += advance;
+    p_len -= advance;
+    length += out_len;
+    if (code == 0 && p_len == 0) break; // end of last frame
+    if (code == 0) dict = _lz4_next_frame_dictionary(L, p, p_len, &dict_len);
+  }
+  buf->length = length;
+
+  lua_pushinteger(L, length - offset);
+
+  return 1;
+}
+
+static int lz4_frame_info(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  lz4_frame_context_t *ctx = _frame_context(L);
+  LZ4F_frameInfo_t info;
+  LZ4F_errorCode_t code;
+  size_t advance = in_len;
+
+  LZ4F_resetDecompressionContext(ctx->dctx);
+  code = LZ4F_getFrameInfo(ctx->dctx, &info, in, &advance);
+  LZ4F_resetDecompressionContext(ctx->dctx);
+  if (LZ4F_isError(code)) return luaL_error(L, "invalid frame header: %s", LZ4F_getErrorName(code));
+
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, info.blockSizeID);
+  lua_setfield(L, -2, "block_size");
+  lua_pushboolean(L, info.blockMode == LZ4F_blockIndependent);
+  lua_setfield(L, -2, "block_independent");
+  lua_pushboolean(L, info.contentChecksumFlag == LZ4F_contentChecksumEnabled);
+  lua_setfield(L, -2, "content_checksum");
+  lua_pushboolean(L, info.frameType == LZ4F_skippableFrame);
+  lua_setfield(L, -2, "skippable");
+  if (info.contentSize > 0)
+  {
+#if LUA_VERSION_NUM >= 503
+    lua_pushinteger(L, (lua_Integer)info.contentSize);
+#else
+    lua_pushnumber(L, (lua_Number)info.contentSize);
+#endif
+    lua_setfield(L, -2, "content_size");
+  }
+  if (info.dictID != 0)
+  {
+#if LUA_VERSION_NUM >= 503
+    lua_pushinteger(L, (lua_Integer)info.dictID);
+#else
+    lua_pushnumber(L, (lua_Number)info.dictID);
+#endif
+    lua_setfield(L, -2, "dictionary_id");
+  }
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Block
+ ****************************************************************************/
+
+static int lz4_block_compress(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int accelerate = luaL_optinteger(L, 2, 0);
+  int bound, r;
+
+  if (in_len > LZ4_MAX_INPUT_SIZE)
+    return luaL_error(L, "input longer than %d", LZ4_MAX_INPUT_SIZE);
+
+  bound = LZ4_compressBound(in_len);
+
+  {
+    LUABUFF_NEW(b, out, bound)
+    r = LZ4_compress_fast(in, out, in_len, bound, accelerate);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+/*
+ * The HC state of lz4.block_compress_hc is cached per lua_State. It is never
+ * cleared again, each call indexes its input above the previous ones, so a
+ * small input costs its size and not the 256KB of tables.
+ */
+static void *_hc_state(lua_State *L)
+{
+  void *p;
+
+  lua_getfield(L, LUA_REGISTRYINDEX, "lz4.hc_state");
+  p = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+
+  if (p == NULL)
+  {
+    p = lua_newuserdata(L, LZ4_sizeofStateHC());
+    memset(p, 0, LZ4_sizeofStateHC());
+    lua_setfield(L, LUA_REGISTRYINDEX, "lz4.hc_state");
+  }
+
+  return p;
+}
+
+static int lz4_block_compress_hc(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int level = luaL_optinteger(L, 2, 0);
+  void *state;
+  int bound, r;
+
+  if (in_len > LZ4_MAX_INPUT_SIZE)
+    return luaL_error(L, "input longer than %d", LZ4_MAX_INPUT_SIZE);
+
+  bound = LZ4_compressBound(in_len);
+  state = _hc_state(L);
+
+  {
+    LUABUFF_NEW(b, out, bound)
+    r = LZ4_compress_HC_extStateHC_fastReset(state, in, out, in_len, bound, level);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static int lz4_block_decompress_safe(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int out_len = luaL_checkinteger(L, 2);
+  int r;
+
+  LUABUFF_NEW(b, out, out_len)
+  r = LZ4_decompress_safe(in, out, in_len, out_len);
+  if (r < 0)
+  {
+    LUABUFF_FREE(out)
+    return luaL_error(L, "corrupt input or need more output space");
+  }
+  LUABUFF_PUSH(b, out, r)
+
+  return 1;
+}
+
+static int lz4_block_decompress_fast(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int out_len = luaL_checkinteger(L, 2);
+
+  {
+    int r;
+    LUABUFF_NEW(b, out, out_len)
+    r = LZ4_decompress_fast(in, out, out_len);
+    if (r < 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "corrupt input or incorrect output length");
+    }
+    LUABUFF_PUSH(b, out, out_len)
+  }
+
+  return 1;
+}
+
+static int lz4_block_decompress_safe_partial(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int target_len = luaL_checkinteger(L, 2);
+  int out_len = luaL_checkinteger(L, 3);
+  int r;
+
+  LUABUFF_NEW(b, out, out_len)
+  r = LZ4_decompress_safe_partial(in, out, in_len, target_len, out_len);
+  if (r < 0)
+  {
+    LUABUFF_FREE(out)
+    return luaL_error(L, "corrupt input or need more output space");
+  }
+  if (target_len < r) r = target_len;
+  LUABUFF_PUSH(b, out, r)
+
+  return 1;
+}
+
+static int lz4_block_compress_into(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  size_t in_len;
+  const char *in = _checkinput(L, 2, &in_len);
+  size_t offset = _lz4_buffer_optoffset(L, 3, buf);
+  int accelerate = luaL_optinteger(L, 4, 0);
+  int bound, r;
+
+  luaL_argcheck(L, !lua_rawequal(L, 1, 2), 2, "input must not be the output buffer");
+
+  if (in_len > LZ4_MAX_INPUT_SIZE)
+    return luaL_error(L, "input longer than %d", LZ4_MAX_INPUT_SIZE);
+
+  bound = LZ4_compressBound(in_len);
+  _lz4_buffer_reserve(L, buf, offset + bound);
+
+  r = LZ4_compress_fast(in, buf->data + offset, in_len, bound, accelerate);
+  if (r == 0) return luaL_error(L, "compression failed");
+  buf->length = offset + r;
+
+  lua_pushinteger(L, r);
+
+  return 1;
+}
+
+static int lz4_block_decompress_into(lua_State *L)
+{
+  lz4_buffer_t *buf = _checkbuffer(L, 1);
+  size_t in_len;
+  const char *in = _checkinput(L, 2, &in_len);
+  int out_len = luaL_checkinteger(L, 3);
+  size_t offset = _lz4_buffer_optoffset(L, 4, buf);
+  int r;
+
+  luaL_argcheck(L, !lua_rawequal(L, 1, 2), 2, "input must not be the output buffer");
+  luaL_argcheck(L, out_len >= 0, 3, "negative length");
+  _lz4_buffer_reserve(L, buf, offset + out_len);
+
+  r = LZ4_decompress_safe(in, buf->data + offset, in_len, out_len);
+  if (r < 0) return luaL_error(L, "corrupt input or need more output space");
+  buf->length = offset + r;
+
+  lua_pushinteger(L, r);
+
+  return 1;
+}
+
+static const char *_lz4_batch_string(lua_State *L, int table_index, int i, size_t *len)
+{
+  const char *s;
+  lua_rawgeti(L, table_index, i);
+  if (lua_type(L, -1) != LUA_TSTRING) luaL_error(L, "element %d must be a string", i);
+  s = lua_tolstring(L, -1, len);
+  lua_pop(L, 1);  // the string is still referenced by the table
+  return s;
+}
+
+static int lz4_block_compress_batch(lua_State *L)
+{
+  int accelerate = luaL_optinteger(L, 2, 0);
+  LZ4_stream_t state;
+  size_t in_len, bound = 0;
+  const char *in;
+  char *out;
+  int n, i, r;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = (int)lua_rawlen(L, 1);
+
+  for (i = 1; i <= n; i++)
+  {
+    _lz4_batch_string(L, 1, i, &in_len);
+    if (in_len > LZ4_MAX_INPUT_SIZE)
+      return luaL_error(L, "element %d longer than %d", i, LZ4_MAX_INPUT_SIZE);
+    if ((size_t)LZ4_compressBound(in_len) > bound) bound = LZ4_compressBound(in_len);
+  }
+
+  // one scratch output for the whole batch, collected with the userdata
+  out = (char *)lua_newuserdata(L, bound > 0 ? bound : 1);
+  lua_createtable(L, n, 0);
+  for (i = 1; i <= n; i++)
+  {
+    in = _lz4_batch_string(L, 1, i, &in_len);
+    r = LZ4_compress_fast_extState(&state, in, out, in_len, bound, accelerate);
+    if (r == 0) return luaL_error(L, "compression failed at element %d", i);
+    lua_pushlstring(L, out, r);
+    lua_rawseti(L, -2, i);
+  }
+
+  return 1;
+}
+
+static int lz4_block_decompress_batch(lua_State *L)
+{
+  size_t in_len, out_len = 0;
+  const char *in;
+  char *out;
+  int n, i, r;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  n = (int)lua_rawlen(L, 1);
+
+  for (i = 1; i <= n; i++)
+  {
+    lua_rawgeti(L, 2, i);
+    if (lua_type(L, -1) != LUA_TNUMBER) return luaL_error(L, "size %d must be a number", i);
+    r = lua_tointeger(L, -1);
+    if (r < 0) return luaL_error(L, "size %d is negative", i);
+    if ((size_t)r > out_len) out_len = r;
+    lua_pop(L, 1);
+  }
+
+  out = (char *)lua_newuserdata(L, out_len > 0 ? out_len : 1);
+  lua_createtable(L, n, 0);
+  for (i = 1; i <= n; i++)
+  {
+    in = _lz4_batch_string(L, 1, i, &in_len);
+    lua_rawgeti(L, 2, i);
+    r = LZ4_decompress_safe(in, out, in_len, lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    if (r < 0) return luaL_error(L, "corrupt input or need more output space at element %d", i);
+    lua_pushlstring(L, out, r);
+    lua_rawseti(L, -2, i);
+  }
+
+  return 1;
+}
+
+static int lz4_block_compress_dest_size(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int target_len = luaL_checkinteger(L, 2);
+  int consumed = in_len > LZ4_MAX_INPUT_SIZE ? LZ4_MAX_INPUT_SIZE : (int)in_len;
+  int r;
+
+  luaL_argcheck(L, target_len > 0, 2, "target size must be positive");
+
+  {
+    LUABUFF_NEW(b, out, target_len)
+    r = LZ4_compress_destSize(in, out, &consumed, target_len);
+    if (r == 0 && in_len > 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    LUABUFF_PUSH(b, out, r)
+  }
+  lua_pushinteger(L, consumed);
+
+  return 2;
+}
+
+static int lz4_block_compress_slices(lua_State *L)
+{
+  size_t in_len, pos = 0;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int target_len = luaL_checkinteger(L, 2);
+  int i = 0;
+  char *out;
+
+  luaL_argcheck(L, target_len > 0, 2, "target size must be positive");
+
+  out = (char *)lua_newuserdata(L, target_len);
+  lua_newtable(L);  // blocks
+  lua_newtable(L);  // sizes
+  while (pos < in_len)
+  {
+    size_t left = in_len - pos;
+    int consumed = left > LZ4_MAX_INPUT_SIZE ? LZ4_MAX_INPUT_SIZE : (int)left;
+    int r = LZ4_compress_destSize(in + pos, out, &consumed, target_len);
+    if (r == 0 || consumed == 0) return luaL_error(L, "target size %d too small", target_len);
+    i++;
+    lua_pushlstring(L, out, r);
+    lua_rawseti(L, -3, i);
+    lua_pushinteger(L, consumed);
+    lua_rawseti(L, -2, i);
+    pos += consumed;
+  }
+
+  return 2;
+}
+
+/*****************************************************************************
+ * Dictionary
+ ****************************************************************************/
+
+/*
+ * A prepared dictionary keeps the last 64KB of the dictionary and an
+ * LZ4_stream_t already hashed over it. Compression clones the stream with a
+ * memcpy instead of running LZ4_loadDict for every input.
+ */
+
+typedef struct
+{
+  LZ4_stream_t stream;
+  int size;
+  char *data;             // points right after the structure, in the same userdata
+} lz4_dictionary_t;
+
+static lz4_dictionary_t *_checkdictionary(lua_State *L, int index)
+{
+  return (lz4_dictionary_t *)luaL_checkudata(L, index, "lz4.dictionary");
+}
+
+// accept a dictionary string or a prepared lz4.dictionary
+static const char *_checkdictdata(lua_State *L, int index, int *len, lz4_dictionary_t **prepared)
+{
+  size_t dict_len;
+  const char *dict;
+
+  *prepared = NULL;
+  if (lua_type(L, index) == LUA_TUSERDATA)
+  {
+    *prepared = _checkdictionary(L, index);
+    *len = (*prepared)->size;
+    return (*prepared)->data;
+  }
+
+  dict = luaL_checklstring(L, index, &dict_len);
+  if (dict_len > LZ4_DICTSIZE)
+  {
+    dict += dict_len - LZ4_DICTSIZE;
+    dict_len = LZ4_DICTSIZE;
+  }
+  *len = (int)dict_len;
+  return dict;
+}
+
+static int lz4_block_compress_dict(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int accelerate = luaL_optinteger(L, 3, 0);
+  lz4_dictionary_t *prepared;
+  LZ4_stream_t stream;
+  int dict_len, bound, r;
+  const char *dict = _checkdictdata(L, 2, &dict_len, &prepared);
+
+  if (in_len > LZ4_MAX_INPUT_SIZE)
+    return luaL_error(L, "input longer than %d", LZ4_MAX_INPUT_SIZE);
+
+  if (prepared != NULL)
+    memcpy(&stream, &prepared->stream, sizeof(stream));
+  else
+  {
+    LZ4_resetStream(&stream);
+    LZ4_loadDict(&stream, dict, dict_len);
+  }
+
+  bound = LZ4_compressBound(in_len);
+
+  {
+    LUABUFF_NEW(b, out, bound)
+    r = LZ4_compress_fast_continue(&stream, in, out, in_len, bound, accelerate);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static int lz4_block_decompress_safe_dict(lua_State *L)
+{
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 1, &in_len);
+  int out_len = luaL_checkinteger(L, 2);
+  lz4_dictionary_t *prepared;
+  int dict_len, r;
+  const char *dict = _checkdictdata(L, 3, &dict_len, &prepared);
+
+  LUABUFF_NEW(b, out, out_len)
+  r = LZ4_decompress_safe_usingDict(in, out, in_len, out_len, dict, dict_len);
+  if (r < 0)
+  {
+    LUABUFF_FREE(out)
+    return luaL_error(L, "corrupt input or need more output space");
+  }
+  LUABUFF_PUSH(b, out, r)
+
+  return 1;
+}
+
+static int lz4_dictionary_len(lua_State *L)
+{
+  lz4_dictionary_t *p = _checkdictionary(L, 1);
+  lua_pushinteger(L, p->size);
+  return 1;
+}
+
+static int lz4_dictionary_tostring(lua_State *L)
+{
+  lz4_dictionary_t *p = _checkdictionary(L, 1);
+  lua_pushfstring(L, "lz4.dictionary (%p)", p);
+  return 1;
+}
+
+static int lz4_new_dictionary(lua_State *L)
+{
+  size_t dict_len;
+  const char *dict = luaL_checklstring(L, 1, &dict_len);
+  lz4_dictionary_t *p;
+
+  if (dict_len > LZ4_DICTSIZE)
+  {
+    dict += dict_len - LZ4_DICTSIZE;
+    dict_len = LZ4_DICTSIZE;
+  }
+
+  p = (lz4_dictionary_t *)lua_newuserdata(L, sizeof(lz4_dictionary_t) + dict_len);
+  p->size = (int)dict_len;
+  p->data = (char *)(p + 1);
+  memcpy(p->data, dict, dict_len);
+  LZ4_resetStream(&p->stream);
+  LZ4_loadDict(&p->stream, p->data, p->size);
+
+  if (luaL_newmetatable(L, "lz4.dictionary"))
+  {
+    // metatable.__len
+    lua_pushcfunction(L, lz4_dictionary_len);
+    lua_setfield(L, -2, "__len");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_dictionary_tostring);
+    lua_setfield(L, -2, "__tostring");
+  }
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
+/*
+ * Frame dictionaries are registered by ID in the "lz4.dictionaries" table of
+ * the Lua registry, lz4.decompress looks up the ID found in the frame header.
+ */
+
+static unsigned int _checkdictid(lua_State *L, lua_Number id, int arg)
+{
+  if (!(id >= 1 && id <= 4294967295.0 && id == (lua_Number)(unsigned int)id))
+    luaL_argerror(L, arg, "dictionary id out of range");
+  return (unsigned int)id;
+}
+
+static const char *_lz4_registered_dictionary(lua_State *L, unsigned int id, size_t *len)
+{
+  const char *dict = NULL;
+  lz4_dictionary_t *prepared;
+  int dict_len = 0;
+
+  lua_getfield(L, LUA_REGISTRYINDEX, "lz4.dictionaries");
+  if (lua_istable(L, -1))
+  {
+    lua_pushnumber(L, (lua_Number)id);
+    lua_rawget(L, -2);
+    // the registry keeps the dictionary alive
+    if (!lua_isnil(L, -1)) dict = _checkdictdata(L, lua_gettop(L), &dict_len, &prepared);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  if (dict == NULL)
+  {
+    char name[16];
+    sprintf(name, "%u", id);
+    luaL_error(L, "dictionary %s not registered", name);
+  }
+  *len = dict_len;
+  return dict;
+}
+
+// reads the `dictionary` and `dictionary_id` fields of an options table
+static const char *_lz4_frame_dictionary(lua_State *L, int table_index, unsigned int *id, size_t *len)
+{
+  const char *dict = NULL;
+  lz4_dictionary_t *prepared;
+  int dict_len = 0;
+  int type;
+
+  *id = 0;
+  lua_getfield(L, table_index, "dictionary_id");
+  type = lua_type(L, -1);
+  if (type != LUA_TNIL)
+  {
+    if (type != LUA_TNUMBER) luaL_error(L, "field '%s' must be a number", "dictionary_id");
+    *id = _checkdictid(L, lua_tonumber(L, -1), table_index);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, table_index, "dictionary");
+  type = lua_type(L, -1);
+  if (type != LUA_TNIL)
+  {
+    // the options table keeps the dictionary alive
+    if (type != LUA_TSTRING && type != LUA_TUSERDATA) luaL_error(L, "field '%s' must be a string or lz4.dictionary", "dictionary");
+    dict = _checkdictdata(L, lua_gettop(L), &dict_len, &prepared);
+  }
+  lua_pop(L, 1);
+
+  *len = dict_len;
+  if (dict == NULL && *id != 0) dict = _lz4_registered_dictionary(L, *id, len);
+  return dict;
+}
+
+// each of concatenated frames names its own dictionary
+static const char *_lz4_next_frame_dictionary(lua_State *L, const char *p, size_t p_len, size_t *len)
+{
+  unsigned int id = _lz4_frame_dict_id(p, p_len);
+  *len = 0;
+  return id != 0 ? _lz4_registered_dictionary(L, id, len) : NULL;
+}
+
+static int lz4_register_dictionary(lua_State *L)
+{
+  unsigned int id = _checkdictid(L, luaL_checknumber(L, 1), 1);
+  lz4_dictionary_t *prepared;
+  int dict_len;
+
+  if (!lua_isnoneornil(L, 2)) _checkdictdata(L, 2, &dict_len, &prepared);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, "lz4.dictionaries");
+  if (!lua_istable(L, -1))
+  {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, "lz4.dictionaries");
+  }
+  lua_pushnumber(L, (lua_Number)id);
+  if (lua_isnoneornil(L, 2))
+    lua_pushnil(L);
+  else
+    lua_pushvalue(L, 2);
+  lua_rawset(L, -3);
+
+  return 0;
+}
+
+/*
+ * Dictionary trainer, a simplified COVER algorithm. Every 6 byte substring
+ * (d-mer) is scored by the number of samples containing it. The samples are
+ * cut into epochs and the 64 byte segment with the highest total score of
+ * distinct d-mers is picked from each epoch in turn; the d-mers of a picked
+ * segment score nothing afterward. Picked segments are laid out by score so
+ * the most valuable ones end up at the end of the dictionary, closest to the
+ * data being compressed.
+ */
+
+#define TRAIN_DMER          6
+#define TRAIN_SEGMENT       64
+#define TRAIN_HASH_LOG      20
+#define TRAIN_NO_DMER       0xFFFFFFFFU
+
+typedef struct
+{
+  size_t offset;
+  size_t length;
+  unsigned int score;
+} lz4_segment_t;
+
+typedef struct
+{
+  const unsigned char *data;
+  size_t length;
+  unsigned int *dmer;     // hash of the d-mer at each position, TRAIN_NO_DMER if it crosses a sample end
+  unsigned int *freq;     // number of samples containing each d-mer hash
+  unsigned int *active;   // occurrences of each d-mer hash in the current window
+} lz4_trainer_t;
+
+static unsigned int _train_hash(const unsigned char *p)
+{
+  unsigned int h = 0;
+  int i;
+  for (i = 0; i < TRAIN_DMER; i++) h = (h + p[i]) * 2654435761U;
+  return h >> (32 - TRAIN_HASH_LOG);
+}
+
+// best segment starting in [begin, end), the score is 0 if nothing is left to gain
+static lz4_segment_t _train_select(lz4_trainer_t *t, size_t begin, size_t end)
+{
+  const size_t window = TRAIN_SEGMENT - TRAIN_DMER + 1;
+  lz4_segment_t best;
+  unsigned int score = 0;
+  size_t head, tail = begin;
+
+  best.offset = begin;
+  best.length = TRAIN_SEGMENT;
+  best.score = 0;
+  for (head = begin; head < end; head++)
+  {
+    unsigned int h = t->dmer[head];
+    if (h != TRAIN_NO_DMER && t->active[h]++ == 0) score += t->freq[h];
+    if (head - tail + 1 > window)
+    {
+      h = t->dmer[tail++];
+      if (h != TRAIN_NO_DMER && --t->active[h] == 0) score -= t->freq[h];
+    }
+    if (score > best.score)
+    {
+      best.offset = tail;
+      best.score = score;
+    }
+  }
+  for (; tail < end; tail++)
+    if (t->dmer[tail] != TRAIN_NO_DMER) t->active[t->dmer[tail]] = 0;
+
+  return best;
+}
+
+static int _train_compare(const void *a, const void *b)
+{
+  unsigned int x = ((const lz4_segment_t *)a)->score, y = ((const lz4_segment_t *)b)->score;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Writes a dictionary of at most `size` bytes at the end of `dict` and returns
+ * its length, or (size_t)-1 if out of memory. `sample_end` holds the end
+ * offset of every sample in `data`.
+ */
+static size_t _lz4_train_dictionary(const char *data, size_t length, const size_t *sample_end, int samples, char *dict, size_t size)
+{
+  lz4_trainer_t t;
+  lz4_segment_t *segment;
+  size_t max_segments = size / TRAIN_SEGMENT + 1, segments = 0;
+  size_t epochs, epoch_size, p, dict_len = 0;
+  int i, idle = 0;
+
+  if (length < TRAIN_DMER || size == 0) return 0;
+
+  t.data = (const unsigned char *)data;
+  t.length = length;
+  t.dmer = (unsigned int *)malloc(length * sizeof(unsigned int));
+  t.freq = (unsigned int *)calloc(1 << TRAIN_HASH_LOG, sizeof(unsigned int));
+  t.active = (unsigned int *)calloc(1 << TRAIN_HASH_LOG, sizeof(unsigned int));
+  segment = (lz4_segment_t *)malloc(max_segments * sizeof(lz4_segment_t));
+  if (t.dmer == NULL || t.freq == NULL || t.active == NULL || segment == NULL)
+  {
+    dict_len = (size_t)-1;
+    goto done;
+  }
+
+  // count every d-mer once per sample, t.active remembers the last sample seen;
+  // a single sample counts every occurrence instead
+  for (i = 0, p = 0; i < samples; i++)
+  {
+    for (; p < sample_end[i]; p++)
+    {
+      unsigned int h;
+      if (p + TRAIN_DMER > sample_end[i])
+      {
+        t.dmer[p] = TRAIN_NO_DMER;
+        continue;
+      }
+      h = t.dmer[p] = _train_hash(t.data + p);
+      if (samples == 1 || t.active[h] != (unsigned int)i + 1)
+      {
+        t.active[h] = i + 1;
+        t.freq[h]++;
+      }
+    }
+  }
+  memset(t.active, 0, (1 << TRAIN_HASH_LOG) * sizeof(unsigned int));
+  // a d-mer seen in a single sample is not worth a place in the dictionary
+  for (p = 0; p < (1 << TRAIN_HASH_LOG); p++)
+    if (t.freq[p] < 2) t.freq[p] = 0;
+
+  epochs = size / TRAIN_SEGMENT;
+  epoch_size = length / (epochs > 0 ? epochs : 1);
+  if (epoch_size < 4 * TRAIN_SEGMENT) epoch_size = 4 * TRAIN_SEGMENT;
+  epochs = (length + epoch_size - 1) / epoch_size;
+
+  for (p = 0; dict_len < size && idle < (int)epochs; p = (p + 1) % epochs)
+  {
+    size_t begin = p * epoch_size, end = begin + epoch_size, q, seg_end;
+    lz4_segment_t best;
+    if (end > length) end = length;
+    best = _train_select(&t, begin, end);
+    if (best.score == 0)
+    {
+      idle++;
+      continue;
+    }
+    idle = 0;
+
+    seg_end = best.offset + TRAIN_SEGMENT;
+    if (seg_end > length) seg_end = length;
+    if (seg_end - best.offset > size - dict_len) seg_end = best.offset + size - dict_len;
+    for (q = best.offset; q + TRAIN_DMER <= seg_end; q++)
+      if (t.dmer[q] != TRAIN_NO_DMER) t.freq[t.dmer[q]] = 0;
+
+    best.length = seg_end - best.offset;
+    // segments cut short by the end of the data fill less than TRAIN_SEGMENT bytes each
+    if (segments == max_segments)
+    {
+      lz4_segment_t *grown = (lz4_segment_t *)realloc(segment, 2 * max_segments * sizeof(lz4_segment_t));
+      if (grown == NULL)
+      {
+        dict_len = (size_t)-1;
+        goto done;
+      }
+      segment = grown;
+      max_segments *= 2;
+    }
+    segment[segments++] = best;
+    dict_len += best.length;
+  }
+
+  // lowest scores first, the best segment is written last
+  qsort(segment, segments, sizeof(lz4_segment_t), _train_compare);
+  {
+    char *out = dict + size - dict_len;
+    for (p = 0; p < segments; p++)
+    {
+      memcpy(out, data + segment[p].offset, segment[p].length);
+      out += segment[p].length;
+    }
+  }
+
+done:
+  free(t.dmer);
+  free(t.freq);
+  free(t.active);
+  free(segment);
+  return dict_len;
+}
+
+static int lz4_train_dictionary(lua_State *L)
+{
+  int size = luaL_optinteger(L, 2, LZ4_DICTSIZE);
+  size_t length = 0, len, r;
+  size_t *sample_end;
+  char *data, *dict;
+  int n, i;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_argcheck(L, size > 0 && size <= LZ4_DICTSIZE, 2, "size out of range");
+  n = (int)lua_rawlen(L, 1);
+  for (i = 1; i <= n; i++)
+  {
+    _lz4_batch_string(L, 1, i, &len);
+    length += len;
+  }
+
+  // all temporary memory is owned by userdata, nothing leaks on error
+  sample_end = (size_t *)lua_newuserdata(L, (n > 0 ? n : 1) * sizeof(size_t));
+  data = (char *)lua_newuserdata(L, length > 0 ? length : 1);
+  dict = (char *)lua_newuserdata(L, size);
+  for (i = 1, length = 0; i <= n; i++)
+  {
+    const char *s = _lz4_batch_string(L, 1, i, &len);
+    memcpy(data + length, s, len);
+    length += len;
+    sample_end[i - 1] = length;
+  }
+
+  r = _lz4_train_dictionary(data, length, sample_end, n, dict, size);
+  if (r == (size_t)-1) return luaL_error(L, "out of memory");
+  lua_pushlstring(L, dict + size - r, r);
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Compression Stream
+ ****************************************************************************/
+
+typedef struct
+{
+  LZ4_streamHashLog_t *handle;
+  int accelerate;
+  int buffer_size;
+  int buffer_position;
+  char *buffer;
+  lz4_buffer_t *view;   // lz4.buffer viewing the next block, NULL until writable() creates it
+  int view_position;    // buffer_position when the view was placed
+  char *external;       // views of blocks which do not fit in the ring
+  size_t external_size;
+} lz4_compress_stream_t;
+
+static lz4_compress_stream_t *_checkcompressionstream(lua_State *L, int index)
+{
+  return (lz4_compress_stream_t *)luaL_checkudata(L, index, "lz4.compression_stream");
+}
+
+// the view can no longer write into the ring
+static void _lz4_cs_release_view(lz4_compress_stream_t *cs)
+{
+  if (cs->view != NULL)
+  {
+    cs->view->data = NULL;
+    cs->view->capacity = 0;
+    cs->view->length = 0;
+  }
+}
+
+static int lz4_cs_reset(lua_State *L)
+{
+  lz4_compress_stream_t *cs = _checkcompressionstream(L, 1);
+  size_t in_len = 0;
+  const char *in = luaL_optlstring(L, 2, NULL, &in_len);
+
+  _lz4_cs_release_view(cs);
+  if (in != NULL && in_len > 0)
+  {
+    int limit_len = LZ4_DICTSIZE;
+    if (limit_len > cs->buffer_size) limit_len = cs->buffer_size;
+    if (in_len > limit_len)
+    {
+      in = in + in_len - limit_len;
+      in_len = limit_len;
+    }
+    memcpy(cs->buffer, in, in_len);
+    cs->buffer_position = LZ4_loadDictHashLog(cs->handle, cs->buffer, in_len);
+  }
+  else
+  {
+    LZ4_resetStreamHashLog(cs->handle);
+    cs->buffer_position = 0;
+  }
+
+  lua_pushinteger(L, cs->buffer_position);
+
+  return 1;
+}
+
+static int lz4_cs_compress(lua_State *L)
+{
+  lz4_compress_stream_t *cs = _checkcompressionstream(L, 1);
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 2, &in_len);
+  size_t bound = LZ4_compressBound(in_len);
+  int policy = _ring_policy(cs->buffer_size, cs->buffer_position, in_len);
+  int r;
+
+  _lz4_cs_release_view(cs);
+
+  LUABUFF_NEW(b, out, bound)
+
+  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  {
+    char *ring;
+    if (policy == RING_POLICY_APPEND)
+    {
+      ring = cs->buffer + cs->buffer_position;
+      cs->buffer_position += in_len;
+    }
+    else
+    { // RING_POLICY_RESET
+      ring = cs->buffer;
+      cs->buffer_position = in_len;
+    }
+    memcpy(ring, in, in_len);
+    r = LZ4_compress_fast_continueHashLog(cs->handle, ring, out, in_len, bound, cs->accelerate);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+  }
+  else
+  { // RING_POLICY_EXTERNAL
+    r = LZ4_compress_fast_continueHashLog(cs->handle, in, out, in_len, bound, cs->accelerate);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    cs->buffer_position = LZ4_saveDictHashLog(cs->handle, cs->buffer, cs->buffer_size);
+  }
+
+  LUABUFF_PUSH(b, out, r)
+
+  return 1;
+}
+
+static int lz4_cs_writable(lua_State *L)
+{
+  lz4_compress_stream_t *cs = _checkcompressionstream(L, 1);
+  lua_Integer size = luaL_checkinteger(L, 2);
+  int policy;
+  char *data;
+
+  luaL_argcheck(L, size > 0 && size <= cs->buffer_size, 2, "size out of range");
+
+  _lz4_cs_release_view(cs);
+  // same placement as decompression streams, so both rings stay in step
+  cs->view_position = cs->buffer_position;
+  policy = _ring_policy(cs->buffer_size, cs->buffer_position, (int)size);
+  if (policy == RING_POLICY_APPEND)
+    data = cs->buffer + cs->buffer_position;  // after the previous block
+  else if (policy == RING_POLICY_RESET)
+    data = cs->buffer;  // the previous 64KB stay in place
+  else
+  {
+    // RING_POLICY_EXTERNAL, outside the ring which keeps the dictionary, as compress() does
+    if ((size_t)size > cs->external_size)
+    {
+      data = (char *)realloc(cs->external, (size_t)size);
+      if (data == NULL) return luaL_error(L, "out of memory");
+      cs->external = data;
+      cs->external_size = (size_t)size;
+    }
+    data = cs->external;
+  }
+
+  if (cs->view == NULL)
+  {
+    // stream and view keep each other alive
+    lua_newtable(L);
+    cs->view = _lz4_new_buffer(L);
+    cs->view->view = 1;
+    lua_newtable(L);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_setuservalue(L, -2);
+    lua_rawseti(L, -2, 1);
+    lua_setuservalue(L, 1);
+  }
+  lua_getuservalue(L, 1);
+  lua_rawgeti(L, -1, 1);
+
+  cs->view->data = data;
+  cs->view->capacity = (size_t)size;
+  cs->view->length = 0;
+
+  return 1;
+}
+
+static int lz4_cs_commit(lua_State *L)
+{
+  lz4_compress_stream_t *cs = _checkcompressionstream(L, 1);
+  lua_Integer in_len;
+  char *in;
+  size_t bound;
+  int policy, r;
+
+  if (cs->view == NULL || cs->view->data == NULL) return luaL_error(L, "no writable view to commit");
+  in_len = luaL_optinteger(L, 2, (lua_Integer)cs->view->length);
+  luaL_argcheck(L, in_len >= 0 && (size_t)in_len <= cs->view->capacity, 2, "size out of range");
+  in = cs->view->data;
+  bound = LZ4_compressBound((int)in_len);
+  _lz4_cs_release_view(cs);
+
+  // decoders place the block by its length, not by the capacity of the view
+  policy = _ring_policy(cs->buffer_size, cs->view_position, (int)in_len);
+  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  {
+    char *ring = policy == RING_POLICY_APPEND ? cs->buffer + cs->view_position : cs->buffer;
+    if (ring != in) memmove(ring, in, (size_t)in_len);
+    in = ring;
+  }
+
+  {
+    LUABUFF_NEW(b, out, bound)
+
+    r = LZ4_compress_fast_continueHashLog(cs->handle, in, out, (int)in_len, bound, cs->accelerate);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    if (policy == RING_POLICY_EXTERNAL)
+      cs->buffer_position = LZ4_saveDictHashLog(cs->handle, cs->buffer, cs->buffer_size);
+    else
+      cs->buffer_position = (int)(in - cs->buffer) + (int)in_len;
+
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static int lz4_cs_tostring(lua_State *L)
+{
+  lz4_compress_stream_t *p = _checkcompressionstream(L, 1);
+  lua_pushfstring(L, "lz4.compression_stream (%p)", p);
+  return 1;
+}
+
+static int lz4_cs_gc(lua_State *L)
+{
+  lz4_compress_stream_t *p = _checkcompressionstream(L, 1);
+  LZ4_freeStreamHashLog(p->handle);
+  free(p->buffer);
+  free(p->external);
+  return 0;
+}
+
+static const luaL_Reg compress_stream_functions[] = {
+  { "reset",    lz4_cs_reset },
+  { "compress", lz4_cs_compress },
+  { "writable", lz4_cs_writable },
+  { "commit",   lz4_cs_commit },
+  { NULL,       NULL },
+};
+
+static int lz4_new_compression_stream(lua_State *L)
+{
+  int buffer_size = luaL_optinteger(L, 1, DEF_BUFSIZE);
+  int accelerate = luaL_optinteger(L, 2, 1);
+  int hash_log = LZ4_MEMORY_USAGE - 2;
+  lz4_compress_stream_t *p;
+
+  if (!lua_isnoneornil(L, 3))
+  {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    hash_log = _lua_table_optinteger(L, 3, "hash_log", hash_log);
+    if (hash_log < LZ4_HASHLOG_MIN || hash_log > LZ4_HASHLOG_MAX || (hash_log & 1))
+      return luaL_error(L, "hash_log must be an even number between %d and %d", LZ4_HASHLOG_MIN, LZ4_HASHLOG_MAX);
+  }
+  if (buffer_size < MIN_BUFFSIZE) buffer_size = MIN_BUFFSIZE;
+
+  p = lua_newuserdata(L, sizeof(lz4_compress_stream_t));
+  p->handle = NULL;
+  p->accelerate = accelerate;
+  p->buffer_size = buffer_size;
+  p->buffer_position = 0;
+  p->buffer = NULL;
+  p->view = NULL;
+  p->view_position = 0;
+  p->external = NULL;
+  p->external_size = 0;
+
+  if (luaL_newmetatable(L, "lz4.compression_stream"))
+  {
+    // new method table
+    luaL_newlib(L, compress_stream_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_cs_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    // metatable.__gc
+    lua_pushcfunction(L, lz4_cs_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+
+  p->handle = LZ4_createStreamHashLog(hash_log);
+  p->buffer = malloc(buffer_size);
+  if (p->handle == NULL || p->buffer == NULL) return luaL_error(L, "out of memory");
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Compression Stream HC
+ ****************************************************************************/
+
+typedef struct
+{
+  LZ4_streamHCParams_t *handle;
+  int buffer_size;
+  int buffer_position;
+  char *buffer;
+} lz4_compress_stream_hc_t;
+
+static lz4_compress_stream_hc_t *_checkcompressionstream_hc(lua_State *L, int index)
+{
+  return (lz4_compress_stream_hc_t *)luaL_checkudata(L, index, "lz4.compression_stream_hc");
+}
+
+static int lz4_cs_hc_reset(lua_State *L)
+{
+  lz4_compress_stream_hc_t *cs = _checkcompressionstream_hc(L, 1);
+  size_t in_len = 0;
+  const char *in = luaL_optlstring(L, 2, NULL, &in_len);
+
+  if (in != NULL && in_len > 0)
+  {
+    int limit_len = LZ4_DICTSIZE;
+    if (limit_len > cs->buffer_size) limit_len = cs->buffer_size;
+    if (in_len > limit_len)
+    {
+      in = in + in_len - limit_len;
+      in_len = limit_len;
+    }
+    memcpy(cs->buffer, in, in_len);
+    cs->buffer_position = LZ4_loadDictHCParams(cs->handle, cs->buffer, in_len);
+  }
+  else
+  {
+    LZ4_resetStreamHCParams(cs->handle);
+    cs->buffer_position = 0;
+  }
+
+  lua_pushinteger(L, cs->buffer_position);
+
+  return 1;
+}
+
+static int lz4_cs_hc_compress(lua_State *L)
+{
+  lz4_compress_stream_hc_t *cs = _checkcompressionstream_hc(L, 1);
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 2, &in_len);
+  size_t bound = LZ4_compressBound(in_len);
+  int policy = _ring_policy(cs->buffer_size, cs->buffer_position, in_len);
+  int r;
+
+  LUABUFF_NEW(b, out, bound)
+
+  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  {
+    char *ring;
+    if (policy == RING_POLICY_APPEND)
+    {
+      ring = cs->buffer + cs->buffer_position;
+      cs->buffer_position += in_len;
+    }
+    else
+    { // RING_POLICY_RESET
+      ring = cs->buffer;
+      cs->buffer_position = in_len;
+    }
+    memcpy(ring, in, in_len);
+    r = LZ4_compress_HC_continueParams(cs->handle, ring, out, in_len, bound);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+  }
+  else
+  { // RING_POLICY_EXTERNAL
+    r = LZ4_compress_HC_continueParams(cs->handle, in, out, in_len, bound);
+    if (r == 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "compression failed");
+    }
+    cs->buffer_position = LZ4_saveDictHCParams(cs->handle, cs->buffer, cs->buffer_size);
+  }
+
+  LUABUFF_PUSH(b, out, r)
+
+  return 1;
+}
+
+static int lz4_cs_hc_tostring(lua_State *L)
+{
+  lz4_compress_stream_hc_t *p = _checkcompressionstream_hc(L, 1);
+  lua_pushfstring(L, "lz4.compression_stream_hc (%p)", p);
+  return 1;
+}
+
+static int lz4_cs_hc_gc(lua_State *L)
+{
+  lz4_compress_stream_hc_t *p = _checkcompressionstream_hc(L, 1);
+  LZ4_freeStreamHCParams(p->handle);
+  free(p->buffer);
+  return 0;
+}
+
+static const luaL_Reg compress_stream_hc_functions[] = {
+  { "reset",    lz4_cs_hc_reset },
+  { "compress", lz4_cs_hc_compress },
+  { NULL,       NULL },
+};
+
+static int lz4_new_compression_stream_hc(lua_State *L)
+{
+  int buffer_size = luaL_optinteger(L, 1, DEF_BUFSIZE);
+  int level = luaL_optinteger(L, 2, 0);
+  int max_attempts = LZ4_maxAttemptsHC(level);
+  int chain_log = LZ4HC_CHAINLOG_MAX;
+  lz4_compress_stream_hc_t *p;
+
+  if (!lua_isnoneornil(L, 3))
+  {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    max_attempts = _lua_table_optinteger(L, 3, "max_attempts", max_attempts);
+    chain_log = _lua_table_optinteger(L, 3, "chain_log", chain_log);
+    if (max_attempts < 1 || max_attempts > LZ4HC_MAXATTEMPTS_MAX)
+      return luaL_error(L, "max_attempts must be between 1 and %d", LZ4HC_MAXATTEMPTS_MAX);
+    if (chain_log < LZ4HC_CHAINLOG_MIN || chain_log > LZ4HC_CHAINLOG_MAX)
+      return luaL_error(L, "chain_log must be between %d and %d", LZ4HC_CHAINLOG_MIN, LZ4HC_CHAINLOG_MAX);
+  }
+  if (buffer_size < MIN_BUFFSIZE) buffer_size = MIN_BUFFSIZE;
+
+  p = lua_newuserdata(L, sizeof(lz4_compress_stream_hc_t));
+  p->handle = NULL;
+  p->buffer_size = buffer_size;
+  p->buffer_position = 0;
+  p->buffer = NULL;
+
+  if (luaL_newmetatable(L, "lz4.compression_stream_hc"))
+  {
+    // new method table
+    luaL_newlib(L, compress_stream_hc_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_cs_hc_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    // metatable.__gc
+    lua_pushcfunction(L, lz4_cs_hc_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+
+  p->handle = LZ4_createStreamHCParams(chain_log, max_attempts);
+  p->buffer = malloc(buffer_size);
+  if (p->handle == NULL || p->buffer == NULL) return luaL_error(L, "out of memory");
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Decompression Stream
+ ****************************************************************************/
+
+typedef struct
+{
+  LZ4_streamDecode_t handle;
+  int buffer_size;
+  int buffer_position;
+  char *buffer;
+  unsigned generation;  // incremented by every decode and reset, expires views
+  char *external;       // blocks of views which do not fit in the ring
+  size_t external_size;
+} lz4_decompress_stream_t;
+
+typedef struct
+{
+  const char *data;
+  size_t length;
+  unsigned generation;
+  const lz4_decompress_stream_t *ds;  // anchored by the uservalue
+} lz4_view_t;
+
+static lz4_decompress_stream_t *_checkdecompressionstream(lua_State *L, int index)
+{
+  return (lz4_decompress_stream_t *)luaL_checkudata(L, index, "lz4.decompression_stream");
+}
+
+static lz4_view_t *_checkview(lua_State *L, int index)
+{
+  lz4_view_t *v = (lz4_view_t *)luaL_checkudata(L, index, "lz4.view");
+  if (v->generation != v->ds->generation) luaL_error(L, "view expired by a later decode");
+  return v;
+}
+
+/* string.sub index rules */
+static size_t _lz4_view_posrelat(lua_Integer pos, size_t len)
+{
+  if (pos >= 0) return (size_t)pos;
+  if ((size_t)-pos > len) return 0;
+  return len + (size_t)pos + 1;
+}
+
+static int lz4_view_len(lua_State *L)
+{
+  lz4_view_t *v = _checkview(L, 1);
+  lua_pushinteger(L, v->length);
+  return 1;
+}
+
+static int lz4_view_sub(lua_State *L)
+{
+  lz4_view_t *v = _checkview(L, 1);
+  size_t i = _lz4_view_posrelat(luaL_optinteger(L, 2, 1), v->length);
+  size_t j = _lz4_view_posrelat(luaL_optinteger(L, 3, -1), v->length);
+
+  if (i < 1) i = 1;
+  if (j > v->length) j = v->length;
+  if (i > j) lua_pushliteral(L, "");
+  else lua_pushlstring(L, v->data + i - 1, j - i + 1);
+  return 1;
+}
+
+static int lz4_view_byte(lua_State *L)
+{
+  lz4_view_t *v = _checkview(L, 1);
+  size_t i = _lz4_view_posrelat(luaL_optinteger(L, 2, 1), v->length);
+  size_t j = _lz4_view_posrelat(luaL_optinteger(L, 3, (lua_Integer)i), v->length);
+  int n;
+
+  if (i < 1) i = 1;
+  if (j > v->length) j = v->length;
+  if (i > j) return 0;
+  if (j - i >= INT_MAX) return luaL_error(L, "view slice too long");
+  n = (int)(j - i) + 1;
+  luaL_checkstack(L, n, "view slice too long");
+  for (j = 0; j < (size_t)n; j++) lua_pushinteger(L, (unsigned char)v->data[i + j - 1]);
+  return n;
+}
+
+/* plain substring search, patterns would need a string */
+static int lz4_view_find(lua_State *L)
+{
+  lz4_view_t *v = _checkview(L, 1);
+  size_t s_len;
+  const char *s = luaL_checklstring(L, 2, &s_len);
+  size_t init = _lz4_view_posrelat(luaL_optinteger(L, 3, 1), v->length);
+  const char *p, *end;
+
+  if (init < 1) init = 1;
+  if (init > v->length + 1)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  p = v->data + init - 1;
+  end = v->data + v->length;
+  if (s_len == 0)
+  {
+    lua_pushinteger(L, init);
+    lua_pushinteger(L, init - 1);
+    return 2;
+  }
+  while ((size_t)(end - p) >= s_len)
+  {
+    p = memchr(p, s[0], (end - p) - s_len + 1);
+    if (p == NULL) break;
+    if (memcmp(p + 1, s + 1, s_len - 1) == 0)
+    {
+      lua_pushinteger(L, p - v->data + 1);
+      lua_pushinteger(L, p - v->data + s_len);
+      return 2;
+    }
+    p++;
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+static int lz4_view_tostring(lua_State *L)
+{
+  lz4_view_t *p = (lz4_view_t *)luaL_checkudata(L, 1, "lz4.view");
+  lua_pushfstring(L, "lz4.view (%p)", p);
+  return 1;
+}
+
+static const luaL_Reg view_functions[] = {
+  { "len",  lz4_view_len },
+  { "sub",  lz4_view_sub },
+  { "byte", lz4_view_byte },
+  { "find", lz4_view_find },
+  { NULL,   NULL },
+};
+
+/* push a view of data decoded by the stream at index */
+static void _lz4_new_view(lua_State *L, int index, const lz4_decompress_stream_t *ds, const char *data, size_t length)
+{
+  lz4_view_t *v = lua_newuserdata(L, sizeof(lz4_view_t));
+  v->data = data;
+  v->length = length;
+  v->generation = ds->generation;
+  v->ds = ds;
+
+  if (luaL_newmetatable(L, "lz4.view"))
+  {
+    // new method table
+    luaL_newlib(L, view_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__len
+    lua_pushcfunction(L, lz4_view_len);
+    lua_setfield(L, -2, "__len");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_view_tostring);
+    lua_setfield(L, -2, "__tostring");
+  }
+  lua_setmetatable(L, -2);
+
+  // the stream outlives its views, uservalues are tables before Lua 5.3
+#if LUA_VERSION_NUM < 503
+  lua_createtable(L, 1, 0);
+  lua_pushvalue(L, index);
+  lua_rawseti(L, -2, 1);
+#else
+  lua_pushvalue(L, index);
+#endif
+  lua_setuservalue(L, -2);
+}
+
+static int lz4_ds_reset(lua_State *L)
+{
+  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
+  size_t in_len = 0;
+  const char *in = luaL_optlstring(L, 2, NULL, &in_len);
+
+  ds->generation++;
+  if (in != NULL && in_len > 0)
+  {
+    int limit_len = LZ4_DICTSIZE;
+    if (limit_len > ds->buffer_size) limit_len = ds->buffer_size;
+    if (in_len > limit_len)
+    {
+      in = in + in_len - limit_len;
+      in_len = limit_len;
+    }
+    memcpy(ds->buffer, in, in_len);
+    ds->buffer_position = LZ4_setStreamDecode(&ds->handle, ds->buffer, in_len);
+  }
+  else
+  {
+    LZ4_setStreamDecode(&ds->handle, NULL, 0);
+    ds->buffer_position = 0;
+  }
+
+  lua_pushinteger(L, ds->buffer_position);
+
+  return 1;
+}
+
+static void _lz4_ds_save_dict(lz4_decompress_stream_t *ds, const char *dict, int dict_size)
+{
+  int limit_len = LZ4_DICTSIZE;
+  if (limit_len > ds->buffer_size) limit_len = ds->buffer_size;
+
+  if (dict_size > limit_len)
+  {
+    dict += dict_size - limit_len;
+    dict_size = limit_len;
+  }
+
+  memmove(ds->buffer, dict, dict_size);
+  LZ4_setStreamDecode(&ds->handle, ds->buffer, dict_size);
+
+  ds->buffer_position = dict_size;
+}
+
+static int lz4_ds_decompress_safe(lua_State *L)
+{
+  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 2, &in_len);
+  size_t out_len = luaL_checkinteger(L, 3);
+  int policy = _ring_policy(ds->buffer_size, ds->buffer_position, out_len);
+  int r;
+
+  ds->generation++;
+  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  {
+    char *ring;
+    size_t new_position;
+    if (policy == RING_POLICY_APPEND)
+    {
+      ring = ds->buffer + ds->buffer_position;
+      new_position = ds->buffer_position + out_len;
+    }
+    else
+    { // RING_POLICY_RESET
+      ring = ds->buffer;
+      new_position = out_len;
+    }
+    r = LZ4_decompress_safe_continue(&ds->handle, in, ring, in_len, out_len);
+    if (r < 0) return luaL_error(L, "corrupt input or need more output space");
+    ds->buffer_position = new_position;
+    lua_pushlstring(L, ring, r);
+  }
+  else
+  { // RING_POLICY_EXTERNAL
+    LUABUFF_NEW(b, out, out_len)
+    r = LZ4_decompress_safe_continue(&ds->handle, in, out, in_len, out_len);
+    if (r < 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "corrupt input or need more output space");
+    }
+    _lz4_ds_save_dict(ds, out, r); // memcpy(ds->buffer, out, out_len)
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static int lz4_ds_decompress_fast(lua_State *L)
+{
+  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 2, &in_len);
+  size_t out_len = luaL_checkinteger(L, 3);
+  int policy = _ring_policy(ds->buffer_size, ds->buffer_position, out_len);
+  int r;
+
+  ds->generation++;
+  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  {
+    char *ring;
+    size_t new_position;
+    if (policy == RING_POLICY_APPEND)
+    {
+      ring = ds->buffer + ds->buffer_position;
+      new_position = ds->buffer_position + out_len;
+    }
+    else
+    { // RING_POLICY_RESET
+      ring = ds->buffer;
+      new_position = out_len;
+    }
+    r = LZ4_decompress_fast_continue(&ds->handle, in, ring, out_len);
+    if (r < 0) return luaL_error(L, "corrupt input or need more output space");
+    ds->buffer_position = new_position;
+    lua_pushlstring(L, ring, out_len);
+  }
+  else
+  { // RING_POLICY_EXTERNAL
+    LUABUFF_NEW(b, out, out_len)
+    r = LZ4_decompress_fast_continue(&ds->handle, in, out, out_len);
+    if (r < 0)
+    {
+      LUABUFF_FREE(out)
+      return luaL_error(L, "corrupt input or need more output space");
+    }
+    _lz4_ds_save_dict(ds, out, out_len); // memcpy(ds->buffer, out, out_len)
+    LUABUFF_PUSH(b, out, out_len)
+  }
+
+  return 1;
+}
+
+/* decode into memory of the stream and return a view of the block */
+static int _lz4_ds_decompress_view(lua_State *L, int fast)
+{
+  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 2, &in_len);
+  size_t out_len = luaL_checkinteger(L, 3);
+  int policy = _ring_policy(ds->buffer_size, ds->buffer_position, out_len);
+  char *out;
+  int r;
+
+  ds->generation++;
+  if (policy == RING_POLICY_APPEND)
+    out = ds->buffer + ds->buffer_position;
+  else if (policy == RING_POLICY_RESET)
+    out = ds->buffer;
+  else
+  { // RING_POLICY_EXTERNAL
+    if (out_len > ds->external_size)
+    {
+      out = realloc(ds->external, out_len);
+      if (out == NULL) return luaL_error(L, "out of memory");
+      ds->external = out;
+      ds->external_size = out_len;
+    }
+    out = ds->external;
+  }
+
+  if (fast)
+    r = LZ4_decompress_fast_continue(&ds->handle, in, out, out_len) < 0 ? -1 : (int)out_len;
+  else
+    r = LZ4_decompress_safe_continue(&ds->handle, in, out, in_len, out_len);
+  if (r < 0) return luaL_error(L, "corrupt input or need more output space");
+
+  if (policy == RING_POLICY_APPEND)
+    ds->buffer_position += out_len;
+  else if (policy == RING_POLICY_RESET)
+    ds->buffer_position = out_len;
+  else
+    _lz4_ds_save_dict(ds, out, r);
+
+  _lz4_new_view(L, 1, ds, out, r);
+  return 1;
+}
+
+static int lz4_ds_decompress_safe_view(lua_State *L)
+{
+  return _lz4_ds_decompress_view(L, 0);
+}
+
+static int lz4_ds_decompress_fast_view(lua_State *L)
+{
+  return _lz4_ds_decompress_view(L, 1);
+}
+
+static int lz4_ds_tostring(lua_State *L)
+{
+  lz4_decompress_stream_t *p = _checkdecompressionstream(L, 1);
+  lua_pushfstring(L, "lz4.decompression_stream (%p)", p);
+  return 1;
+}
+
+static int lz4_ds_gc(lua_State *L)
+{
+  lz4_decompress_stream_t *p = _checkdecompressionstream(L, 1);
+  free(p->buffer);
+  free(p->external);
+  return 0;
+}
+
+static const luaL_Reg decompress_stream_functions[] = {
+  { "reset",            lz4_ds_reset },
+  { "decompress_safe",  lz4_ds_decompress_safe },
+  { "decompress_fast",  lz4_ds_decompress_fast },
+  { "decompress_safe_view", lz4_ds_decompress_safe_view },
+  { "decompress_fast_view", lz4_ds_decompress_fast_view },
+  { NULL,               NULL },
+};
+
+static int lz4_new_decompression_stream(lua_State *L)
+{
+  int buffer_size = luaL_optinteger(L, 1, DEF_BUFSIZE);
+  lz4_decompress_stream_t *p;
+
+  if (buffer_size < MIN_BUFFSIZE) buffer_size = MIN_BUFFSIZE;
+
+  p = lua_newuserdata(L, sizeof(lz4_decompress_stream_t));
+  LZ4_setStreamDecode(&p->handle, NULL, 0);
+  p->buffer_size = buffer_size;
+  p->buffer_position = 0;
+  p->generation = 0;
+  p->external = NULL;
+  p->external_size = 0;
+  p->buffer = malloc(buffer_size);
+  if (p->buffer == NULL) luaL_error(L, "out of memory");
+
+  if (luaL_newmetatable(L, "lz4.decompression_stream"))
+  {
+    // new method table
+    luaL_newlib(L, decompress_stream_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_ds_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    // metatable.__gc
+    lua_pushcfunction(L, lz4_ds_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Frame Compressor
+ ****************************************************************************/
+
+typedef struct
+{
+  LZ4F_compressionContext_t ctx;
+  LZ4F_preferences_t settings;
+  int begun;
+} lz4_frame_compressor_t;
+
+static lz4_frame_compressor_t *_checkframecompressor(lua_State *L, int index)
+{
+  return (lz4_frame_compressor_t *)luaL_checkudata(L, index, "lz4.frame_compressor");
+}
+
+static void _lz4_fc_abort(lz4_frame_compressor_t *fc)
+{
+  // LZ4F_compressUpdate() doesn't guarantee error recovery, start over on next begin()
+  LZ4F_freeCompressionContext(fc->ctx);
+  fc->ctx = NULL;
+  fc->begun = 0;
+}
+
+static int lz4_fc_begin(lua_State *L)
+{
+  lz4_frame_compressor_t *fc = _checkframecompressor(L, 1);
+  lua_Integer content_size = luaL_optinteger(L, 2, 0);
+  char header[FRAME_HEADER_SIZE];
+  size_t r;
+
+  luaL_argcheck(L, content_size >= 0, 2, "content size must not be negative");
+  if (fc->begun) return luaL_error(L, "frame already begun");
+
+  fc->settings.frameInfo.contentSize = (unsigned long long)content_size;
+
+  if (fc->ctx == NULL)
+  {
+    r = LZ4F_createCompressionContext(&fc->ctx, LZ4F_VERSION);
+    if (LZ4F_isError(r))
+    {
+      fc->ctx = NULL;
+      return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
+    }
+  }
+
+  r = LZ4F_compressBegin(fc->ctx, header, sizeof(header), &fc->settings);
+  if (LZ4F_isError(r))
+  {
+    _lz4_fc_abort(fc);
+    return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
+  }
+  fc->begun = 1;
+
+  lua_pushlstring(L, header, r);
+
+  return 1;
+}
+
+static int lz4_fc_update(lua_State *L)
+{
+  lz4_frame_compressor_t *fc = _checkframecompressor(L, 1);
+  size_t in_len;
+  const char *in = luaL_checklstring(L, 2, &in_len);
+  size_t bound, r;
+
+  if (!fc->begun) return luaL_error(L, "frame not begun");
+
+  bound = LZ4F_compressBound(in_len, &fc->settings);
+
+  {
+    LUABUFF_NEW(b, out, bound)
+    r = LZ4F_compressUpdate(fc->ctx, out, bound, in, in_len, NULL);
+    if (LZ4F_isError(r))
+    {
+      LUABUFF_FREE(out)
+      _lz4_fc_abort(fc);
+      return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
+    }
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static int _lz4_fc_flush(lua_State *L, int end)
+{
+  lz4_frame_compressor_t *fc = _checkframecompressor(L, 1);
+  size_t bound, r;
+
+  if (!fc->begun) return luaL_error(L, "frame not begun");
+
+  // worst case: one full buffered block, end mark and checksum
+  bound = LZ4F_compressBound(0, &fc->settings);
+
+  {
+    LUABUFF_NEW(b, out, bound)
+    if (end)
+      r = LZ4F_compressEnd(fc->ctx, out, bound, NULL);
+    else
+      r = LZ4F_flush(fc->ctx, out, bound, NULL);
+    if (LZ4F_isError(r))
+    {
+      LUABUFF_FREE(out)
+      _lz4_fc_abort(fc);
+      return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(r));
+    }
+    if (end) fc->begun = 0;
+    LUABUFF_PUSH(b, out, r)
+  }
+
+  return 1;
+}
+
+static int lz4_fc_flush(lua_State *L)
+{
+  return _lz4_fc_flush(L, 0);
+}
+
+static int lz4_fc_finish(lua_State *L)
+{
+  return _lz4_fc_flush(L, 1);
+}
+
+static int lz4_fc_tostring(lua_State *L)
+{
+  lz4_frame_compressor_t *p = _checkframecompressor(L, 1);
+  lua_pushfstring(L, "lz4.frame_compressor (%p)", p);
+  return 1;
+}
+
+static int lz4_fc_gc(lua_State *L)
+{
+  lz4_frame_compressor_t *p = _checkframecompressor(L, 1);
+  LZ4F_freeCompressionContext(p->ctx);
+  p->ctx = NULL;
+  return 0;
+}
+
+static const luaL_Reg frame_compressor_functions[] = {
+  { "begin",    lz4_fc_begin },
+  { "update",   lz4_fc_update },
+  { "flush",    lz4_fc_flush },
+  { "finish",   lz4_fc_finish },
+  { NULL,       NULL },
+};
+
+static int lz4_new_frame_compressor(lua_State *L)
+{
+  lz4_frame_compressor_t *p;
+  LZ4F_errorCode_t code;
+
+  p = lua_newuserdata(L, sizeof(lz4_frame_compressor_t));
+  memset(p, 0, sizeof(lz4_frame_compressor_t));
+  if (lua_type(L, 1) == LUA_TTABLE) _lua_table_preferences(L, 1, &p->settings);
+
+  if (luaL_newmetatable(L, "lz4.frame_compressor"))
+  {
+    // new method table
+    luaL_newlib(L, frame_compressor_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_fc_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    // metatable.__gc
+    lua_pushcfunction(L, lz4_fc_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+
+  code = LZ4F_createCompressionContext(&p->ctx, LZ4F_VERSION);
+  if (LZ4F_isError(code))
+  {
+    p->ctx = NULL;
+    return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(code));
+  }
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Frame Decompressor
+ ****************************************************************************/
+
+typedef struct
+{
+  size_t size;
+  size_t capacity;
+  char *data;
+} lz4_pending_t;
+
+typedef struct
+{
+  LZ4F_decompressionContext_t ctx;
+  // LZ4F_decompress() must resume from the very address where it stopped,
+  // so input is staged in [1] and swapped into [0] while partly consumed
+  lz4_pending_t pending[2];
+  size_t pending_offset;
+} lz4_frame_decompressor_t;
+
+static lz4_frame_decompressor_t *_checkframedecompressor(lua_State *L, int index)
+{
+  return (lz4_frame_decompressor_t *)luaL_checkudata(L, index, "lz4.frame_decompressor");
+}
+
+static int _lz4_pending_append(lz4_pending_t *pending, const char *in, size_t in_len)
+{
+  size_t size = pending->size + in_len;
+  if (size > pending->capacity)
+  {
+    char *data;
+    if (size < 2 * pending->capacity) size = 2 * pending->capacity;
+    data = realloc(pending->data, size);
+    if (data == NULL) return 0;
+    pending->data = data;
+    pending->capacity = size;
+  }
+  memcpy(pending->data + pending->size, in, in_len);
+  pending->size += in_len;
+  return 1;
+}
+
+static void _lz4_fd_abort(lz4_frame_decompressor_t *fd)
+{
+  // a failed frame can not continue, start over with the next one
+  LZ4F_resetDecompressionContext(fd->ctx);
+  fd->pending[0].size = 0;
+  fd->pending[1].size = 0;
+  fd->pending_offset = 0;
+}
+
+static size_t _lz4_fd_run(lz4_frame_decompressor_t *fd, luaL_Buffer *b, const char *p, size_t *p_len, size_t *total, size_t max_output)
+{
+  size_t code = 1;
+  size_t remain = *p_len;
+
+  while (*total < max_output)
+  {
+#if LUA_VERSION_NUM >= 502
+    size_t out_len = 65536;
+    char *out = luaL_prepbuffsize(b, out_len);
+#else
+    size_t out_len = LUAL_BUFFERSIZE;
+    char *out = luaL_prepbuffer(b);
+#endif
+    size_t advance = remain;
+    if (out_len > max_output - *total) out_len = max_output - *total;
+    code = LZ4F_decompress(fd->ctx, out, &out_len, p, &advance, NULL);
+    if (LZ4F_isError(code)) break;
+    p += advance;
+    remain -= advance;
+    luaL_addsize(b, out_len);
+    *total += out_len;
+    if (code == 0) break; // end of frame
+    if (out_len == 0 && advance == 0) break;
+  }
+
+  *p_len -= remain;
+  return code;
+}
+
+static int lz4_fd_decompress(lua_State *L)
+{
+  lz4_frame_decompressor_t *fd = _checkframedecompressor(L, 1);
+  size_t in_len = 0;
+  const char *in = luaL_optlstring(L, 2, "", &in_len);
+  size_t max_output = (size_t)luaL_optinteger(L, 3, 0);
+  size_t total = 0;
+  size_t code = 1;
+
+  if (max_output == 0) max_output = (size_t)-1;
+
+  if (!_lz4_pending_append(&fd->pending[1], in, in_len)) return luaL_error(L, "out of memory");
+
+  {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+
+    // resume input left over by the previous call
+    if (fd->pending[0].size > 0)
     {
-      ring = cs->buffer + cs->buffer_position;
-      cs->buffer_position += in_len;
-    }
-    else
-    { // RING_POLICY_RESET
-      ring = cs->buffer;
-      cs->buffer_position = in_len;
+      size_t advance = fd->pending[0].size - fd->pending_offset;
+      code = _lz4_fd_run(fd, &b, fd->pending[0].data + fd->pending_offset, &advance, &total, max_output);
+      if (LZ4F_isError(code)) goto decompression_failed;
+      fd->pending_offset += advance;
+      if (fd->pending_offset == fd->pending[0].size)
+      {
+        fd->pending[0].size = 0;
+        fd->pending_offset = 0;
+      }
     }
-    memcpy(ring, in, in_len);
-    r = LZ4_compress_fast_continue(&cs->handle, ring, out, in_len, bound, cs->accelerate);
-    if (r == 0)
+
+    if (fd->pending[0].size == 0 && fd->pending[1].size > 0 && total < max_output && code != 0)
     {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed");
+      size_t advance = fd->pending[1].size;
+      code = _lz4_fd_run(fd, &b, fd->pending[1].data, &advance, &total, max_output);
+      if (LZ4F_isError(code)) goto decompression_failed;
+      if (advance < fd->pending[1].size)
+      {
+        lz4_pending_t t = fd->pending[0];
+        fd->pending[0] = fd->pending[1];
+        fd->pending[1] = t;
+        fd->pending_offset = advance;
+      }
+      else
+        fd->pending[1].size = 0;
     }
+
+    luaL_pushresult(&b);
   }
-  else
-  { // RING_POLICY_EXTERNAL
-    r = LZ4_compress_fast_continue(&cs->handle, in, out, in_len, bound, cs->accelerate);
-    if (r == 0)
+
+  lua_pushinteger(L, code);
+
+  return 2;
+
+decompression_failed:
+  _lz4_fd_abort(fd);
+  return luaL_error(L, "decompression failed: %s", LZ4F_getErrorName(code));
+}
+
+static int lz4_fd_tostring(lua_State *L)
+{
+  lz4_frame_decompressor_t *p = _checkframedecompressor(L, 1);
+  lua_pushfstring(L, "lz4.frame_decompressor (%p)", p);
+  return 1;
+}
+
+static int lz4_fd_gc(lua_State *L)
+{
+  lz4_frame_decompressor_t *p = _checkframedecompressor(L, 1);
+  LZ4F_freeDecompressionContext(p->ctx);
+  p->ctx = NULL;
+  free(p->pending[0].data);
+  free(p->pending[1].data);
+  p->pending[0].data = NULL;
+  p->pending[1].data = NULL;
+  return 0;
+}
+
+static const luaL_Reg frame_decompressor_functions[] = {
+  { "decompress", lz4_fd_decompress },
+  { NULL,         NULL },
+};
+
+static int lz4_new_frame_decompressor(lua_State *L)
+{
+  lz4_frame_decompressor_t *p;
+  LZ4F_errorCode_t code;
+
+  p = lua_newuserdata(L, sizeof(lz4_frame_decompressor_t));
+  memset(p, 0, sizeof(lz4_frame_decompressor_t));
+
+  if (luaL_newmetatable(L, "lz4.frame_decompressor"))
+  {
+    // new method table
+    luaL_newlib(L, frame_decompressor_functions);
+    // metatable.__index = method table
+    lua_setfield(L, -2, "__index");
+
+    // metatable.__tostring
+    lua_pushcfunction(L, lz4_fd_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    // metatable.__gc
+    lua_pushcfunction(L, lz4_fd_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+
+  code = LZ4F_createDecompressionContext(&p->ctx, LZ4F_VERSION);
+  if (LZ4F_isError(code))
+  {
+    p->ctx = NULL;
+    return luaL_error(L, "decompression failed: %s", LZ4F_getErrorName(code));
+  }
+
+  return 1;
+}
+
+/*****************************************************************************
+ * Frame Job
+ ****************************************************************************/
+
+/*
+ * A frame job compresses or decompresses one input a slice at a time, every
+ * step() processes at most step_size bytes of input, so a coroutine can yield
+ * between steps. The uservalue of the job pins the input and the dictionary.
+ */
+
+#define FRAME_JOB_STEP_SIZE (1 << 20)
+
+#define FRAME_JOB_RUNNING  0
+#define FRAME_JOB_DONE     1
+#define FRAME_JOB_FAILED   2
+
+typedef struct
+{
+  int decompress;
+  int state;
+  int begun;
+  LZ4F_compressionContext_t cctx;
+  LZ4F_decompressionContext_t dctx;
+  LZ4F_preferences_t settings;
+  const char *in;
+  size_t in_len;
+  size_t in_pos;
+  const char *dict;
+  size_t dict_len;
+  unsigned int dict_id;   // of the pinned dictionary
+  int dict_given;         // by the options, for all frames
+  size_t step_size;
+  char *out;
+  size_t out_len;
+  size_t out_capacity;
+} lz4_frame_job_t;
+
+static lz4_frame_job_t *_checkframejob(lua_State *L, int index)
+{
+  return (lz4_frame_job_t *)luaL_checkudata(L, index, "lz4.frame_job");
+}
+
+static void _lz4_job_free_contexts(lz4_frame_job_t *job)
+{
+  LZ4F_freeCompressionContext(job->cctx);
+  LZ4F_freeDecompressionContext(job->dctx);
+  job->cctx = NULL;
+  job->dctx = NULL;
+}
+
+static int _lz4_job_fail(lua_State *L, lz4_frame_job_t *job, const char *what, const char *error)
+{
+  // LZ4F contexts do not recover from errors, the job can not continue
+  job->state = FRAME_JOB_FAILED;
+  _lz4_job_free_contexts(job);
+  return luaL_error(L, "%s failed: %s", what, error);
+}
+
+static void _lz4_job_reserve(lua_State *L, lz4_frame_job_t *job, size_t size)
+{
+  if (job->out_len + size > job->out_capacity)
+  {
+    // grow geometrically
+    size_t capacity = job->out_len + size;
+    char *out;
+    if (capacity < 2 * job->out_capacity) capacity = 2 * job->out_capacity;
+    out = realloc(job->out, capacity);
+    if (out == NULL) _lz4_job_fail(L, job, job->decompress ? "decompression" : "compression", "out of memory");
+    job->out = out;
+    job->out_capacity = capacity;
+  }
+}
+
+static void _lz4_job_compress_step(lua_State *L, lz4_frame_job_t *job, size_t step_size)
+{
+  size_t chunk = job->in_len - job->in_pos;
+  size_t r;
+
+  if (!job->begun)
+  {
+    _lz4_job_reserve(L, job, FRAME_HEADER_SIZE);
+    r = LZ4F_compressBegin_usingDict(job->cctx, job->out + job->out_len, FRAME_HEADER_SIZE, job->dict, job->dict_len, &job->settings);
+    if (LZ4F_isError(r)) _lz4_job_fail(L, job, "compression", LZ4F_getErrorName(r));
+    job->out_len += r;
+    job->begun = 1;
+  }
+
+  if (chunk > step_size) chunk = step_size;
+  if (chunk > 0)
+  {
+    size_t bound = LZ4F_compressBound(chunk, &job->settings);
+    _lz4_job_reserve(L, job, bound);
+    r = LZ4F_compressUpdate(job->cctx, job->out + job->out_len, bound, job->in + job->in_pos, chunk, NULL);
+    if (LZ4F_isError(r)) _lz4_job_fail(L, job, "compression", LZ4F_getErrorName(r));
+    job->out_len += r;
+    job->in_pos += chunk;
+  }
+
+  if (job->in_pos == job->in_len)
+  {
+    size_t bound = LZ4F_compressBound(0, &job->settings);
+    _lz4_job_reserve(L, job, bound);
+    r = LZ4F_compressEnd(job->cctx, job->out + job->out_len, bound, NULL);
+    if (LZ4F_isError(r)) _lz4_job_fail(L, job, "compression", LZ4F_getErrorName(r));
+    job->out_len += r;
+    job->state = FRAME_JOB_DONE;
+  }
+}
+
+/* copy the dictionary, options and registry may drop it before the job ends */
+static void _lz4_frame_job_pin_dict(lua_State *L, lz4_frame_job_t *job, int job_index)
+{
+  lua_getuservalue(L, job_index);
+  lua_pushlstring(L, job->dict, job->dict_len);
+  job->dict = lua_tostring(L, -1);
+  lua_rawseti(L, -2, 2);
+  lua_pop(L, 1);
+}
+
+static void _lz4_job_decompress_step(lua_State *L, lz4_frame_job_t *job, int job_index, size_t step_size)
+{
+  size_t end = job->in_len - job->in_pos > step_size ? job->in_pos + step_size : job->in_len;
+  LZ4F_errorCode_t code;
+
+  while (job->in_pos < end)
+  {
+    size_t out_len, advance = end - job->in_pos;
+    _lz4_job_reserve(L, job, 65536);
+    out_len = job->out_capacity - job->out_len;
+    code = LZ4F_decompress_usingDict(job->dctx, job->out + job->out_len, &out_len, job->in + job->in_pos, &advance, job->dict, job->dict_len, NULL);
+    if (LZ4F_isError(code)) _lz4_job_fail(L, job, "decompression", LZ4F_getErrorName(code));
+    job->in_pos += advance;
+    job->out_len += out_len;
+    if (code == 0 && !job->dict_given)
     {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed");
+      // frames naming the pinned dictionary keep it, the registry may have dropped it
+      unsigned int id = _lz4_frame_dict_id(job->in + job->in_pos, job->in_len - job->in_pos);
+      if (id != 0 && id != job->dict_id)
+      {
+        job->dict = _lz4_registered_dictionary(L, id, &job->dict_len);
+        job->dict_id = id;
+        _lz4_frame_job_pin_dict(L, job, job_index);
+      }
     }
-    cs->buffer_position = LZ4_saveDict(&cs->handle, cs->buffer, cs->buffer_size);
+    if (out_len == 0 && advance == 0) break;
   }
 
-  LUABUFF_PUSH(b, out, r)
+  // like lz4.decompress, the output ends with the input
+  if (job->in_pos == job->in_len) job->state = FRAME_JOB_DONE;
+}
 
+static int lz4_job_step(lua_State *L)
+{
+  lz4_frame_job_t *job = _checkframejob(L, 1);
+  lua_Integer step_size = luaL_optinteger(L, 2, (lua_Integer)job->step_size);
+
+  luaL_argcheck(L, step_size > 0, 2, "step size must be positive");
+  if (job->state == FRAME_JOB_FAILED) return luaL_error(L, "job failed");
+
+  if (job->state == FRAME_JOB_RUNNING)
+  {
+    if (job->decompress)
+      _lz4_job_decompress_step(L, job, 1, (size_t)step_size);
+    else
+      _lz4_job_compress_step(L, job, (size_t)step_size);
+    if (job->state == FRAME_JOB_DONE) _lz4_job_free_contexts(job);
+  }
+
+  lua_pushboolean(L, job->state == FRAME_JOB_DONE);
+  lua_pushinteger(L, job->in_pos);
+  return 2;
+}
+
+static int lz4_job_result(lua_State *L)
+{
+  lz4_frame_job_t *job = _checkframejob(L, 1);
+
+  if (job->state != FRAME_JOB_DONE) return luaL_error(L, job->state == FRAME_JOB_FAILED ? "job failed" : "job not done");
+
+  if (lua_isnoneornil(L, 2))
+    lua_pushlstring(L, job->out, job->out_len);
+  else
+  {
+    lz4_buffer_t *buf = _checkbuffer(L, 2);
+    size_t offset = _lz4_buffer_optoffset(L, 3, buf);
+    _lz4_buffer_reserve(L, buf, offset + job->out_len);
+    if (job->out_len > 0) memcpy(buf->data + offset, job->out, job->out_len);
+    buf->length = offset + job->out_len;
+    lua_pushinteger(L, job->out_len);
+  }
   return 1;
 }
 
-static int lz4_cs_tostring(lua_State *L)
+static int lz4_job_tostring(lua_State *L)
 {
-  lz4_compress_stream_t *p = _checkcompressionstream(L, 1);
-  lua_pushfstring(L, "lz4.compression_stream (%p)", p);
+  lz4_frame_job_t *p = _checkframejob(L, 1);
+  lua_pushfstring(L, "lz4.frame_job (%p)", p);
   return 1;
 }
 
-static int lz4_cs_gc(lua_State *L)
+static int lz4_job_gc(lua_State *L)
 {
-  lz4_compress_stream_t *p = _checkcompressionstream(L, 1);
-  free(p->buffer);
+  lz4_frame_job_t *p = _checkframejob(L, 1);
+  _lz4_job_free_contexts(p);
+  free(p->out);
+  p->out = NULL;
   return 0;
 }
 
-static const luaL_Reg compress_stream_functions[] = {
-  { "reset",    lz4_cs_reset },
-  { "compress", lz4_cs_compress },
-  { NULL,       NULL },
+static const luaL_Reg frame_job_functions[] = {
+  { "step",   lz4_job_step },
+  { "result", lz4_job_result },
+  { NULL,     NULL },
 };
 
-static int lz4_new_compression_stream(lua_State *L)
+/* push a new job for the input at index 1 */
+static lz4_frame_job_t *_lz4_new_frame_job(lua_State *L, int decompress)
 {
-  int buffer_size = luaL_optinteger(L, 1, DEF_BUFSIZE);
-  int accelerate = luaL_optinteger(L, 2, 1);
-  lz4_compress_stream_t *p;
-
-  if (buffer_size < MIN_BUFFSIZE) buffer_size = MIN_BUFFSIZE;
+  lz4_frame_job_t *p;
 
-  p = lua_newuserdata(L, sizeof(lz4_compress_stream_t));
-  LZ4_resetStream(&p->handle);
-  p->accelerate = accelerate;
-  p->buffer_size = buffer_size;
-  p->buffer_position = 0;
-  p->buffer = malloc(buffer_size);
-  if (p->buffer == NULL) luaL_error(L, "out of memory");
+  luaL_checktype(L, 1, LUA_TSTRING);
+  p = lua_newuserdata(L, sizeof(lz4_frame_job_t));
+  memset(p, 0, sizeof(lz4_frame_job_t));
+  p->decompress = decompress;
+  p->in = lua_tolstring(L, 1, &p->in_len);
+  p->step_size = FRAME_JOB_STEP_SIZE;
 
-  if (luaL_newmetatable(L, "lz4.compression_stream"))
+  if (luaL_newmetatable(L, "lz4.frame_job"))
   {
     // new method table
-    luaL_newlib(L, compress_stream_functions);
+    luaL_newlib(L, frame_job_functions);
     // metatable.__index = method table
     lua_setfield(L, -2, "__index");
 
     // metatable.__tostring
-    lua_pushcfunction(L, lz4_cs_tostring);
+    lua_pushcfunction(L, lz4_job_tostring);
     lua_setfield(L, -2, "__tostring");
 
     // metatable.__gc
-    lua_pushcfunction(L, lz4_cs_gc);
+    lua_pushcfunction(L, lz4_job_gc);
     lua_setfield(L, -2, "__gc");
   }
   lua_setmetatable(L, -2);
 
+  // pin the input, the dictionary goes to [2]
+  lua_createtable(L, 2, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  lua_setuservalue(L, -2);
+
+  if (lua_type(L, 2) == LUA_TTABLE)
+  {
+    lua_Integer step_size = _lua_table_optinteger(L, 2, "step_size", FRAME_JOB_STEP_SIZE);
+    luaL_argcheck(L, step_size > 0, 2, "step size must be positive");
+    p->step_size = (size_t)step_size;
+  }
+
+  return p;
+}
+
+static int lz4_compress_job(lua_State *L)
+{
+  lz4_frame_job_t *p = _lz4_new_frame_job(L, 0);
+  int job_index = lua_gettop(L);
+  LZ4F_errorCode_t code;
+
+  if (lua_type(L, 2) == LUA_TTABLE)
+  {
+    _lua_table_preferences(L, 2, &p->settings);
+    if (_lua_table_optboolean(L, 2, "content_size", 0)) p->settings.frameInfo.contentSize = p->in_len;
+    p->dict = _lz4_frame_dictionary(L, 2, &p->settings.frameInfo.dictID, &p->dict_len);
+    if (p->dict != NULL) _lz4_frame_job_pin_dict(L, p, job_index);
+  }
+
+  code = LZ4F_createCompressionContext(&p->cctx, LZ4F_VERSION);
+  if (LZ4F_isError(code))
+  {
+    p->cctx = NULL;
+    return luaL_error(L, "compression failed: %s", LZ4F_getErrorName(code));
+  }
+
+  lua_settop(L, job_index);
+  return 1;
+}
+
+static int lz4_decompress_job(lua_State *L)
+{
+  lz4_frame_job_t *p = _lz4_new_frame_job(L, 1);
+  int job_index = lua_gettop(L);
+  LZ4F_frameInfo_t info;
+  LZ4F_errorCode_t code;
+  unsigned int dict_id;
+  size_t advance;
+
+  code = LZ4F_createDecompressionContext(&p->dctx, LZ4F_VERSION);
+  if (LZ4F_isError(code))
+  {
+    p->dctx = NULL;
+    return luaL_error(L, "decompression failed: %s", LZ4F_getErrorName(code));
+  }
+
+  if (lua_type(L, 2) == LUA_TTABLE)
+    p->dict = _lz4_frame_dictionary(L, 2, &dict_id, &p->dict_len);
+  p->dict_given = p->dict != NULL;
+
+  // the header names the registered dictionary, the first step resumes after it
+  advance = p->in_len;
+  code = LZ4F_getFrameInfo(p->dctx, &info, p->in, &advance);
+  if (LZ4F_isError(code))
+    LZ4F_resetDecompressionContext(p->dctx); // let the first step complete the header or report the error
+  else
+  {
+    p->in_pos = advance;
+    if (p->dict == NULL && info.dictID != 0)
+    {
+      p->dict = _lz4_registered_dictionary(L, info.dictID, &p->dict_len);
+      p->dict_id = info.dictID;
+    }
+  }
+  if (p->dict != NULL) _lz4_frame_job_pin_dict(L, p, job_index);
+
+  lua_settop(L, job_index);
   return 1;
 }
 
 /*****************************************************************************
- * Compression Stream HC
+ * CPU
  ****************************************************************************/
 
-typedef struct
+static const struct
 {
-  LZ4_streamHC_t handle;
-  int level;
-  int buffer_size;
-  int buffer_position;
-  char *buffer;
-} lz4_compress_stream_hc_t;
+  const char *name;
+  unsigned flag;
+} cpu_features[] = {
+  { "sse2",   LZ4_CPU_SSE2 },
+  { "ssse3",  LZ4_CPU_SSSE3 },
+  { "sse4_1", LZ4_CPU_SSE41 },
+  { "sse4_2", LZ4_CPU_SSE42 },
+  { "avx2",   LZ4_CPU_AVX2 },
+  { "bmi2",   LZ4_CPU_BMI2 },
+  { "avx512", LZ4_CPU_AVX512 },
+};
 
-static lz4_compress_stream_hc_t *_checkcompressionstream_hc(lua_State *L, int index)
+static int lz4_cpu_features(lua_State *L)
 {
-  return (lz4_compress_stream_hc_t *)luaL_checkudata(L, index, "lz4.compression_stream_hc");
+  unsigned features;
+  size_t i;
+
+  if (lua_isnoneornil(L, 1))
+    features = LZ4_cpuFeatures();
+  else
+  {
+    unsigned mask = LZ4_CPU_ALL;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    // the selection is process-wide, workers of this or other lua_States would switch kernels mid-job
+    if (_lz4_atomic_load(&_lz4_busy_workers) != 0) return luaL_error(L, "can not select CPU features while pools are open or threads are running");
+    for (i = 0; i < sizeof(cpu_features) / sizeof(cpu_features[0]); i++)
+      if (!_lua_table_optboolean(L, 1, cpu_features[i].name, 1)) mask &= ~cpu_features[i].flag;
+    features = LZ4_cpuSelect(mask);
+  }
+
+  lua_newtable(L);
+  for (i = 0; i < sizeof(cpu_features) / sizeof(cpu_features[0]); i++)
+  {
+    lua_pushboolean(L, (features & cpu_features[i].flag) != 0);
+    lua_setfield(L, -2, cpu_features[i].name);
+  }
+  lua_pushstring(L, LZ4_compressVariant());
+  lua_setfield(L, -2, "compress");
+  lua_pushstring(L, LZ4_decompressVariant());
+  lua_setfield(L, -2, "decompress");
+  lua_pushstring(L, LZ4_countVariant());
+  lua_setfield(L, -2, "count");
+  lua_pushstring(L, "scalar");  /* 4 dependent multiply lanes, vectorizing them is slower */
+  lua_setfield(L, -2, "xxh32");
+  return 1;
 }
 
-static int lz4_cs_hc_reset(lua_State *L)
+/*****************************************************************************
+ * Pool
+ ****************************************************************************/
+
+/*
+ * A pool owns worker threads which run frame jobs off the Lua thread. A job
+ * lives in its lz4.pool_job userdata, the uservalue of the job pins the input
+ * string, the pool and the dictionary until the job is collected. Workers only
+ * read the job input and write its output, the state of a job is protected by
+ * the pool mutex.
+ */
+
+#define POOL_JOB_QUEUED   0
+#define POOL_JOB_RUNNING  1
+#define POOL_JOB_DONE     2
+
+#define POOL_JOB_COMPRESS    0
+#define POOL_JOB_DECOMPRESS  1
+
+struct lz4_pool_s;
+
+typedef struct lz4_pool_job_s
 {
-  lz4_compress_stream_hc_t *cs = _checkcompressionstream_hc(L, 1);
-  size_t in_len = 0;
-  const char *in = luaL_optlstring(L, 2, NULL, &in_len);
+  struct lz4_pool_job_s *next;
+  struct lz4_pool_s *pool;
+  int op;
+  int state;
+  const char *in;
+  size_t in_len;
+  const char *dict;
+  size_t dict_len;
+  unsigned int dict_id;   // of the first frame, workers can not look up another one
+  int dict_given;         // by the options, for all frames
+  LZ4F_preferences_t settings;
+  int has_settings;
+  char *out;              // malloc'd result
+  size_t out_len;
+  const char *error;      // static message, NULL on success
+} lz4_pool_job_t;
+
+typedef struct lz4_pool_s
+{
+  lz4_mutex_t mutex;
+  lz4_cond_t work;        // a job was queued or the pool closed
+  lz4_cond_t done;        // a job completed
+  lz4_pool_job_t *head;   // queued jobs, oldest first
+  lz4_pool_job_t *tail;
+  int closed;
+  int threads;
+  lz4_thread_t handles[MAX_THREADS];
+  lz4_thread_arg_t args[MAX_THREADS];
+  LZ4F_compressionContext_t cctx[MAX_THREADS];
+  LZ4F_decompressionContext_t dctx[MAX_THREADS];
+} lz4_pool_t;
+
+static lz4_pool_t *_checkpool(lua_State *L, int index)
+{
+  lz4_pool_t *pool = (lz4_pool_t *)luaL_checkudata(L, index, "lz4.pool");
+  if (pool->closed) luaL_error(L, "pool is closed");
+  return pool;
+}
 
-  if (in != NULL && in_len > 0)
+static lz4_pool_job_t *_checkpooljob(lua_State *L, int index)
+{
+  return (lz4_pool_job_t *)luaL_checkudata(L, index, "lz4.pool_job");
+}
+
+static void _lz4_pool_compress(lz4_pool_job_t *job, LZ4F_compressionContext_t cctx)
+{
+  LZ4F_preferences_t *settings = job->has_settings ? &job->settings : NULL;
+  size_t bound = LZ4F_compressFrameBound(job->in_len, settings);
+  size_t r;
+
+  job->out = malloc(bound);
+  if (job->out == NULL)
   {
-    int limit_len = LZ4_DICTSIZE;
-    if (limit_len > cs->buffer_size) limit_len = cs->buffer_size;
-    if (in_len > limit_len)
+    job->error = "out of memory";
+    return;
+  }
+  r = LZ4F_compressFrame_usingDict(cctx, job->out, bound, job->in, job->in_len, job->dict, job->dict_len, settings);
+  if (LZ4F_isError(r))
+    job->error = LZ4F_getErrorName(r);
+  else
+    job->out_len = r;
+}
+
+static void _lz4_pool_decompress(lz4_pool_job_t *job, LZ4F_decompressionContext_t dctx)
+{
+  const char *p = job->in;
+  size_t p_len = job->in_len;
+  size_t capacity = 0;
+  LZ4F_errorCode_t code;
+
+  LZ4F_resetDecompressionContext(dctx);
+  while (1)
+  {
+    size_t out_len, advance = p_len;
+    if (capacity - job->out_len < 65536)
     {
-      in = in + in_len - limit_len;
-      in_len = limit_len;
+      // grow geometrically
+      size_t size = capacity < 65536 ? 65536 : capacity * 2;
+      char *out = realloc(job->out, size);
+      if (out == NULL)
+      {
+        job->error = "out of memory";
+        return;
+      }
+      job->out = out;
+      capacity = size;
     }
-    memcpy(cs->buffer, in, in_len);
-    cs->buffer_position = LZ4_loadDictHC(&cs->handle, cs->buffer, in_len);
+    out_len = capacity - job->out_len;
+    code = LZ4F_decompress_usingDict(dctx, job->out + job->out_len, &out_len, p, &advance, job->dict, job->dict_len, NULL);
+    if (LZ4F_isError(code))
+    {
+      job->error = LZ4F_getErrorName(code);
+      LZ4F_resetDecompressionContext(dctx);
+      return;
+    }
+    if (out_len == 0) break;
+    p += advance;
+    p_len -= advance;
+    job->out_len += out_len;
+    if (code == 0 && p_len == 0) break; // end of last frame
+    if (code == 0 && !job->dict_given)
+    {
+      unsigned int id = _lz4_frame_dict_id(p, p_len);
+      if (id != 0 && id != job->dict_id)
+      {
+        job->error = "frames use different dictionaries";
+        return;
+      }
+    }
+  }
+}
+
+static void _lz4_pool_worker(void *arg, int thread)
+{
+  lz4_pool_t *pool = (lz4_pool_t *)arg;
+  lz4_pool_job_t *job;
+
+  _lz4_mutex_lock(&pool->mutex);
+  while (1)
+  {
+    while (pool->head == NULL && !pool->closed) _lz4_cond_wait(&pool->work, &pool->mutex);
+    if (pool->head == NULL) break;
+    job = pool->head;
+    pool->head = job->next;
+    if (pool->head == NULL) pool->tail = NULL;
+    job->state = POOL_JOB_RUNNING;
+    _lz4_mutex_unlock(&pool->mutex);
+
+    if (job->op == POOL_JOB_COMPRESS)
+      _lz4_pool_compress(job, pool->cctx[thread]);
+    else
+      _lz4_pool_decompress(job, pool->dctx[thread]);
+
+    _lz4_mutex_lock(&pool->mutex);
+    job->state = POOL_JOB_DONE;
+    _lz4_cond_broadcast(&pool->done);
+  }
+  _lz4_mutex_unlock(&pool->mutex);
+}
+
+/* cancel the queued jobs, wait for the running ones and stop the workers */
+static void _lz4_pool_close(lz4_pool_t *pool)
+{
+  lz4_pool_job_t *job;
+  int i;
+
+  if (pool->closed) return;
+  _lz4_mutex_lock(&pool->mutex);
+  pool->closed = 1;
+  _lz4_atomic_add(&_lz4_busy_workers, -1);
+  for (job = pool->head; job != NULL; job = job->next)
+  {
+    job->state = POOL_JOB_DONE;
+    job->error = "pool closed";
   }
-  else
+  pool->head = pool->tail = NULL;
+  _lz4_cond_broadcast(&pool->work);
+  _lz4_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < pool->threads; i++) _lz4_thread_join(pool->handles[i]);
+  for (i = 0; i < MAX_THREADS; i++)
   {
-    LZ4_resetStreamHC(&cs->handle, cs->level);
-    cs->buffer_position = 0;
+    LZ4F_freeCompressionContext(pool->cctx[i]);
+    LZ4F_freeDecompressionContext(pool->dctx[i]);
   }
+  _lz4_cond_destroy(&pool->work);
+  _lz4_cond_destroy(&pool->done);
+  _lz4_mutex_destroy(&pool->mutex);
+}
 
-  lua_pushinteger(L, cs->buffer_position);
+static int _lz4_pool_job_done(lz4_pool_job_t *job)
+{
+  int done;
 
-  return 1;
+  if (job->pool->closed) return 1;
+  _lz4_mutex_lock(&job->pool->mutex);
+  done = job->state == POOL_JOB_DONE;
+  _lz4_mutex_unlock(&job->pool->mutex);
+  return done;
 }
 
-static int lz4_cs_hc_compress(lua_State *L)
+static int lz4_pool_job_done(lua_State *L)
 {
-  lz4_compress_stream_hc_t *cs = _checkcompressionstream_hc(L, 1);
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 2, &in_len);
-  size_t bound = LZ4_compressBound(in_len);
-  int policy = _ring_policy(cs->buffer_size, cs->buffer_position, in_len);
-  int r;
+  lua_pushboolean(L, _lz4_pool_job_done(_checkpooljob(L, 1)));
+  return 1;
+}
 
-  LUABUFF_NEW(b, out, bound)
+/* push the result of a completed job, as a string or into the buffer at index 2 */
+static int _lz4_pool_job_result(lua_State *L, lz4_pool_job_t *job)
+{
+  if (job->error != NULL)
+    return luaL_error(L, "%s failed: %s", job->op == POOL_JOB_COMPRESS ? "compression" : "decompression", job->error);
 
-  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  if (lua_isnoneornil(L, 2))
+    lua_pushlstring(L, job->out, job->out_len);
+  else
   {
-    char *ring;
-    if (policy == RING_POLICY_APPEND)
-    {
-      ring = cs->buffer + cs->buffer_position;
-      cs->buffer_position += in_len;
-    }
-    else
-    { // RING_POLICY_RESET
-      ring = cs->buffer;
-      cs->buffer_position = in_len;
-    }
-    memcpy(ring, in, in_len);
-    r = LZ4_compress_HC_continue(&cs->handle, ring, out, in_len, bound);
-    if (r == 0)
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed");
-    }
+    lz4_buffer_t *buf = _checkbuffer(L, 2);
+    size_t offset = _lz4_buffer_optoffset(L, 3, buf);
+    _lz4_buffer_reserve(L, buf, offset + job->out_len);
+    if (job->out_len > 0) memcpy(buf->data + offset, job->out, job->out_len);
+    buf->length = offset + job->out_len;
+    lua_pushinteger(L, job->out_len);
   }
-  else
-  { // RING_POLICY_EXTERNAL
-    r = LZ4_compress_HC_continue(&cs->handle, in, out, in_len, bound);
-    if (r == 0)
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "compression failed");
-    }
-    cs->buffer_position = LZ4_saveDictHC(&cs->handle, cs->buffer, cs->buffer_size);
+  return 1;
+}
+
+static int lz4_pool_job_poll(lua_State *L)
+{
+  lz4_pool_job_t *job = _checkpooljob(L, 1);
+
+  if (!_lz4_pool_job_done(job))
+  {
+    lua_pushnil(L);
+    return 1;
   }
+  return _lz4_pool_job_result(L, job);
+}
 
-  LUABUFF_PUSH(b, out, r)
+static int lz4_pool_job_wait(lua_State *L)
+{
+  lz4_pool_job_t *job = _checkpooljob(L, 1);
 
-  return 1;
+  if (!job->pool->closed)
+  {
+    _lz4_mutex_lock(&job->pool->mutex);
+    while (job->state != POOL_JOB_DONE) _lz4_cond_wait(&job->pool->done, &job->pool->mutex);
+    _lz4_mutex_unlock(&job->pool->mutex);
+  }
+  return _lz4_pool_job_result(L, job);
 }
 
-static int lz4_cs_hc_tostring(lua_State *L)
+static int lz4_pool_job_tostring(lua_State *L)
 {
-  lz4_compress_stream_hc_t *p = _checkcompressionstream_hc(L, 1);
-  lua_pushfstring(L, "lz4.compression_stream_hc (%p)", p);
+  lz4_pool_job_t *p = _checkpooljob(L, 1);
+  lua_pushfstring(L, "lz4.pool_job (%p)", p);
   return 1;
 }
 
-static int lz4_cs_hc_gc(lua_State *L)
+static int lz4_pool_job_gc(lua_State *L)
 {
-  lz4_compress_stream_hc_t *p = _checkcompressionstream_hc(L, 1);
-  free(p->buffer);
+  lz4_pool_job_t *job = _checkpooljob(L, 1);
+  lz4_pool_t *pool = job->pool;
+
+  // the input is collected with the job, a worker must not read it any more
+  if (!pool->closed)
+  {
+    _lz4_mutex_lock(&pool->mutex);
+    if (job->state == POOL_JOB_QUEUED)
+    {
+      lz4_pool_job_t **link = &pool->head, *prev = NULL;
+      while (*link != job)
+      {
+        prev = *link;
+        link = &(*link)->next;
+      }
+      *link = job->next;
+      if (pool->tail == job) pool->tail = prev;
+      job->state = POOL_JOB_DONE;
+    }
+    while (job->state != POOL_JOB_DONE) _lz4_cond_wait(&pool->done, &pool->mutex);
+    _lz4_mutex_unlock(&pool->mutex);
+  }
+  free(job->out);
+  job->out = NULL;
   return 0;
 }
 
-static const luaL_Reg compress_stream_hc_functions[] = {
-  { "reset",    lz4_cs_hc_reset },
-  { "compress", lz4_cs_hc_compress },
-  { NULL,       NULL },
+static const luaL_Reg pool_job_functions[] = {
+  { "done", lz4_pool_job_done },
+  { "poll", lz4_pool_job_poll },
+  { "wait", lz4_pool_job_wait },
+  { NULL,   NULL },
 };
 
-static int lz4_new_compression_stream_hc(lua_State *L)
+/* push a new job of the pool at index 1 for the input at index 2 */
+static lz4_pool_job_t *_lz4_pool_job_new(lua_State *L, lz4_pool_t *pool, int op)
 {
-  int buffer_size = luaL_optinteger(L, 1, DEF_BUFSIZE);
-  int level = luaL_optinteger(L, 2, 0);
-  lz4_compress_stream_hc_t *p;
-
-  if (buffer_size < MIN_BUFFSIZE) buffer_size = MIN_BUFFSIZE;
-
-  p = lua_newuserdata(L, sizeof(lz4_compress_stream_hc_t));
-  LZ4_resetStreamHC(&p->handle, level);
-  p->level = level;
-  p->buffer_size = buffer_size;
-  p->buffer_position = 0;
-  p->buffer = malloc(buffer_size);
-  if (p->buffer == NULL) luaL_error(L, "out of memory");
-
-  if (luaL_newmetatable(L, "lz4.compression_stream_hc"))
+  lz4_pool_job_t *job = lua_newuserdata(L, sizeof(lz4_pool_job_t));
+  memset(job, 0, sizeof(lz4_pool_job_t));
+  job->pool = pool;
+  job->op = op;
+  job->state = POOL_JOB_DONE;   // not queued yet, gc has nothing to wait for
+  job->in = lua_tolstring(L, 2, &job->in_len);
+
+  if (luaL_newmetatable(L, "lz4.pool_job"))
   {
     // new method table
-    luaL_newlib(L, compress_stream_hc_functions);
+    luaL_newlib(L, pool_job_functions);
     // metatable.__index = method table
     lua_setfield(L, -2, "__index");
 
     // metatable.__tostring
-    lua_pushcfunction(L, lz4_cs_hc_tostring);
+    lua_pushcfunction(L, lz4_pool_job_tostring);
     lua_setfield(L, -2, "__tostring");
 
     // metatable.__gc
-    lua_pushcfunction(L, lz4_cs_hc_gc);
+    lua_pushcfunction(L, lz4_pool_job_gc);
     lua_setfield(L, -2, "__gc");
   }
   lua_setmetatable(L, -2);
 
-  return 1;
-}
-
-/*****************************************************************************
- * Decompression Stream
- ****************************************************************************/
+  // pin the pool and the input
+  lua_createtable(L, 3, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  lua_pushvalue(L, 2);
+  lua_rawseti(L, -2, 2);
+  lua_setuservalue(L, -2);
 
-typedef struct
-{
-  LZ4_streamDecode_t handle;
-  int buffer_size;
-  int buffer_position;
-  char *buffer;
-} lz4_decompress_stream_t;
+  return job;
+}
 
-static lz4_decompress_stream_t *_checkdecompressionstream(lua_State *L, int index)
+/* pin the dictionary at the top of the stack to the job at index */
+static void _lz4_pool_job_pin(lua_State *L, int index)
 {
-  return (lz4_decompress_stream_t *)luaL_checkudata(L, index, "lz4.decompression_stream");
+  lua_getuservalue(L, index);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, 3);
+  lua_pop(L, 1);
 }
 
-static int lz4_ds_reset(lua_State *L)
+static void _lz4_pool_submit(lz4_pool_t *pool, lz4_pool_job_t *job)
 {
-  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
-  size_t in_len = 0;
-  const char *in = luaL_optlstring(L, 2, NULL, &in_len);
-
-  if (in != NULL && in_len > 0)
-  {
-    int limit_len = LZ4_DICTSIZE;
-    if (limit_len > ds->buffer_size) limit_len = ds->buffer_size;
-    if (in_len > limit_len)
-    {
-      in = in + in_len - limit_len;
-      in_len = limit_len;
-    }
-    memcpy(ds->buffer, in, in_len);
-    ds->buffer_position = LZ4_setStreamDecode(&ds->handle, ds->buffer, in_len);
-  }
+  _lz4_mutex_lock(&pool->mutex);
+  job->state = POOL_JOB_QUEUED;
+  if (pool->tail != NULL)
+    pool->tail->next = job;
   else
-  {
-    LZ4_setStreamDecode(&ds->handle, NULL, 0);
-    ds->buffer_position = 0;
-  }
-
-  lua_pushinteger(L, ds->buffer_position);
-
-  return 1;
+    pool->head = job;
+  pool->tail = job;
+  _lz4_cond_broadcast(&pool->work);
+  _lz4_mutex_unlock(&pool->mutex);
 }
 
-static void _lz4_ds_save_dict(lz4_decompress_stream_t *ds, const char *dict, int dict_size)
+static int lz4_pool_compress_async(lua_State *L)
 {
-  int limit_len = LZ4_DICTSIZE;
-  if (limit_len > ds->buffer_size) limit_len = ds->buffer_size;
-
-  if (dict_size > limit_len)
-  {
-    dict += dict_size - limit_len;
-    dict_size = limit_len;
-  }
-
-  memmove(ds->buffer, dict, dict_size);
-  LZ4_setStreamDecode(&ds->handle, ds->buffer, dict_size);
-
-  ds->buffer_position = dict_size;
-}
+  lz4_pool_t *pool = _checkpool(L, 1);
+  lz4_pool_job_t *job;
+  int job_index;
 
-static int lz4_ds_decompress_safe(lua_State *L)
-{
-  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 2, &in_len);
-  size_t out_len = luaL_checkinteger(L, 3);
-  int policy = _ring_policy(ds->buffer_size, ds->buffer_position, out_len);
-  int r;
+  luaL_checktype(L, 2, LUA_TSTRING);
+  job = _lz4_pool_job_new(L, pool, POOL_JOB_COMPRESS);
+  job_index = lua_gettop(L);
 
-  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  if (lua_type(L, 3) == LUA_TTABLE)
   {
-    char *ring;
-    size_t new_position;
-    if (policy == RING_POLICY_APPEND)
-    {
-      ring = ds->buffer + ds->buffer_position;
-      new_position = ds->buffer_position + out_len;
-    }
-    else
-    { // RING_POLICY_RESET
-      ring = ds->buffer;
-      new_position = out_len;
-    }
-    r = LZ4_decompress_safe_continue(&ds->handle, in, ring, in_len, out_len);
-    if (r < 0) return luaL_error(L, "corrupt input or need more output space");
-    ds->buffer_position = new_position;
-    lua_pushlstring(L, ring, r);
-  }
-  else
-  { // RING_POLICY_EXTERNAL
-    LUABUFF_NEW(b, out, out_len)
-    r = LZ4_decompress_safe_continue(&ds->handle, in, out, in_len, out_len);
-    if (r < 0)
+    job->has_settings = 1;
+    _lua_table_preferences(L, 3, &job->settings);
+    job->settings.frameInfo.contentSize = _lua_table_optboolean(L, 3, "content_size", 0);
+    job->dict = _lz4_frame_dictionary(L, 3, &job->settings.frameInfo.dictID, &job->dict_len);
+    if (job->dict != NULL)
     {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "corrupt input or need more output space");
+      // the options table or the registry may drop the dictionary before the job runs
+      lua_pushlstring(L, job->dict, job->dict_len);
+      job->dict = lua_tostring(L, -1);
+      _lz4_pool_job_pin(L, job_index);
     }
-    _lz4_ds_save_dict(ds, out, r); // memcpy(ds->buffer, out, out_len)
-    LUABUFF_PUSH(b, out, r)
   }
 
+  _lz4_pool_submit(pool, job);
+  lua_pushvalue(L, job_index);
   return 1;
 }
 
-static int lz4_ds_decompress_fast(lua_State *L)
+static int lz4_pool_decompress_async(lua_State *L)
 {
-  lz4_decompress_stream_t *ds = _checkdecompressionstream(L, 1);
-  size_t in_len;
-  const char *in = luaL_checklstring(L, 2, &in_len);
-  size_t out_len = luaL_checkinteger(L, 3);
-  int policy = _ring_policy(ds->buffer_size, ds->buffer_position, out_len);
-  int r;
-
-  if (policy == RING_POLICY_APPEND || policy == RING_POLICY_RESET)
+  lz4_pool_t *pool = _checkpool(L, 1);
+  lz4_pool_job_t *job;
+  int job_index;
+  unsigned int dict_id;
+
+  luaL_checktype(L, 2, LUA_TSTRING);
+  job = _lz4_pool_job_new(L, pool, POOL_JOB_DECOMPRESS);
+  job_index = lua_gettop(L);
+
+  if (lua_type(L, 3) == LUA_TTABLE)
+    job->dict = _lz4_frame_dictionary(L, 3, &dict_id, &job->dict_len);
+  job->dict_given = job->dict != NULL;
+  if (job->dict == NULL)
   {
-    char *ring;
-    size_t new_position;
-    if (policy == RING_POLICY_APPEND)
+    lz4_frame_context_t *ctx = _frame_context(L);
+    LZ4F_frameInfo_t info;
+    size_t advance = job->in_len;
+    LZ4F_errorCode_t code;
+
+    LZ4F_resetDecompressionContext(ctx->dctx);
+    code = LZ4F_getFrameInfo(ctx->dctx, &info, job->in, &advance);
+    LZ4F_resetDecompressionContext(ctx->dctx);
+    if (!LZ4F_isError(code) && info.dictID != 0)
     {
-      ring = ds->buffer + ds->buffer_position;
-      new_position = ds->buffer_position + out_len;
-    }
-    else
-    { // RING_POLICY_RESET
-      ring = ds->buffer;
-      new_position = out_len;
+      job->dict = _lz4_registered_dictionary(L, info.dictID, &job->dict_len);
+      job->dict_id = info.dictID;
     }
-    r = LZ4_decompress_fast_continue(&ds->handle, in, ring, out_len);
-    if (r < 0) return luaL_error(L, "corrupt input or need more output space");
-    ds->buffer_position = new_position;
-    lua_pushlstring(L, ring, out_len);
   }
-  else
-  { // RING_POLICY_EXTERNAL
-    LUABUFF_NEW(b, out, out_len)
-    r = LZ4_decompress_fast_continue(&ds->handle, in, out, out_len);
-    if (r < 0)
-    {
-      LUABUFF_FREE(out)
-      return luaL_error(L, "corrupt input or need more output space");
-    }
-    _lz4_ds_save_dict(ds, out, out_len); // memcpy(ds->buffer, out, out_len)
-    LUABUFF_PUSH(b, out, out_len)
+  if (job->dict != NULL)
+  {
+    lua_pushlstring(L, job->dict, job->dict_len);
+    job->dict = lua_tostring(L, -1);
+    _lz4_pool_job_pin(L, job_index);
   }
 
+  _lz4_pool_submit(pool, job);
+  lua_pushvalue(L, job_index);
   return 1;
 }
 
-static int lz4_ds_tostring(lua_State *L)
+static int lz4_pool_close(lua_State *L)
 {
-  lz4_decompress_stream_t *p = _checkdecompressionstream(L, 1);
-  lua_pushfstring(L, "lz4.decompression_stream (%p)", p);
+  lz4_pool_t *pool = (lz4_pool_t *)luaL_checkudata(L, 1, "lz4.pool");
+  _lz4_pool_close(pool);
+  return 0;
+}
+
+static int lz4_pool_size(lua_State *L)
+{
+  lz4_pool_t *pool = (lz4_pool_t *)luaL_checkudata(L, 1, "lz4.pool");
+  lua_pushinteger(L, pool->closed ? 0 : pool->threads);
   return 1;
 }
 
-static int lz4_ds_gc(lua_State *L)
+static int lz4_pool_tostring(lua_State *L)
 {
-  lz4_decompress_stream_t *p = _checkdecompressionstream(L, 1);
-  free(p->buffer);
-  return 0;
+  lz4_pool_t *p = (lz4_pool_t *)luaL_checkudata(L, 1, "lz4.pool");
+  lua_pushfstring(L, "lz4.pool (%p)", p);
+  return 1;
 }
 
-static const luaL_Reg decompress_stream_functions[] = {
-  { "reset",            lz4_ds_reset },
-  { "decompress_safe",  lz4_ds_decompress_safe },
-  { "decompress_fast",  lz4_ds_decompress_fast },
+static const luaL_Reg pool_functions[] = {
+  { "compress_async",   lz4_pool_compress_async },
+  { "decompress_async", lz4_pool_decompress_async },
+  { "size",             lz4_pool_size },
+  { "close",            lz4_pool_close },
   { NULL,               NULL },
 };
 
-static int lz4_new_decompression_stream(lua_State *L)
+static int lz4_pool(lua_State *L)
 {
-  int buffer_size = luaL_optinteger(L, 1, DEF_BUFSIZE);
-  lz4_decompress_stream_t *p;
+  int threads = luaL_optinteger(L, 1, 1);
+  lz4_pool_t *p;
+  int i;
 
-  if (buffer_size < MIN_BUFFSIZE) buffer_size = MIN_BUFFSIZE;
+  luaL_argcheck(L, threads >= 1 && threads <= MAX_THREADS, 1, "threads out of range");
 
-  p = lua_newuserdata(L, sizeof(lz4_decompress_stream_t));
-  LZ4_setStreamDecode(&p->handle, NULL, 0);
-  p->buffer_size = buffer_size;
-  p->buffer_position = 0;
-  p->buffer = malloc(buffer_size);
-  if (p->buffer == NULL) luaL_error(L, "out of memory");
+  p = lua_newuserdata(L, sizeof(lz4_pool_t));
+  memset(p, 0, sizeof(lz4_pool_t));
+  p->closed = 1;   // nothing to stop until the workers start
 
-  if (luaL_newmetatable(L, "lz4.decompression_stream"))
+  if (luaL_newmetatable(L, "lz4.pool"))
   {
     // new method table
-    luaL_newlib(L, decompress_stream_functions);
+    luaL_newlib(L, pool_functions);
     // metatable.__index = method table
     lua_setfield(L, -2, "__index");
 
     // metatable.__tostring
-    lua_pushcfunction(L, lz4_ds_tostring);
+    lua_pushcfunction(L, lz4_pool_tostring);
     lua_setfield(L, -2, "__tostring");
 
     // metatable.__gc
-    lua_pushcfunction(L, lz4_ds_gc);
+    lua_pushcfunction(L, lz4_pool_close);
     lua_setfield(L, -2, "__gc");
   }
   lua_setmetatable(L, -2);
 
+  for (i = 0; i < threads; i++)
+  {
+    if (LZ4F_isError(LZ4F_createCompressionContext(&p->cctx[i], LZ4F_VERSION))) p->cctx[i] = NULL;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&p->dctx[i], LZ4F_VERSION))) p->dctx[i] = NULL;
+    if (p->cctx[i] == NULL || p->dctx[i] == NULL)
+    {
+      for (; i >= 0; i--)
+      {
+        LZ4F_freeCompressionContext(p->cctx[i]);
+        LZ4F_freeDecompressionContext(p->dctx[i]);
+      }
+      return luaL_error(L, "out of memory");
+    }
+  }
+
+  _lz4_mutex_init(&p->mutex);
+  _lz4_cond_init(&p->work);
+  _lz4_cond_init(&p->done);
+  p->closed = 0;
+  _lz4_atomic_add(&_lz4_busy_workers, 1);
+  for (i = 0; i < threads; i++)
+  {
+    p->args[p->threads].fn = _lz4_pool_worker;
+    p->args[p->threads].arg = p;
+    p->args[p->threads].thread = p->threads;
+    if (_lz4_thread_create(&p->handles[p->threads], &p->args[p->threads])) p->threads++;
+  }
+  if (p->threads == 0)
+  {
+    _lz4_pool_close(p);
+    return luaL_error(L, "can not create threads");
+  }
+
   return 1;
 }
 
@@ -802,22 +3988,48 @@ static const luaL_Reg export_functions[] = {
   /* Frame */
   { "compress",                       lz4_compress },
   { "decompress",                     lz4_decompress },
+  { "frame_info",                     lz4_frame_info },
+  { "compress_into",                  lz4_compress_into },
+  { "decompress_into",                lz4_decompress_into },
+  { "new_frame_compressor",           lz4_new_frame_compressor },
+  { "new_frame_decompressor",         lz4_new_frame_decompressor },
+  { "compress_job",                   lz4_compress_job },
+  { "decompress_job",                 lz4_decompress_job },
   /* Block */
   { "block_compress",                 lz4_block_compress },
   { "block_compress_hc",              lz4_block_compress_hc },
   { "block_decompress_safe",          lz4_block_decompress_safe },
   { "block_decompress_fast",          lz4_block_decompress_fast },
   { "block_decompress_safe_partial",  lz4_block_decompress_safe_partial },
+  { "block_compress_into",            lz4_block_compress_into },
+  { "block_decompress_into",          lz4_block_decompress_into },
+  { "block_compress_batch",           lz4_block_compress_batch },
+  { "block_decompress_batch",         lz4_block_decompress_batch },
+  { "block_compress_dest_size",       lz4_block_compress_dest_size },
+  { "block_compress_slices",          lz4_block_compress_slices },
+  /* Dictionary */
+  { "new_dictionary",                 lz4_new_dictionary },
+  { "block_compress_dict",            lz4_block_compress_dict },
+  { "block_decompress_safe_dict",     lz4_block_decompress_safe_dict },
+  { "train_dictionary",               lz4_train_dictionary },
+  { "register_dictionary",            lz4_register_dictionary },
   /* Stream */
   { "new_compression_stream",         lz4_new_compression_stream },
   { "new_compression_stream_hc",      lz4_new_compression_stream_hc },
   { "new_decompression_stream",       lz4_new_decompression_stream },
+  /* Buffer */
+  { "new_buffer",                     lz4_new_buffer },
+  /* CPU */
+  { "cpu_features",                   lz4_cpu_features },
+  /* Pool */
+  { "pool",                           lz4_pool },
   { NULL,                             NULL },
 };
 
 LUALIB_API int luaopen_lz4(lua_State *L)
 {
   int table_index;
+  LZ4_cpuFeatures();  /* detect the CPU once, before any thread starts */
   luaL_newlib(L, export_functions);
 
   table_index = lua_gettop(L);
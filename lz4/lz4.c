@@ -61,11 +61,20 @@
 #  define LZ4_FORCE_SW_BITCOUNT
 #endif
 
+/*
+ * LZ4_SIMD
+ * Compression and decompression are also compiled for SSE2 and AVX2 (+BMI2), the variant matching
+ * the CPU is selected at run time, see lz4cpu.h.
+ * Enabled by default on x86 and x86-64 with gcc >= 4.9, clang or Visual Studio 2012+.
+ * Define LZ4_SIMD=0 to build the scalar code only.
+ */
+
 
 /**************************************
 *  Includes
 **************************************/
 #include "lz4.h"
+#include "lz4cpu.h"
 
 
 /**************************************
@@ -98,6 +107,26 @@
 #define likely(expr)     expect((expr) != 0, 1)
 #define unlikely(expr)   expect((expr) != 0, 0)
 
+#ifndef LZ4_SIMD
+#  if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)) \
+   && ((LZ4_GCC_VERSION >= 409) || defined(__clang__) || (defined(_MSC_VER) && (_MSC_VER >= 1700)))
+#    define LZ4_SIMD 1
+#  else
+#    define LZ4_SIMD 0
+#  endif
+#endif
+
+#if LZ4_SIMD
+#  include <immintrin.h>
+#  if defined(__GNUC__) || defined(__clang__)
+#    define LZ4_TARGET(t) __attribute__((target(t)))
+#    define LZ4_TARGET_FLATTEN(t) __attribute__((target(t), flatten))   /* inline the kernels of target t */
+#  else
+#    define LZ4_TARGET(t)
+#    define LZ4_TARGET_FLATTEN(t)
+#  endif
+#endif
+
 
 /**************************************
 *  Memory routines
@@ -347,14 +376,24 @@ static const U32 LZ4_skipTrigger = 6;  /* Increase this value ==> compression ru
 *  Local Structures and types
 **************************************/
 typedef struct {
-    U32 hashTable[HASH_SIZE_U32];
     U32 currentOffset;
     U32 initCheck;
     const BYTE* dictionary;
     BYTE* bufferStart;   /* obsolete, used for slideInputBuffer */
     U32 dictSize;
+} LZ4_window_t;
+
+typedef struct {
+    U32 hashTable[HASH_SIZE_U32];
+    LZ4_window_t window;
 } LZ4_stream_t_internal;
 
+struct LZ4_streamHashLog_s {
+    LZ4_window_t window;
+    U32 hashLog;
+    U32 hashTable[1];   /* (1<<hashLog) entries, allocated with the structure */
+};
+
 typedef enum { notLimited = 0, limitedOutput = 1 } limitedOutput_directive;
 typedef enum { byPtr, byU32, byU16 } tableType_t;
 
@@ -365,6 +404,168 @@ typedef enum { endOnOutputSize = 0, endOnInputSize = 1 } endCondition_directive;
 typedef enum { full = 0, partial = 1 } earlyEnd_directive;
 
 
+/**************************************
+*  SIMD kernels
+**************************************/
+typedef enum { simdNone = 0, simdSSE2, simdAVX2 } simd_directive;
+
+#if LZ4_SIMD
+
+static int LZ4_simdLevel(void)
+{
+    const unsigned cpu = LZ4_cpuFeatures();
+    if (cpu & LZ4_CPU_AVX2) return simdAVX2;
+    if (cpu & LZ4_CPU_SSE2) return simdSSE2;
+    return simdNone;
+}
+
+/* the AVX2 compression variant also needs tzcnt and shlx / shrx */
+static int LZ4_compressLevel(void)
+{
+    const unsigned cpu = LZ4_cpuFeatures();
+    if ((cpu & (LZ4_CPU_AVX2|LZ4_CPU_BMI2)) == (LZ4_CPU_AVX2|LZ4_CPU_BMI2)) return simdAVX2;
+    if (cpu & LZ4_CPU_SSE2) return simdSSE2;
+    return simdNone;
+}
+
+/* pshufb masks repeating the first `offset` bytes : LZ4_patternMask[offset][i] == i % offset */
+static const BYTE LZ4_patternMask[16][32] = {
+    { 0 },
+#define LZ4_PATTERN_ROW(o) { 0%o, 1%o, 2%o, 3%o, 4%o, 5%o, 6%o, 7%o, 8%o, 9%o, 10%o, 11%o, 12%o, 13%o, 14%o, 15%o, \
+                             16%o, 17%o, 18%o, 19%o, 20%o, 21%o, 22%o, 23%o, 24%o, 25%o, 26%o, 27%o, 28%o, 29%o, 30%o, 31%o }
+    LZ4_PATTERN_ROW(1), LZ4_PATTERN_ROW(2), LZ4_PATTERN_ROW(3), LZ4_PATTERN_ROW(4), LZ4_PATTERN_ROW(5),
+    LZ4_PATTERN_ROW(6), LZ4_PATTERN_ROW(7), LZ4_PATTERN_ROW(8), LZ4_PATTERN_ROW(9), LZ4_PATTERN_ROW(10),
+    LZ4_PATTERN_ROW(11), LZ4_PATTERN_ROW(12), LZ4_PATTERN_ROW(13), LZ4_PATTERN_ROW(14), LZ4_PATTERN_ROW(15)
+#undef LZ4_PATTERN_ROW
+};
+
+LZ4_TARGET("sse2") static void LZ4_copy16(void* dstPtr, const void* srcPtr)
+{
+    _mm_storeu_si128((__m128i*)dstPtr, _mm_loadu_si128((const __m128i*)srcPtr));
+}
+
+LZ4_TARGET("avx2") static void LZ4_copy32(void* dstPtr, const void* srcPtr)
+{
+    _mm256_storeu_si256((__m256i*)dstPtr, _mm256_loadu_si256((const __m256i*)srcPtr));
+}
+
+/* same as LZ4_wildCopy(), including the 7 bytes limit, moving 16 bytes at a time while possible */
+LZ4_TARGET("sse2") static void LZ4_wildCopy16(void* dstPtr, const void* srcPtr, void* dstEnd)
+{
+    BYTE* d = (BYTE*)dstPtr;
+    const BYTE* s = (const BYTE*)srcPtr;
+    BYTE* e = (BYTE*)dstEnd;
+    while (e-d > 16) { LZ4_copy16(d,s); d+=16; s+=16; }
+    do { LZ4_copy8(d,s); d+=8; s+=8; } while (d<e);
+}
+
+/* same as LZ4_wildCopy(), including the 7 bytes limit, moving 32 bytes at a time while possible */
+LZ4_TARGET("avx2") static void LZ4_wildCopy32(void* dstPtr, const void* srcPtr, void* dstEnd)
+{
+    BYTE* d = (BYTE*)dstPtr;
+    const BYTE* s = (const BYTE*)srcPtr;
+    BYTE* e = (BYTE*)dstEnd;
+    while (e-d > 32) { LZ4_copy32(d,s); d+=32; s+=32; }
+    if (e-d > 16) { LZ4_copy16(d,s); d+=16; s+=16; }
+    do { LZ4_copy8(d,s); d+=8; s+=8; } while (d<e);
+}
+
+/* match copy for offset >= 16, may overwrite up to 15 bytes beyond dstEnd */
+LZ4_TARGET("sse2") static void LZ4_matchCopy16(BYTE* op, const BYTE* match, BYTE* const dstEnd)
+{
+    do { LZ4_copy16(op, match); op+=16; match+=16; } while (op<dstEnd);
+}
+
+/* match copy for offset >= 32, may overwrite up to 31 bytes beyond dstEnd */
+LZ4_TARGET("avx2") static void LZ4_matchCopy32(BYTE* op, const BYTE* match, BYTE* const dstEnd)
+{
+    do { LZ4_copy32(op, match); op+=32; match+=32; } while (op<dstEnd);
+}
+
+/* match copy for 0 < offset < 16 : the period is shuffled into a 32 bytes pattern,
+ * stored every multiple of offset. May overwrite up to 31 bytes beyond dstEnd,
+ * reads 16 bytes from match. */
+LZ4_TARGET("avx2") static void LZ4_patternCopy32(BYTE* op, const BYTE* match, BYTE* const dstEnd, size_t offset)
+{
+    const __m256i src = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)match));
+    const __m256i pattern = _mm256_shuffle_epi8(src, _mm256_loadu_si256((const __m256i*)LZ4_patternMask[offset]));
+    const size_t step = 32 - (32 % offset);
+    do { _mm256_storeu_si256((__m256i*)op, pattern); op+=step; } while (op<dstEnd);
+}
+
+/* index of the first set bit, mask != 0 */
+static unsigned LZ4_firstBit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long r;
+    _BitScanForward(&r, mask);
+    return (unsigned)r;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/* same as LZ4_count(), the first word is compared alone so short matches cost the same,
+ * then 16 bytes at a time, LZ4_count() finishes the last 15 bytes */
+LZ4_TARGET("sse2") static unsigned LZ4_count16(const BYTE* pIn, const BYTE* pMatch, const BYTE* pInLimit)
+{
+    const BYTE* const pStart = pIn;
+
+    if (likely(pIn<pInLimit-(STEPSIZE-1)))
+    {
+        size_t diff = LZ4_read_ARCH(pMatch) ^ LZ4_read_ARCH(pIn);
+        if (diff) return LZ4_NbCommonBytes(diff);
+        pIn+=STEPSIZE; pMatch+=STEPSIZE;
+    }
+
+    while (likely(pIn<pInLimit-15))
+    {
+        const __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)pIn), _mm_loadu_si128((const __m128i*)pMatch));
+        const unsigned mask = (unsigned)_mm_movemask_epi8(eq) ^ 0xFFFF;
+        if (mask) return (unsigned)(pIn - pStart) + LZ4_firstBit(mask);
+        pIn+=16; pMatch+=16;
+    }
+
+    return (unsigned)(pIn - pStart) + LZ4_count(pIn, pMatch, pInLimit);
+}
+
+/* same as LZ4_count16(), 32 bytes at a time */
+LZ4_TARGET("avx2,bmi") static unsigned LZ4_count32(const BYTE* pIn, const BYTE* pMatch, const BYTE* pInLimit)
+{
+    const BYTE* const pStart = pIn;
+
+    if (likely(pIn<pInLimit-(STEPSIZE-1)))
+    {
+        size_t diff = LZ4_read_ARCH(pMatch) ^ LZ4_read_ARCH(pIn);
+        if (diff) return LZ4_NbCommonBytes(diff);
+        pIn+=STEPSIZE; pMatch+=STEPSIZE;
+    }
+
+    while (likely(pIn<pInLimit-31))
+    {
+        const __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)pIn), _mm256_loadu_si256((const __m256i*)pMatch));
+        const unsigned mask = ~(unsigned)_mm256_movemask_epi8(eq);
+        if (mask) return (unsigned)(pIn - pStart) + LZ4_firstBit(mask);
+        pIn+=32; pMatch+=32;
+    }
+
+    return (unsigned)(pIn - pStart) + LZ4_count16(pIn, pMatch, pInLimit);
+}
+
+#endif   /* LZ4_SIMD */
+
+
+FORCE_INLINE unsigned LZ4_countSimd(const BYTE* pIn, const BYTE* pMatch, const BYTE* pInLimit, int simd)
+{
+#if LZ4_SIMD
+    if (simd == simdAVX2) return LZ4_count32(pIn, pMatch, pInLimit);
+    if (simd == simdSSE2) return LZ4_count16(pIn, pMatch, pInLimit);
+#endif
+    (void)simd;
+    return LZ4_count(pIn, pMatch, pInLimit);
+}
+
+
 /**************************************
 *  Local Utils
 **************************************/
@@ -378,30 +579,30 @@ int LZ4_sizeofState() { return LZ4_STREAMSIZE; }
 *  Compression functions
 ********************************/
 
-static U32 LZ4_hashSequence(U32 sequence, tableType_t const tableType)
+static U32 LZ4_hashSequence(U32 sequence, tableType_t const tableType, U32 const hashLog)
 {
     if (tableType == byU16)
-        return (((sequence) * 2654435761U) >> ((MINMATCH*8)-(LZ4_HASHLOG+1)));
+        return (((sequence) * 2654435761U) >> ((MINMATCH*8)-(hashLog+1)));
     else
-        return (((sequence) * 2654435761U) >> ((MINMATCH*8)-LZ4_HASHLOG));
+        return (((sequence) * 2654435761U) >> ((MINMATCH*8)-hashLog));
 }
 
 static const U64 prime5bytes = 889523592379ULL;
-static U32 LZ4_hashSequence64(size_t sequence, tableType_t const tableType)
+static U32 LZ4_hashSequence64(size_t sequence, tableType_t const tableType, U32 const tableLog)
 {
-    const U32 hashLog = (tableType == byU16) ? LZ4_HASHLOG+1 : LZ4_HASHLOG;
+    const U32 hashLog = (tableType == byU16) ? tableLog+1 : tableLog;
     const U32 hashMask = (1<<hashLog) - 1;
     return ((sequence * prime5bytes) >> (40 - hashLog)) & hashMask;
 }
 
-static U32 LZ4_hashSequenceT(size_t sequence, tableType_t const tableType)
+static U32 LZ4_hashSequenceT(size_t sequence, tableType_t const tableType, U32 const hashLog)
 {
     if (LZ4_64bits())
-        return LZ4_hashSequence64(sequence, tableType);
-    return LZ4_hashSequence((U32)sequence, tableType);
+        return LZ4_hashSequence64(sequence, tableType, hashLog);
+    return LZ4_hashSequence((U32)sequence, tableType, hashLog);
 }
 
-static U32 LZ4_hashPosition(const void* p, tableType_t tableType) { return LZ4_hashSequenceT(LZ4_read_ARCH(p), tableType); }
+static U32 LZ4_hashPosition(const void* p, tableType_t tableType, U32 hashLog) { return LZ4_hashSequenceT(LZ4_read_ARCH(p), tableType, hashLog); }
 
 static void LZ4_putPositionOnHash(const BYTE* p, U32 h, void* tableBase, tableType_t const tableType, const BYTE* srcBase)
 {
@@ -413,9 +614,9 @@ static void LZ4_putPositionOnHash(const BYTE* p, U32 h, void* tableBase, tableTy
     }
 }
 
-static void LZ4_putPosition(const BYTE* p, void* tableBase, tableType_t tableType, const BYTE* srcBase)
+static void LZ4_putPosition(const BYTE* p, void* tableBase, tableType_t tableType, const BYTE* srcBase, U32 hashLog)
 {
-    U32 h = LZ4_hashPosition(p, tableType);
+    U32 h = LZ4_hashPosition(p, tableType, hashLog);
     LZ4_putPositionOnHash(p, h, tableBase, tableType, srcBase);
 }
 
@@ -426,14 +627,15 @@ static const BYTE* LZ4_getPositionOnHash(U32 h, void* tableBase, tableType_t tab
     { U16* hashTable = (U16*) tableBase; return hashTable[h] + srcBase; }   /* default, to ensure a return */
 }
 
-static const BYTE* LZ4_getPosition(const BYTE* p, void* tableBase, tableType_t tableType, const BYTE* srcBase)
+static const BYTE* LZ4_getPosition(const BYTE* p, void* tableBase, tableType_t tableType, const BYTE* srcBase, U32 hashLog)
 {
-    U32 h = LZ4_hashPosition(p, tableType);
+    U32 h = LZ4_hashPosition(p, tableType, hashLog);
     return LZ4_getPositionOnHash(h, tableBase, tableType, srcBase);
 }
 
-FORCE_INLINE int LZ4_compress_generic(
-                 void* const ctx,
+FORCE_INLINE int LZ4_compress_body(
+                 void* const tableBase,
+                 const LZ4_window_t* const dictPtr,
                  const char* const source,
                  char* const dest,
                  const int inputSize,
@@ -442,10 +644,10 @@ FORCE_INLINE int LZ4_compress_generic(
                  const tableType_t tableType,
                  const dict_directive dict,
                  const dictIssue_directive dictIssue,
-                 const U32 acceleration)
+                 const U32 acceleration,
+                 const U32 hashLog,
+                 const int simd)
 {
-    LZ4_stream_t_internal* const dictPtr = (LZ4_stream_t_internal*)ctx;
-
     const BYTE* ip = (const BYTE*) source;
     const BYTE* base;
     const BYTE* lowLimit;
@@ -486,8 +688,8 @@ FORCE_INLINE int LZ4_compress_generic(
     if (inputSize<LZ4_minLength) goto _last_literals;                  /* Input too small, no compression (all literals) */
 
     /* First Byte */
-    LZ4_putPosition(ip, ctx, tableType, base);
-    ip++; forwardH = LZ4_hashPosition(ip, tableType);
+    LZ4_putPosition(ip, tableBase, tableType, base, hashLog);
+    ip++; forwardH = LZ4_hashPosition(ip, tableType, hashLog);
 
     /* Main Loop */
     for ( ; ; )
@@ -508,7 +710,7 @@ FORCE_INLINE int LZ4_compress_generic(
 
                 if (unlikely(forwardIp > mflimit)) goto _last_literals;
 
-                match = LZ4_getPositionOnHash(h, ctx, tableType, base);
+                match = LZ4_getPositionOnHash(h, tableBase, tableType, base);
                 if (dict==usingExtDict)
                 {
                     if (match<(const BYTE*)source)
@@ -522,8 +724,8 @@ FORCE_INLINE int LZ4_compress_generic(
                         lowLimit = (const BYTE*)source;
                     }
                 }
-                forwardH = LZ4_hashPosition(forwardIp, tableType);
-                LZ4_putPositionOnHash(ip, h, ctx, tableType, base);
+                forwardH = LZ4_hashPosition(forwardIp, tableType, hashLog);
+                LZ4_putPositionOnHash(ip, h, tableBase, tableType, base);
 
             } while ( ((dictIssue==dictSmall) ? (match < lowRefLimit) : 0)
                 || ((tableType==byU16) ? 0 : (match + MAX_DISTANCE < ip))
@@ -567,18 +769,18 @@ _next_match:
                 match += refDelta;
                 limit = ip + (dictEnd-match);
                 if (limit > matchlimit) limit = matchlimit;
-                matchLength = LZ4_count(ip+MINMATCH, match+MINMATCH, limit);
+                matchLength = LZ4_countSimd(ip+MINMATCH, match+MINMATCH, limit, simd);
                 ip += MINMATCH + matchLength;
                 if (ip==limit)
                 {
-                    unsigned more = LZ4_count(ip, (const BYTE*)source, matchlimit);
+                    unsigned more = LZ4_countSimd(ip, (const BYTE*)source, matchlimit, simd);
                     matchLength += more;
                     ip += more;
                 }
             }
             else
             {
-                matchLength = LZ4_count(ip+MINMATCH, match+MINMATCH, matchlimit);
+                matchLength = LZ4_countSimd(ip+MINMATCH, match+MINMATCH, matchlimit, simd);
                 ip += MINMATCH + matchLength;
             }
 
@@ -601,10 +803,10 @@ _next_match:
         if (ip > mflimit) break;
 
         /* Fill table */
-        LZ4_putPosition(ip-2, ctx, tableType, base);
+        LZ4_putPosition(ip-2, tableBase, tableType, base, hashLog);
 
         /* Test next position */
-        match = LZ4_getPosition(ip, ctx, tableType, base);
+        match = LZ4_getPosition(ip, tableBase, tableType, base, hashLog);
         if (dict==usingExtDict)
         {
             if (match<(const BYTE*)source)
@@ -618,14 +820,14 @@ _next_match:
                 lowLimit = (const BYTE*)source;
             }
         }
-        LZ4_putPosition(ip, ctx, tableType, base);
+        LZ4_putPosition(ip, tableBase, tableType, base, hashLog);
         if ( ((dictIssue==dictSmall) ? (match>=lowRefLimit) : 1)
             && (match+MAX_DISTANCE>=ip)
             && (LZ4_read32(match+refDelta)==LZ4_read32(ip)) )
         { token=op++; *token=0; goto _next_match; }
 
         /* Prepare next loop */
-        forwardH = LZ4_hashPosition(++ip, tableType);
+        forwardH = LZ4_hashPosition(++ip, tableType, hashLog);
     }
 
 _last_literals:
@@ -654,6 +856,123 @@ _last_literals:
 }
 
 
+#if LZ4_SIMD
+/*
+ * LZ4_compress_sse2(), LZ4_compress_avx2() :
+ * LZ4_compress_body() compiled for a CPU level. The use cases of this file
+ * are listed with constant directives, so each one is still specialized;
+ * any other combination runs with the directives as variables.
+ */
+FORCE_INLINE int LZ4_compress_simd(
+                 void* const tableBase, const LZ4_window_t* const dictPtr,
+                 const char* const source, char* const dest,
+                 const int inputSize, const int maxOutputSize,
+                 const limitedOutput_directive outputLimited, const tableType_t tableType,
+                 const dict_directive dict, const dictIssue_directive dictIssue,
+                 const U32 acceleration, const U32 hashLog, const int simd)
+{
+#define LZ4_COMPRESS_CASE(l, t, d, i, h) \
+    if ((outputLimited==l) && (tableType==t) && (dict==d) && (dictIssue==i) && (hashLog==h)) \
+        return LZ4_compress_body(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, l, t, d, i, acceleration, h, simd)
+#define LZ4_COMPRESS_STREAM_CASES(h) \
+    LZ4_COMPRESS_CASE(limitedOutput, byU32, withPrefix64k, noDictIssue, h); \
+    LZ4_COMPRESS_CASE(limitedOutput, byU32, withPrefix64k, dictSmall,   h); \
+    LZ4_COMPRESS_CASE(limitedOutput, byU32, usingExtDict,  noDictIssue, h); \
+    LZ4_COMPRESS_CASE(limitedOutput, byU32, usingExtDict,  dictSmall,   h)
+    LZ4_COMPRESS_CASE(notLimited,    byU16, noDict,        noDictIssue, LZ4_HASHLOG);
+    LZ4_COMPRESS_CASE(notLimited,    byU32, noDict,        noDictIssue, LZ4_HASHLOG);
+    LZ4_COMPRESS_CASE(limitedOutput, byU16, noDict,        noDictIssue, LZ4_HASHLOG);
+    LZ4_COMPRESS_CASE(limitedOutput, byU32, noDict,        noDictIssue, LZ4_HASHLOG);
+    LZ4_COMPRESS_CASE(notLimited,    byU32, usingExtDict,  noDictIssue, LZ4_HASHLOG);
+    LZ4_COMPRESS_STREAM_CASES(LZ4_HASHLOG);
+#if LZ4_HASHLOG != 10
+    LZ4_COMPRESS_STREAM_CASES(10);
+#endif
+#if LZ4_HASHLOG != 12
+    LZ4_COMPRESS_STREAM_CASES(12);
+#endif
+#if LZ4_HASHLOG != 14
+    LZ4_COMPRESS_STREAM_CASES(14);
+#endif
+#if LZ4_HASHLOG != 16
+    LZ4_COMPRESS_STREAM_CASES(16);
+#endif
+#if LZ4_HASHLOG != 18
+    LZ4_COMPRESS_STREAM_CASES(18);
+#endif
+#undef LZ4_COMPRESS_STREAM_CASES
+#undef LZ4_COMPRESS_CASE
+    return LZ4_compress_body(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, hashLog, simd);
+}
+
+LZ4_TARGET_FLATTEN("sse2") static int LZ4_compress_sse2(
+                 void* const tableBase, const LZ4_window_t* const dictPtr,
+                 const char* const source, char* const dest,
+                 const int inputSize, const int maxOutputSize,
+                 const limitedOutput_directive outputLimited, const tableType_t tableType,
+                 const dict_directive dict, const dictIssue_directive dictIssue,
+                 const U32 acceleration, const U32 hashLog)
+{
+    return LZ4_compress_simd(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, hashLog, simdSSE2);
+}
+
+LZ4_TARGET_FLATTEN("avx2,bmi,bmi2") static int LZ4_compress_avx2(
+                 void* const tableBase, const LZ4_window_t* const dictPtr,
+                 const char* const source, char* const dest,
+                 const int inputSize, const int maxOutputSize,
+                 const limitedOutput_directive outputLimited, const tableType_t tableType,
+                 const dict_directive dict, const dictIssue_directive dictIssue,
+                 const U32 acceleration, const U32 hashLog)
+{
+    return LZ4_compress_simd(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, hashLog, simdAVX2);
+}
+#endif
+
+
+/*
+ * Selects the variant matching the CPU, then runs LZ4_compress_body()
+ * over a hash table of (1<<hashLog) entries.
+ */
+FORCE_INLINE int LZ4_compress_tables(
+                 void* const tableBase,
+                 const LZ4_window_t* const dictPtr,
+                 const char* const source,
+                 char* const dest,
+                 const int inputSize,
+                 const int maxOutputSize,
+                 const limitedOutput_directive outputLimited,
+                 const tableType_t tableType,
+                 const dict_directive dict,
+                 const dictIssue_directive dictIssue,
+                 const U32 acceleration,
+                 const U32 hashLog)
+{
+#if LZ4_SIMD
+    const int simd = LZ4_compressLevel();
+    if (simd == simdAVX2)
+        return LZ4_compress_avx2(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, hashLog);
+    if (simd == simdSSE2)
+        return LZ4_compress_sse2(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, hashLog);
+#endif
+    return LZ4_compress_body(tableBase, dictPtr, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, hashLog, simdNone);
+}
+
+FORCE_INLINE int LZ4_compress_generic(
+                 void* const ctx,
+                 const char* const source,
+                 char* const dest,
+                 const int inputSize,
+                 const int maxOutputSize,
+                 const limitedOutput_directive outputLimited,
+                 const tableType_t tableType,
+                 const dict_directive dict,
+                 const dictIssue_directive dictIssue,
+                 const U32 acceleration)
+{
+    LZ4_stream_t_internal* const streamPtr = (LZ4_stream_t_internal*)ctx;
+    return LZ4_compress_tables(streamPtr->hashTable, &streamPtr->window, source, dest, inputSize, maxOutputSize, outputLimited, tableType, dict, dictIssue, acceleration, LZ4_HASHLOG);
+}
+
 int LZ4_compress_fast_extState(void* state, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
 {
     LZ4_resetStream((LZ4_stream_t*)state);
@@ -752,8 +1071,8 @@ static int LZ4_compress_destSize_generic(
 
     /* First Byte */
     *srcSizePtr = 0;
-    LZ4_putPosition(ip, ctx, tableType, base);
-    ip++; forwardH = LZ4_hashPosition(ip, tableType);
+    LZ4_putPosition(ip, ctx, tableType, base, LZ4_HASHLOG);
+    ip++; forwardH = LZ4_hashPosition(ip, tableType, LZ4_HASHLOG);
 
     /* Main Loop */
     for ( ; ; )
@@ -776,7 +1095,7 @@ static int LZ4_compress_destSize_generic(
                     goto _last_literals;
 
                 match = LZ4_getPositionOnHash(h, ctx, tableType, base);
-                forwardH = LZ4_hashPosition(forwardIp, tableType);
+                forwardH = LZ4_hashPosition(forwardIp, tableType, LZ4_HASHLOG);
                 LZ4_putPositionOnHash(ip, h, ctx, tableType, base);
 
             } while ( ((tableType==byU16) ? 0 : (match + MAX_DISTANCE < ip))
@@ -845,17 +1164,17 @@ _next_match:
         if (op > oMaxSeq) break;
 
         /* Fill table */
-        LZ4_putPosition(ip-2, ctx, tableType, base);
+        LZ4_putPosition(ip-2, ctx, tableType, base, LZ4_HASHLOG);
 
         /* Test next position */
-        match = LZ4_getPosition(ip, ctx, tableType, base);
-        LZ4_putPosition(ip, ctx, tableType, base);
+        match = LZ4_getPosition(ip, ctx, tableType, base, LZ4_HASHLOG);
+        LZ4_putPosition(ip, ctx, tableType, base, LZ4_HASHLOG);
         if ( (match+MAX_DISTANCE>=ip)
             && (LZ4_read32(match)==LZ4_read32(ip)) )
         { token=op++; *token=0; goto _next_match; }
 
         /* Prepare next loop */
-        forwardH = LZ4_hashPosition(++ip, tableType);
+        forwardH = LZ4_hashPosition(++ip, tableType, LZ4_HASHLOG);
     }
 
 _last_literals:
@@ -953,15 +1272,20 @@ int LZ4_freeStream (LZ4_stream_t* LZ4_stream)
 
 
 #define HASH_UNIT sizeof(size_t)
-int LZ4_loadDict (LZ4_stream_t* LZ4_dict, const char* dictionary, int dictSize)
+static void LZ4_resetWindow(LZ4_window_t* window, U32* hashTable, U32 hashLog)
+{
+    MEM_INIT(hashTable, 0, sizeof(U32) << hashLog);
+    MEM_INIT(window, 0, sizeof(LZ4_window_t));
+}
+
+static int LZ4_loadDict_generic(LZ4_window_t* dict, U32* hashTable, U32 hashLog, const char* dictionary, int dictSize)
 {
-    LZ4_stream_t_internal* dict = (LZ4_stream_t_internal*) LZ4_dict;
     const BYTE* p = (const BYTE*)dictionary;
     const BYTE* const dictEnd = p + dictSize;
     const BYTE* base;
 
     if ((dict->initCheck) || (dict->currentOffset > 1 GB))  /* Uninitialized structure, or reuse overflow */
-        LZ4_resetStream(LZ4_dict);
+        LZ4_resetWindow(dict, hashTable, hashLog);
 
     if (dictSize < (int)HASH_UNIT)
     {
@@ -979,15 +1303,21 @@ int LZ4_loadDict (LZ4_stream_t* LZ4_dict, const char* dictionary, int dictSize)
 
     while (p <= dictEnd-HASH_UNIT)
     {
-        LZ4_putPosition(p, dict->hashTable, byU32, base);
+        LZ4_putPosition(p, hashTable, byU32, base, hashLog);
         p+=3;
     }
 
     return dict->dictSize;
 }
 
+int LZ4_loadDict (LZ4_stream_t* LZ4_dict, const char* dictionary, int dictSize)
+{
+    LZ4_stream_t_internal* dict = (LZ4_stream_t_internal*) LZ4_dict;
+    return LZ4_loadDict_generic(&dict->window, dict->hashTable, LZ4_HASHLOG, dictionary, dictSize);
+}
 
-static void LZ4_renormDictT(LZ4_stream_t_internal* LZ4_dict, const BYTE* src)
+
+static void LZ4_renormDictT(LZ4_window_t* LZ4_dict, U32* hashTable, U32 hashLog, const BYTE* src)
 {
     if ((LZ4_dict->currentOffset > 0x80000000) ||
         ((size_t)LZ4_dict->currentOffset > (size_t)src))   /* address space overflow */
@@ -995,11 +1325,11 @@ static void LZ4_renormDictT(LZ4_stream_t_internal* LZ4_dict, const BYTE* src)
         /* rescale hash table */
         U32 delta = LZ4_dict->currentOffset - 64 KB;
         const BYTE* dictEnd = LZ4_dict->dictionary + LZ4_dict->dictSize;
-        int i;
-        for (i=0; i<HASH_SIZE_U32; i++)
+        U32 i;
+        for (i=0; i<(1U<<hashLog); i++)
         {
-            if (LZ4_dict->hashTable[i] < delta) LZ4_dict->hashTable[i]=0;
-            else LZ4_dict->hashTable[i] -= delta;
+            if (hashTable[i] < delta) hashTable[i]=0;
+            else hashTable[i] -= delta;
         }
         LZ4_dict->currentOffset = 64 KB;
         if (LZ4_dict->dictSize > 64 KB) LZ4_dict->dictSize = 64 KB;
@@ -1008,15 +1338,15 @@ static void LZ4_renormDictT(LZ4_stream_t_internal* LZ4_dict, const BYTE* src)
 }
 
 
-int LZ4_compress_fast_continue (LZ4_stream_t* LZ4_stream, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+FORCE_INLINE int LZ4_compress_continue_generic (LZ4_window_t* streamPtr, U32* hashTable, const U32 hashLog,
+                 const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
 {
-    LZ4_stream_t_internal* streamPtr = (LZ4_stream_t_internal*)LZ4_stream;
     const BYTE* const dictEnd = streamPtr->dictionary + streamPtr->dictSize;
 
     const BYTE* smallest = (const BYTE*) source;
     if (streamPtr->initCheck) return 0;   /* Uninitialized structure detected */
     if ((streamPtr->dictSize>0) && (smallest>dictEnd)) smallest = dictEnd;
-    LZ4_renormDictT(streamPtr, smallest);
+    LZ4_renormDictT(streamPtr, hashTable, hashLog, smallest);
     if (acceleration < 1) acceleration = ACCELERATION_DEFAULT;
 
     /* Check overlapping input/dictionary space */
@@ -1036,9 +1366,9 @@ int LZ4_compress_fast_continue (LZ4_stream_t* LZ4_stream, const char* source, ch
     {
         int result;
         if ((streamPtr->dictSize < 64 KB) && (streamPtr->dictSize < streamPtr->currentOffset))
-            result = LZ4_compress_generic(LZ4_stream, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, withPrefix64k, dictSmall, acceleration);
+            result = LZ4_compress_tables(hashTable, streamPtr, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, withPrefix64k, dictSmall, acceleration, hashLog);
         else
-            result = LZ4_compress_generic(LZ4_stream, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, withPrefix64k, noDictIssue, acceleration);
+            result = LZ4_compress_tables(hashTable, streamPtr, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, withPrefix64k, noDictIssue, acceleration, hashLog);
         streamPtr->dictSize += (U32)inputSize;
         streamPtr->currentOffset += (U32)inputSize;
         return result;
@@ -1048,9 +1378,9 @@ int LZ4_compress_fast_continue (LZ4_stream_t* LZ4_stream, const char* source, ch
     {
         int result;
         if ((streamPtr->dictSize < 64 KB) && (streamPtr->dictSize < streamPtr->currentOffset))
-            result = LZ4_compress_generic(LZ4_stream, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, usingExtDict, dictSmall, acceleration);
+            result = LZ4_compress_tables(hashTable, streamPtr, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, usingExtDict, dictSmall, acceleration, hashLog);
         else
-            result = LZ4_compress_generic(LZ4_stream, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, usingExtDict, noDictIssue, acceleration);
+            result = LZ4_compress_tables(hashTable, streamPtr, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, usingExtDict, noDictIssue, acceleration, hashLog);
         streamPtr->dictionary = (const BYTE*)source;
         streamPtr->dictSize = (U32)inputSize;
         streamPtr->currentOffset += (U32)inputSize;
@@ -1058,17 +1388,24 @@ int LZ4_compress_fast_continue (LZ4_stream_t* LZ4_stream, const char* source, ch
     }
 }
 
+int LZ4_compress_fast_continue (LZ4_stream_t* LZ4_stream, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+{
+    LZ4_stream_t_internal* streamPtr = (LZ4_stream_t_internal*)LZ4_stream;
+    return LZ4_compress_continue_generic(&streamPtr->window, streamPtr->hashTable, LZ4_HASHLOG, source, dest, inputSize, maxOutputSize, acceleration);
+}
+
 
 /* Hidden debug function, to force external dictionary mode */
 int LZ4_compress_forceExtDict (LZ4_stream_t* LZ4_dict, const char* source, char* dest, int inputSize)
 {
-    LZ4_stream_t_internal* streamPtr = (LZ4_stream_t_internal*)LZ4_dict;
+    LZ4_stream_t_internal* const streamCtx = (LZ4_stream_t_internal*)LZ4_dict;
+    LZ4_window_t* const streamPtr = &streamCtx->window;
     int result;
     const BYTE* const dictEnd = streamPtr->dictionary + streamPtr->dictSize;
 
     const BYTE* smallest = dictEnd;
     if (smallest > (const BYTE*) source) smallest = (const BYTE*) source;
-    LZ4_renormDictT((LZ4_stream_t_internal*)LZ4_dict, smallest);
+    LZ4_renormDictT(streamPtr, streamCtx->hashTable, LZ4_HASHLOG, smallest);
 
     result = LZ4_compress_generic(LZ4_dict, source, dest, inputSize, 0, notLimited, byU32, usingExtDict, noDictIssue, 1);
 
@@ -1080,9 +1417,8 @@ int LZ4_compress_forceExtDict (LZ4_stream_t* LZ4_dict, const char* source, char*
 }
 
 
-int LZ4_saveDict (LZ4_stream_t* LZ4_dict, char* safeBuffer, int dictSize)
+static int LZ4_saveDict_generic (LZ4_window_t* dict, char* safeBuffer, int dictSize)
 {
-    LZ4_stream_t_internal* dict = (LZ4_stream_t_internal*) LZ4_dict;
     const BYTE* previousDictEnd = dict->dictionary + dict->dictSize;
 
     if ((U32)dictSize > 64 KB) dictSize = 64 KB;   /* useless to define a dictionary > 64 KB */
@@ -1096,6 +1432,63 @@ int LZ4_saveDict (LZ4_stream_t* LZ4_dict, char* safeBuffer, int dictSize)
     return dictSize;
 }
 
+int LZ4_saveDict (LZ4_stream_t* LZ4_dict, char* safeBuffer, int dictSize)
+{
+    return LZ4_saveDict_generic(&((LZ4_stream_t_internal*)LZ4_dict)->window, safeBuffer, dictSize);
+}
+
+
+/********************************
+*  Streams with a chosen hash table size
+********************************/
+
+LZ4_streamHashLog_t* LZ4_createStreamHashLog(int hashLog)
+{
+    LZ4_streamHashLog_t* lz4s;
+    if ((hashLog < LZ4_HASHLOG_MIN) || (hashLog > LZ4_HASHLOG_MAX) || (hashLog & 1)) return NULL;
+    lz4s = (LZ4_streamHashLog_t*)ALLOCATOR(1, sizeof(LZ4_streamHashLog_t) + (sizeof(U32) << hashLog));
+    if (lz4s == NULL) return NULL;
+    lz4s->hashLog = (U32)hashLog;
+    return lz4s;
+}
+
+int LZ4_freeStreamHashLog (LZ4_streamHashLog_t* LZ4_stream)
+{
+    FREEMEM(LZ4_stream);
+    return (0);
+}
+
+void LZ4_resetStreamHashLog (LZ4_streamHashLog_t* LZ4_stream)
+{
+    LZ4_resetWindow(&LZ4_stream->window, LZ4_stream->hashTable, LZ4_stream->hashLog);
+}
+
+int LZ4_loadDictHashLog (LZ4_streamHashLog_t* LZ4_dict, const char* dictionary, int dictSize)
+{
+    return LZ4_loadDict_generic(&LZ4_dict->window, LZ4_dict->hashTable, LZ4_dict->hashLog, dictionary, dictSize);
+}
+
+/* one instantiation of LZ4_compress_generic() per supported hashLog */
+int LZ4_compress_fast_continueHashLog (LZ4_streamHashLog_t* LZ4_stream, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+{
+    LZ4_window_t* const window = &LZ4_stream->window;
+    U32* const hashTable = LZ4_stream->hashTable;
+    switch (LZ4_stream->hashLog)
+    {
+    case 10: return LZ4_compress_continue_generic(window, hashTable, 10, source, dest, inputSize, maxOutputSize, acceleration);
+    case 12: return LZ4_compress_continue_generic(window, hashTable, 12, source, dest, inputSize, maxOutputSize, acceleration);
+    case 14: return LZ4_compress_continue_generic(window, hashTable, 14, source, dest, inputSize, maxOutputSize, acceleration);
+    case 16: return LZ4_compress_continue_generic(window, hashTable, 16, source, dest, inputSize, maxOutputSize, acceleration);
+    case 18: return LZ4_compress_continue_generic(window, hashTable, 18, source, dest, inputSize, maxOutputSize, acceleration);
+    default: return 0;
+    }
+}
+
+int LZ4_saveDictHashLog (LZ4_streamHashLog_t* LZ4_dict, char* safeBuffer, int dictSize)
+{
+    return LZ4_saveDict_generic(&LZ4_dict->window, safeBuffer, dictSize);
+}
+
 
 
 /*******************************
@@ -1107,7 +1500,7 @@ int LZ4_saveDict (LZ4_stream_t* LZ4_dict, char* safeBuffer, int dictSize)
  * Note that it is essential this generic function is really inlined,
  * in order to remove useless branches during compilation optimization.
  */
-FORCE_INLINE int LZ4_decompress_generic(
+FORCE_INLINE int LZ4_decompress_body(
                  const char* const source,
                  char* const dest,
                  int inputSize,
@@ -1119,7 +1512,8 @@ FORCE_INLINE int LZ4_decompress_generic(
                  int dict,               /* noDict, withPrefix64k, usingExtDict */
                  const BYTE* const lowPrefix,  /* == dest if dict == noDict */
                  const BYTE* const dictStart,  /* only if dict==usingExtDict */
-                 const size_t dictSize         /* note : = 0 if noDict */
+                 const size_t dictSize,        /* note : = 0 if noDict */
+                 int simd                /* simdNone, simdSSE2, simdAVX2 */
                  )
 {
     /* Local Variables */
@@ -1188,6 +1582,11 @@ FORCE_INLINE int LZ4_decompress_generic(
             op += length;
             break;     /* Necessarily EOF, due to parsing restrictions */
         }
+#if LZ4_SIMD
+        if ((simd == simdAVX2) && (length > 32)) LZ4_wildCopy32(op, ip, cpy);   /* short runs stay on the scalar path, fewer branches */
+        else if ((simd == simdSSE2) && (length > 16)) LZ4_wildCopy16(op, ip, cpy);
+        else
+#endif
         LZ4_wildCopy(op, ip, cpy);
         ip += length; op = cpy;
 
@@ -1245,6 +1644,22 @@ FORCE_INLINE int LZ4_decompress_generic(
 
         /* copy repeated sequence */
         cpy = op + length;
+#if LZ4_SIMD
+        if ((simd != simdNone) && (length >= 32))   /* long matches only, like literals */
+        {
+            const size_t offset = (size_t)(op - match);
+            BYTE* const copyEnd = likely(cpy <= oend-32) ? cpy : oend-32;   /* leave room for the kernels to overwrite */
+            if ((op < copyEnd) && ((offset >= 16) || ((simd == simdAVX2) && (offset > 0))))
+            {
+                if ((simd == simdAVX2) && (offset >= 32)) LZ4_matchCopy32(op, match, copyEnd);
+                else if (offset >= 16) LZ4_matchCopy16(op, match, copyEnd);
+                else LZ4_patternCopy32(op, match, copyEnd, offset);
+                if (copyEnd == cpy) { op = cpy; continue; }
+                match += copyEnd - op;   /* the end of the match is copied below */
+                op = copyEnd;
+            }
+        }
+#endif
         if (unlikely((op-match)<8))
         {
             const size_t dec64 = dec64table[op-match];
@@ -1285,6 +1700,106 @@ _output_error:
 }
 
 
+#if LZ4_SIMD
+/*
+ * LZ4_decompress_sse2(), LZ4_decompress_avx2() :
+ * LZ4_decompress_body() compiled for a CPU level. Every branch below passes
+ * constant directives, so each use case is still specialized.
+ */
+FORCE_INLINE int LZ4_decompress_simd(const char* source, char* dest, int inputSize, int outputSize,
+                 int endOnInput, int partialDecoding, int targetOutputSize, int dict,
+                 const BYTE* lowPrefix, const BYTE* dictStart, size_t dictSize, int simd)
+{
+    if (partialDecoding)
+        return LZ4_decompress_body(source, dest, inputSize, outputSize, endOnInput, partial, targetOutputSize, dict, lowPrefix, dictStart, dictSize, simd);
+    if (endOnInput == endOnOutputSize)
+    {
+        if (dict == usingExtDict)
+            return LZ4_decompress_body(source, dest, 0, outputSize, endOnOutputSize, full, 0, usingExtDict, lowPrefix, dictStart, dictSize, simd);
+        return LZ4_decompress_body(source, dest, 0, outputSize, endOnOutputSize, full, 0, withPrefix64k, lowPrefix, NULL, dictSize, simd);
+    }
+    if (dict == usingExtDict)
+        return LZ4_decompress_body(source, dest, inputSize, outputSize, endOnInputSize, full, 0, usingExtDict, lowPrefix, dictStart, dictSize, simd);
+    return LZ4_decompress_body(source, dest, inputSize, outputSize, endOnInputSize, full, 0, noDict, lowPrefix, NULL, dictSize, simd);
+}
+
+LZ4_TARGET_FLATTEN("sse2") static int LZ4_decompress_sse2(const char* source, char* dest, int inputSize, int outputSize,
+                 int endOnInput, int partialDecoding, int targetOutputSize, int dict,
+                 const BYTE* lowPrefix, const BYTE* dictStart, size_t dictSize)
+{
+    return LZ4_decompress_simd(source, dest, inputSize, outputSize, endOnInput, partialDecoding, targetOutputSize, dict, lowPrefix, dictStart, dictSize, simdSSE2);
+}
+
+LZ4_TARGET_FLATTEN("avx2") static int LZ4_decompress_avx2(const char* source, char* dest, int inputSize, int outputSize,
+                 int endOnInput, int partialDecoding, int targetOutputSize, int dict,
+                 const BYTE* lowPrefix, const BYTE* dictStart, size_t dictSize)
+{
+    return LZ4_decompress_simd(source, dest, inputSize, outputSize, endOnInput, partialDecoding, targetOutputSize, dict, lowPrefix, dictStart, dictSize, simdAVX2);
+}
+#endif
+
+
+/*
+ * Selects the kernels matching the CPU, then runs LZ4_decompress_body().
+ */
+FORCE_INLINE int LZ4_decompress_generic(
+                 const char* const source,
+                 char* const dest,
+                 int inputSize,
+                 int outputSize,
+                 int endOnInput,
+                 int partialDecoding,
+                 int targetOutputSize,
+                 int dict,
+                 const BYTE* const lowPrefix,
+                 const BYTE* const dictStart,
+                 const size_t dictSize
+                 )
+{
+#if LZ4_SIMD
+    const int simd = LZ4_simdLevel();
+    if (simd == simdAVX2)
+        return LZ4_decompress_avx2(source, dest, inputSize, outputSize, endOnInput, partialDecoding, targetOutputSize, dict, lowPrefix, dictStart, dictSize);
+    if (simd == simdSSE2)
+        return LZ4_decompress_sse2(source, dest, inputSize, outputSize, endOnInput, partialDecoding, targetOutputSize, dict, lowPrefix, dictStart, dictSize);
+#endif
+    return LZ4_decompress_body(source, dest, inputSize, outputSize, endOnInput, partialDecoding, targetOutputSize, dict, lowPrefix, dictStart, dictSize, simdNone);
+}
+
+
+const char* LZ4_compressVariant(void)
+{
+#if LZ4_SIMD
+    switch (LZ4_compressLevel())
+    {
+    case simdAVX2: return "avx2";
+    case simdSSE2: return "sse2";
+    default: break;
+    }
+#endif
+    return "scalar";
+}
+
+const char* LZ4_decompressVariant(void)
+{
+#if LZ4_SIMD
+    switch (LZ4_simdLevel())
+    {
+    case simdAVX2: return "avx2";
+    case simdSSE2: return "sse2";
+    default: break;
+    }
+#endif
+    return "scalar";
+}
+
+/* LZ4_count() of the compression variant */
+const char* LZ4_countVariant(void)
+{
+    return LZ4_compressVariant();
+}
+
+
 int LZ4_decompress_safe(const char* source, char* dest, int compressedSize, int maxDecompressedSize)
 {
     return LZ4_decompress_generic(source, dest, compressedSize, maxDecompressedSize, endOnInputSize, full, 0, noDict, (BYTE*)dest, NULL, 0);
@@ -1398,7 +1913,7 @@ int LZ4_decompress_fast_continue (LZ4_streamDecode_t* LZ4_streamDecode, const ch
     else
     {
         lz4sd->extDictSize = lz4sd->prefixSize;
-        lz4sd->externalDict = (BYTE*)dest - lz4sd->extDictSize;
+        lz4sd->externalDict = lz4sd->prefixEnd - lz4sd->extDictSize;
         result = LZ4_decompress_generic(source, dest, 0, originalSize,
                                         endOnOutputSize, full, 0,
                                         usingExtDict, (BYTE*)dest, lz4sd->externalDict, lz4sd->extDictSize);
@@ -1476,7 +1991,7 @@ int LZ4_sizeofStreamState() { return LZ4_STREAMSIZE; }
 static void LZ4_init(LZ4_stream_t_internal* lz4ds, BYTE* base)
 {
     MEM_INIT(lz4ds, 0, LZ4_STREAMSIZE);
-    lz4ds->bufferStart = base;
+    lz4ds->window.bufferStart = base;
 }
 
 int LZ4_resetStreamState(void* state, char* inputBuffer)
@@ -1496,8 +2011,8 @@ void* LZ4_create (char* inputBuffer)
 char* LZ4_slideInputBuffer (void* LZ4_Data)
 {
     LZ4_stream_t_internal* ctx = (LZ4_stream_t_internal*)LZ4_Data;
-    int dictSize = LZ4_saveDict((LZ4_stream_t*)LZ4_Data, (char*)ctx->bufferStart, 64 KB);
-    return (char*)(ctx->bufferStart + dictSize);
+    int dictSize = LZ4_saveDict((LZ4_stream_t*)LZ4_Data, (char*)ctx->window.bufferStart, 64 KB);
+    return (char*)(ctx->window.bufferStart + dictSize);
 }
 
 /* Obsolete streaming decompression functions */
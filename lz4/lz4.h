@@ -240,6 +240,26 @@ int LZ4_compress_fast_continue (LZ4_stream_t* streamPtr, const char* src, char*
 int LZ4_saveDict (LZ4_stream_t* streamPtr, char* safeBuffer, int dictSize);
 
 
+/*
+ * LZ4_streamHashLog_t
+ * Same as LZ4_stream_t, with a hash table of 2^hashLog entries (4 bytes each) chosen at creation,
+ * instead of 2^(LZ4_MEMORY_USAGE-2). hashLog is an even value from LZ4_HASHLOG_MIN (4 KB) to LZ4_HASHLOG_MAX (1 MB) :
+ * a larger table improves compression ratio, a smaller one fits in L1 cache.
+ * LZ4_createStreamHashLog returns NULL if hashLog is not supported, or if allocation fails.
+ * The other functions behave as their LZ4_stream_t counterparts.
+ */
+#define LZ4_HASHLOG_MIN 10
+#define LZ4_HASHLOG_MAX 18
+typedef struct LZ4_streamHashLog_s LZ4_streamHashLog_t;
+
+LZ4_streamHashLog_t* LZ4_createStreamHashLog(int hashLog);
+int  LZ4_freeStreamHashLog (LZ4_streamHashLog_t* streamPtr);
+void LZ4_resetStreamHashLog (LZ4_streamHashLog_t* streamPtr);
+int  LZ4_loadDictHashLog (LZ4_streamHashLog_t* streamPtr, const char* dictionary, int dictSize);
+int  LZ4_compress_fast_continueHashLog (LZ4_streamHashLog_t* streamPtr, const char* src, char* dst, int srcSize, int maxDstSize, int acceleration);
+int  LZ4_saveDictHashLog (LZ4_streamHashLog_t* streamPtr, char* safeBuffer, int dictSize);
+
+
 /************************************************
 *  Streaming Decompression Functions
 ************************************************/
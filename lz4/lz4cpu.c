@@ -0,0 +1,130 @@
+/*
+   LZ4 - CPU feature detection
+
+   BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+*/
+
+
+/**************************************
+*  Includes
+**************************************/
+#include "lz4cpu.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  define LZ4_CPU_X86 1
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  elif defined(__GNUC__) || defined(__clang__)
+#    include <cpuid.h>
+#  else
+#    undef LZ4_CPU_X86
+#  endif
+#endif
+
+
+/**************************************
+*  Detection
+**************************************/
+#ifdef LZ4_CPU_X86
+
+static void LZ4_cpuid(unsigned leaf, unsigned subleaf, unsigned r[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    r[0] = (unsigned)info[0]; r[1] = (unsigned)info[1]; r[2] = (unsigned)info[2]; r[3] = (unsigned)info[3];
+#else
+    __cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+/* register state the OS saves on context switches, valid only when OSXSAVE is set */
+static unsigned LZ4_xgetbv(void)
+{
+#if defined(_MSC_VER)
+    return (unsigned)_xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));   /* xgetbv */
+    return eax;
+#endif
+}
+
+unsigned LZ4_cpuDetect(void)
+{
+    unsigned r[4];
+    unsigned maxLeaf, xcr0 = 0, leaf1c, leaf1d, leaf7b = 0;
+    unsigned features = 0;
+
+    LZ4_cpuid(0, 0, r);
+    maxLeaf = r[0];
+    if (maxLeaf < 1) return 0;
+    LZ4_cpuid(1, 0, r);
+    leaf1c = r[2]; leaf1d = r[3];
+    if (maxLeaf >= 7) { LZ4_cpuid(7, 0, r); leaf7b = r[1]; }
+    if ((leaf1c >> 27) & 1) xcr0 = LZ4_xgetbv();
+
+    if ((leaf1d >> 26) & 1) features |= LZ4_CPU_SSE2;
+    if ((leaf1c >>  9) & 1) features |= LZ4_CPU_SSSE3;
+    if ((leaf1c >> 19) & 1) features |= LZ4_CPU_SSE41;
+    if ((leaf1c >> 20) & 1) features |= LZ4_CPU_SSE42;
+    if (((leaf7b >> 3) & 1) && ((leaf7b >> 8) & 1)) features |= LZ4_CPU_BMI2;
+    if (((leaf1c >> 28) & 1) && ((xcr0 & 0x06) == 0x06))   /* AVX, xmm and ymm saved */
+    {
+        if ((leaf7b >> 5) & 1) features |= LZ4_CPU_AVX2;
+        if (((leaf7b >> 16) & 1) && ((leaf7b >> 30) & 1) && ((leaf7b >> 31) & 1)
+            && ((xcr0 & 0xE0) == 0xE0))   /* opmask and zmm saved */
+            features |= LZ4_CPU_AVX512;
+    }
+    return features;
+}
+
+#else
+
+unsigned LZ4_cpuDetect(void) { return 0; }
+
+#endif   /* LZ4_CPU_X86 */
+
+
+/**************************************
+*  Selection
+**************************************/
+/* the selection is read by kernels of every thread while LZ4_cpuSelect() may change it */
+#if defined(__GNUC__) || defined(__clang__)
+#  define LZ4_CPU_LOAD(v)      __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#  define LZ4_CPU_STORE(v, x)  __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+#else   /* aligned volatile accesses are not torn on supported targets */
+#  define LZ4_CPU_LOAD(v)      (*(volatile unsigned*)&(v))
+#  define LZ4_CPU_STORE(v, x)  (*(volatile unsigned*)&(v) = (x))
+#endif
+
+#define LZ4_CPU_DETECTED (1U<<31)   /* 0 means not yet */
+
+static unsigned LZ4_cpuAvailable = 0;
+static unsigned LZ4_cpuSelected = 0;   /* 0 until LZ4_cpuSelect(), all available features */
+
+/* every thread detects the same features, a concurrent first call is harmless */
+static unsigned LZ4_cpuAvailableFeatures(void)
+{
+    unsigned available = LZ4_CPU_LOAD(LZ4_cpuAvailable);
+    if (!available)
+    {
+        available = LZ4_CPU_DETECTED | LZ4_cpuDetect();
+        LZ4_CPU_STORE(LZ4_cpuAvailable, available);
+    }
+    return available;
+}
+
+unsigned LZ4_cpuFeatures(void)
+{
+    unsigned selected = LZ4_CPU_LOAD(LZ4_cpuSelected);
+    if (!selected) selected = LZ4_cpuAvailableFeatures();
+    return selected & ~LZ4_CPU_DETECTED;
+}
+
+unsigned LZ4_cpuSelect(unsigned mask)
+{
+    unsigned selected = LZ4_cpuAvailableFeatures() & (mask | LZ4_CPU_DETECTED);
+    LZ4_CPU_STORE(LZ4_cpuSelected, selected);
+    return selected & ~LZ4_CPU_DETECTED;
+}
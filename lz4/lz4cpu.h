@@ -0,0 +1,63 @@
+/*
+   LZ4 - CPU feature detection
+   Header File
+
+   BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+
+   The kernels of lz4.c are compiled for several instruction sets in the same
+   binary. The CPU is probed once, the features it reports select the variant
+   each function runs, so a single build runs the best code on every host.
+*/
+#pragma once
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/**************************************
+*  Features
+**************************************/
+#define LZ4_CPU_SSE2     (1U<<0)
+#define LZ4_CPU_SSSE3    (1U<<1)
+#define LZ4_CPU_SSE41    (1U<<2)
+#define LZ4_CPU_SSE42    (1U<<3)
+#define LZ4_CPU_AVX2     (1U<<4)   /* includes the OS support of ymm registers */
+#define LZ4_CPU_BMI2     (1U<<5)   /* BMI1 and BMI2 */
+#define LZ4_CPU_AVX512   (1U<<6)   /* AVX-512 F, BW and VL, includes the OS support of zmm registers */
+#define LZ4_CPU_ALL      ((1U<<7)-1)
+
+/*
+ * LZ4_cpuDetect() :
+ * Returns the features of the running CPU (0 when it is not x86 / x86-64).
+ *
+ * LZ4_cpuFeatures() :
+ * Returns the features the kernels are allowed to use. The first call detects the CPU.
+ *
+ * LZ4_cpuSelect() :
+ * Restricts the kernels to the detected features also present in the mask,
+ * LZ4_CPU_ALL restores the default. Applies to the whole process : each block
+ * reads the selection once, so other threads switch variants at their next
+ * block, and any variant produces the same format. Meant for tests and benchmarks.
+ * Returns the new LZ4_cpuFeatures().
+ */
+unsigned LZ4_cpuDetect(void);
+unsigned LZ4_cpuFeatures(void);
+unsigned LZ4_cpuSelect(unsigned mask);
+
+
+/**************************************
+*  Selected variants
+**************************************/
+/*
+ * Name of the variant the current LZ4_cpuFeatures() selects for
+ * LZ4_compress_generic(), LZ4_decompress_generic() and LZ4_count()
+ * (defined in lz4.c) : "scalar" or the instruction set it is compiled for.
+ */
+const char* LZ4_compressVariant(void);
+const char* LZ4_decompressVariant(void);
+const char* LZ4_countVariant(void);
+
+
+#if defined (__cplusplus)
+}
+#endif
@@ -103,7 +103,7 @@ typedef unsigned long long  U64;
 #define LZ4F_BLOCKSIZEID_DEFAULT LZ4F_max64KB
 
 static const size_t minFHSize = 7;
-static const size_t maxFHSize = 15;
+static const size_t maxFHSize = 19;   /* 7 + content size (8) + dictID (4) */
 static const size_t BHSize = 4;
 static const int    minHClevel = 3;
 
@@ -125,6 +125,8 @@ typedef struct LZ4F_cctx_s
     XXH32_state_t xxh;
     void*  lz4CtxPtr;
     U32    lz4CtxLevel;     /* 0: unallocated;  1: LZ4_stream_t;  3: LZ4_streamHC_t */
+    const BYTE* dict;       /* dictionary of the current frame, must stay valid until the frame ends */
+    size_t dictSize;
 } LZ4F_cctx_t;
 
 typedef struct LZ4F_dctx_s
@@ -142,11 +144,13 @@ typedef struct LZ4F_dctx_s
     BYTE*  tmpOutBuffer;
     const BYTE*  dict;
     size_t dictSize;
+    const BYTE*  frameDict; /* dictionary provided for the current frame */
+    size_t frameDictSize;
     BYTE*  tmpOut;
     size_t tmpOutSize;
     size_t tmpOutStart;
     XXH32_state_t xxh;
-    BYTE   header[16];
+    BYTE   header[19];   /* maxFHSize */
 } LZ4F_dctx_t;
 
 
@@ -285,6 +289,46 @@ size_t LZ4F_compressFrame(void* dstBuffer, size_t dstMaxSize, const void* srcBuf
 {
     LZ4F_cctx_t cctxI;
     LZ4_stream_t lz4ctx;
+    size_t result;
+
+    memset(&cctxI, 0, sizeof(cctxI));   /* works because no allocation */
+
+    cctxI.version = LZ4F_VERSION;
+    cctxI.maxBufferSize = 5 MB;   /* mess with real buffer size to prevent allocation; works because autoflush==1 & stableSrc==1 */
+
+    if ((preferencesPtr == NULL) || (preferencesPtr->compressionLevel < (int)minHClevel))
+    {
+        cctxI.lz4CtxPtr = &lz4ctx;
+        cctxI.lz4CtxLevel = 1;
+    }
+
+    result = LZ4F_compressFrame_usingContext(&cctxI, dstBuffer, dstMaxSize, srcBuffer, srcSize, preferencesPtr);
+
+    if (cctxI.lz4CtxPtr != &lz4ctx)   /* no allocation necessary with lz4 fast */
+        FREEMEM(cctxI.lz4CtxPtr);
+
+    return result;
+}
+
+
+/* LZ4F_compressFrame_usingContext()
+* Same as LZ4F_compressFrame(), but using an existing compressionContext.
+* Its internal state and buffers are reused, so repeated calls do not need any allocation once the context is warm.
+* Any unfinished frame within compressionContext is discarded.
+*/
+size_t LZ4F_compressFrame_usingContext(LZ4F_compressionContext_t compressionContext, void* dstBuffer, size_t dstMaxSize, const void* srcBuffer, size_t srcSize, const LZ4F_preferences_t* preferencesPtr)
+{
+    return LZ4F_compressFrame_usingDict(compressionContext, dstBuffer, dstMaxSize, srcBuffer, srcSize, NULL, 0, preferencesPtr);
+}
+
+
+/* LZ4F_compressFrame_usingDict()
+* Same as LZ4F_compressFrame_usingContext(), every block can reference dict.
+* Set preferencesPtr->frameInfo.dictID to write the dictionary ID into the frame header.
+*/
+size_t LZ4F_compressFrame_usingDict(LZ4F_compressionContext_t compressionContext, void* dstBuffer, size_t dstMaxSize, const void* srcBuffer, size_t srcSize, const void* dict, size_t dictSize, const LZ4F_preferences_t* preferencesPtr)
+{
+    LZ4F_cctx_t* cctxPtr = (LZ4F_cctx_t*)compressionContext;
     LZ4F_preferences_t prefs;
     LZ4F_compressOptions_t options;
     LZ4F_errorCode_t errorCode;
@@ -292,12 +336,8 @@ size_t LZ4F_compressFrame(void* dstBuffer, size_t dstMaxSize, const void* srcBuf
     BYTE* dstPtr = dstStart;
     BYTE* const dstEnd = dstStart + dstMaxSize;
 
-    memset(&cctxI, 0, sizeof(cctxI));   /* works because no allocation */
     memset(&options, 0, sizeof(options));
 
-    cctxI.version = LZ4F_VERSION;
-    cctxI.maxBufferSize = 5 MB;   /* mess with real buffer size to prevent allocation; works because autoflush==1 & stableSrc==1 */
-
     if (preferencesPtr!=NULL)
         prefs = *preferencesPtr;
     else
@@ -305,12 +345,6 @@ size_t LZ4F_compressFrame(void* dstBuffer, size_t dstMaxSize, const void* srcBuf
     if (prefs.frameInfo.contentSize != 0)
         prefs.frameInfo.contentSize = (U64)srcSize;   /* auto-correct content size if selected (!=0) */
 
-    if (prefs.compressionLevel < (int)minHClevel)
-    {
-        cctxI.lz4CtxPtr = &lz4ctx;
-        cctxI.lz4CtxLevel = 1;
-    }
-
     prefs.frameInfo.blockSizeID = LZ4F_optimalBSID(prefs.frameInfo.blockSizeID, srcSize);
     prefs.autoFlush = 1;
     if (srcSize <= LZ4F_getBlockSize(prefs.frameInfo.blockSizeID))
@@ -321,21 +355,20 @@ size_t LZ4F_compressFrame(void* dstBuffer, size_t dstMaxSize, const void* srcBuf
     if (dstMaxSize < LZ4F_compressFrameBound(srcSize, &prefs))
         return (size_t)-LZ4F_ERROR_dstMaxSize_tooSmall;
 
-    errorCode = LZ4F_compressBegin(&cctxI, dstBuffer, dstMaxSize, &prefs);  /* write header */
+    cctxPtr->cStage = 0;   /* discard any unfinished frame */
+
+    errorCode = LZ4F_compressBegin_usingDict(cctxPtr, dstBuffer, dstMaxSize, dict, dictSize, &prefs);  /* write header */
     if (LZ4F_isError(errorCode)) return errorCode;
     dstPtr += errorCode;   /* header size */
 
-    errorCode = LZ4F_compressUpdate(&cctxI, dstPtr, dstEnd-dstPtr, srcBuffer, srcSize, &options);
+    errorCode = LZ4F_compressUpdate(cctxPtr, dstPtr, dstEnd-dstPtr, srcBuffer, srcSize, &options);
     if (LZ4F_isError(errorCode)) return errorCode;
     dstPtr += errorCode;
 
-    errorCode = LZ4F_compressEnd(&cctxI, dstPtr, dstEnd-dstPtr, &options);   /* flush last block, and generate suffix */
+    errorCode = LZ4F_compressEnd(cctxPtr, dstPtr, dstEnd-dstPtr, &options);   /* flush last block, and generate suffix */
     if (LZ4F_isError(errorCode)) return errorCode;
     dstPtr += errorCode;
 
-    if (prefs.compressionLevel >= (int)minHClevel)   /* no allocation necessary with lz4 fast */
-        FREEMEM(cctxI.lz4CtxPtr);
-
     return (dstPtr - dstStart);
 }
 
@@ -390,6 +423,33 @@ LZ4F_errorCode_t LZ4F_freeCompressionContext(LZ4F_compressionContext_t LZ4F_comp
 * or an error code (can be tested using LZ4F_isError())
 */
 size_t LZ4F_compressBegin(LZ4F_compressionContext_t compressionContext, void* dstBuffer, size_t dstMaxSize, const LZ4F_preferences_t* preferencesPtr)
+{
+    return LZ4F_compressBegin_usingDict(compressionContext, dstBuffer, dstMaxSize, NULL, 0, preferencesPtr);
+}
+
+
+/* LZ4F_initStream() :
+* reset the compression stream of cctxPtr and load the frame dictionary into it, if any */
+static void LZ4F_initStream(LZ4F_cctx_t* cctxPtr)
+{
+    if (cctxPtr->prefs.compressionLevel < minHClevel)
+    {
+        LZ4_resetStream((LZ4_stream_t*)(cctxPtr->lz4CtxPtr));
+        if (cctxPtr->dictSize) LZ4_loadDict((LZ4_stream_t*)(cctxPtr->lz4CtxPtr), (const char*)cctxPtr->dict, (int)cctxPtr->dictSize);
+    }
+    else
+    {
+        LZ4_resetStreamHC((LZ4_streamHC_t*)(cctxPtr->lz4CtxPtr), cctxPtr->prefs.compressionLevel);
+        if (cctxPtr->dictSize) LZ4_loadDictHC((LZ4_streamHC_t*)(cctxPtr->lz4CtxPtr), (const char*)cctxPtr->dict, (int)cctxPtr->dictSize);
+    }
+}
+
+
+/* LZ4F_compressBegin_usingDict() :
+* Same as LZ4F_compressBegin(), every block of the frame can reference dict.
+* dict must remain valid and unmodified until the frame is finished with LZ4F_compressEnd().
+*/
+size_t LZ4F_compressBegin_usingDict(LZ4F_compressionContext_t compressionContext, void* dstBuffer, size_t dstMaxSize, const void* dict, size_t dictSize, const LZ4F_preferences_t* preferencesPtr)
 {
     LZ4F_preferences_t prefNull;
     LZ4F_cctx_t* cctxPtr = (LZ4F_cctx_t*)compressionContext;
@@ -436,10 +496,14 @@ size_t LZ4F_compressBegin(LZ4F_compressionContext_t compressionContext, void* ds
     cctxPtr->tmpIn = cctxPtr->tmpBuff;
     cctxPtr->tmpInSize = 0;
     XXH32_reset(&(cctxPtr->xxh), 0);
-    if (cctxPtr->prefs.compressionLevel < minHClevel)
-        LZ4_resetStream((LZ4_stream_t*)(cctxPtr->lz4CtxPtr));
-    else
-        LZ4_resetStreamHC((LZ4_streamHC_t*)(cctxPtr->lz4CtxPtr), cctxPtr->prefs.compressionLevel);
+    if (dictSize > 64 KB)
+    {
+        dict = (const BYTE*)dict + dictSize - 64 KB;
+        dictSize = 64 KB;
+    }
+    cctxPtr->dict = (const BYTE*)dict;
+    cctxPtr->dictSize = dict == NULL ? 0 : dictSize;
+    LZ4F_initStream(cctxPtr);
 
     /* Magic Number */
     LZ4F_writeLE32(dstPtr, LZ4F_MAGICNUMBER);
@@ -450,7 +514,8 @@ size_t LZ4F_compressBegin(LZ4F_compressionContext_t compressionContext, void* ds
     *dstPtr++ = (BYTE)(((1 & _2BITS) << 6)    /* Version('01') */
         + ((cctxPtr->prefs.frameInfo.blockMode & _1BIT ) << 5)    /* Block mode */
         + ((cctxPtr->prefs.frameInfo.contentChecksumFlag & _1BIT ) << 2)   /* Frame checksum */
-        + ((cctxPtr->prefs.frameInfo.contentSize > 0) << 3));   /* Frame content size */
+        + ((cctxPtr->prefs.frameInfo.contentSize > 0) << 3)   /* Frame content size */
+        + ((cctxPtr->prefs.frameInfo.dictID > 0) << 0));   /* Dictionary ID */
     /* BD Byte */
     *dstPtr++ = (BYTE)((cctxPtr->prefs.frameInfo.blockSizeID & _3BITS) << 4);
     /* Optional Frame content size field */
@@ -460,6 +525,12 @@ size_t LZ4F_compressBegin(LZ4F_compressionContext_t compressionContext, void* ds
         dstPtr += 8;
         cctxPtr->totalInSize = 0;
     }
+    /* Optional Dictionary ID field */
+    if (cctxPtr->prefs.frameInfo.dictID)
+    {
+        LZ4F_writeLE32(dstPtr, cctxPtr->prefs.frameInfo.dictID);
+        dstPtr += 4;
+    }
     /* CRC Byte */
     *dstPtr = LZ4F_headerChecksum(headerStart, dstPtr - headerStart);
     dstPtr++;
@@ -495,12 +566,14 @@ size_t LZ4F_compressBound(size_t srcSize, const LZ4F_preferences_t* preferencesP
 
 typedef int (*compressFunc_t)(void* ctx, const char* src, char* dst, int srcSize, int dstSize, int level);
 
-static size_t LZ4F_compressBlock(void* dst, const void* src, size_t srcSize, compressFunc_t compress, void* lz4ctx, int level)
+static size_t LZ4F_compressBlock(void* dst, const void* src, size_t srcSize, compressFunc_t compress, LZ4F_cctx_t* cctxPtr)
 {
     /* compress one block */
     BYTE* cSizePtr = (BYTE*)dst;
     U32 cSize;
-    cSize = (U32)compress(lz4ctx, (const char*)src, (char*)(cSizePtr+4), (int)(srcSize), (int)(srcSize-1), level);
+    if ((cctxPtr->dictSize) && (cctxPtr->prefs.frameInfo.blockMode == LZ4F_blockIndependent))
+        LZ4F_initStream(cctxPtr);   /* every independent block starts from the dictionary alone */
+    cSize = (U32)compress(cctxPtr->lz4CtxPtr, (const char*)src, (char*)(cSizePtr+4), (int)(srcSize), (int)(srcSize-1), cctxPtr->prefs.compressionLevel);
     LZ4F_writeLE32(cSizePtr, cSize);
     if (cSize == 0)   /* compression failed */
     {
@@ -530,8 +603,10 @@ static int LZ4F_localLZ4_compressHC_limitedOutput_continue(void* ctx, const char
     return LZ4_compress_HC_continue((LZ4_streamHC_t*)ctx, src, dst, srcSize, dstSize);
 }
 
-static compressFunc_t LZ4F_selectCompression(LZ4F_blockMode_t blockMode, int level)
+static compressFunc_t LZ4F_selectCompression(LZ4F_blockMode_t blockMode, int level, size_t dictSize)
 {
+    /* with a dictionary, independent blocks continue from a stream reloaded by LZ4F_compressBlock() */
+    if (dictSize) blockMode = LZ4F_blockLinked;
     if (level < minHClevel)
     {
         if (blockMode == LZ4F_blockIndependent) return LZ4F_localLZ4_compress_limitedOutput_withState;
@@ -578,7 +653,7 @@ size_t LZ4F_compressUpdate(LZ4F_compressionContext_t compressionContext, void* d
     if (compressOptionsPtr == NULL) compressOptionsPtr = &cOptionsNull;
 
     /* select compression function */
-    compress = LZ4F_selectCompression(cctxPtr->prefs.frameInfo.blockMode, cctxPtr->prefs.compressionLevel);
+    compress = LZ4F_selectCompression(cctxPtr->prefs.frameInfo.blockMode, cctxPtr->prefs.compressionLevel, cctxPtr->dictSize);
 
     /* complete tmp buffer */
     if (cctxPtr->tmpInSize > 0)   /* some data already within tmp buffer */
@@ -599,7 +674,7 @@ size_t LZ4F_compressUpdate(LZ4F_compressionContext_t compressionContext, void* d
             memcpy(cctxPtr->tmpIn + cctxPtr->tmpInSize, srcBuffer, sizeToCopy);
             srcPtr += sizeToCopy;
 
-            dstPtr += LZ4F_compressBlock(dstPtr, cctxPtr->tmpIn, blockSize, compress, cctxPtr->lz4CtxPtr, cctxPtr->prefs.compressionLevel);
+            dstPtr += LZ4F_compressBlock(dstPtr, cctxPtr->tmpIn, blockSize, compress, cctxPtr);
 
             if (cctxPtr->prefs.frameInfo.blockMode==LZ4F_blockLinked) cctxPtr->tmpIn += blockSize;
             cctxPtr->tmpInSize = 0;
@@ -610,7 +685,7 @@ size_t LZ4F_compressUpdate(LZ4F_compressionContext_t compressionContext, void* d
     {
         /* compress full block */
         lastBlockCompressed = fromSrcBuffer;
-        dstPtr += LZ4F_compressBlock(dstPtr, srcPtr, blockSize, compress, cctxPtr->lz4CtxPtr, cctxPtr->prefs.compressionLevel);
+        dstPtr += LZ4F_compressBlock(dstPtr, srcPtr, blockSize, compress, cctxPtr);
         srcPtr += blockSize;
     }
 
@@ -618,7 +693,7 @@ size_t LZ4F_compressUpdate(LZ4F_compressionContext_t compressionContext, void* d
     {
         /* compress remaining input < blockSize */
         lastBlockCompressed = fromSrcBuffer;
-        dstPtr += LZ4F_compressBlock(dstPtr, srcPtr, srcEnd - srcPtr, compress, cctxPtr->lz4CtxPtr, cctxPtr->prefs.compressionLevel);
+        dstPtr += LZ4F_compressBlock(dstPtr, srcPtr, srcEnd - srcPtr, compress, cctxPtr);
         srcPtr  = srcEnd;
     }
 
@@ -684,10 +759,10 @@ size_t LZ4F_flush(LZ4F_compressionContext_t compressionContext, void* dstBuffer,
     (void)compressOptionsPtr;   /* not yet useful */
 
     /* select compression function */
-    compress = LZ4F_selectCompression(cctxPtr->prefs.frameInfo.blockMode, cctxPtr->prefs.compressionLevel);
+    compress = LZ4F_selectCompression(cctxPtr->prefs.frameInfo.blockMode, cctxPtr->prefs.compressionLevel, cctxPtr->dictSize);
 
     /* compress tmp buffer */
-    dstPtr += LZ4F_compressBlock(dstPtr, cctxPtr->tmpIn, cctxPtr->tmpInSize, compress, cctxPtr->lz4CtxPtr, cctxPtr->prefs.compressionLevel);
+    dstPtr += LZ4F_compressBlock(dstPtr, cctxPtr->tmpIn, cctxPtr->tmpInSize, compress, cctxPtr);
     if (cctxPtr->prefs.frameInfo.blockMode==LZ4F_blockLinked) cctxPtr->tmpIn += cctxPtr->tmpInSize;
     cctxPtr->tmpInSize = 0;
 
@@ -800,6 +875,22 @@ typedef enum { dstage_getHeader=0, dstage_storeHeader,
 } dStage_t;
 
 
+/* LZ4F_resetDecompressionContext()
+* Bring decompressionContext back to its initial state, ready to decode a new frame.
+* Internal buffers are kept, so it can be reused without any allocation, even after an error.
+*/
+void LZ4F_resetDecompressionContext(LZ4F_decompressionContext_t LZ4F_decompressionContext)
+{
+    LZ4F_dctx_t* dctxPtr = (LZ4F_dctx_t*)LZ4F_decompressionContext;
+    dctxPtr->dStage = dstage_getHeader;
+    dctxPtr->srcExpect = NULL;
+    dctxPtr->dict = NULL;
+    dctxPtr->dictSize = 0;
+    dctxPtr->frameDict = NULL;
+    dctxPtr->frameDictSize = 0;
+}
+
+
 /* LZ4F_decodeHeader
    return : nb Bytes read from srcVoidPtr (necessarily <= srcSize)
             or an error code (testable with LZ4F_isError())
@@ -810,7 +901,7 @@ typedef enum { dstage_getHeader=0, dstage_storeHeader,
 static size_t LZ4F_decodeHeader(LZ4F_dctx_t* dctxPtr, const void* srcVoidPtr, size_t srcSize)
 {
     BYTE FLG, BD, HC;
-    unsigned version, blockMode, blockChecksumFlag, contentSizeFlag, contentChecksumFlag, blockSizeID;
+    unsigned version, blockMode, blockChecksumFlag, contentSizeFlag, contentChecksumFlag, dictIDFlag, blockSizeID;
     size_t bufferNeeded;
     size_t frameHeaderSize;
     const BYTE* srcPtr = (const BYTE*)srcVoidPtr;
@@ -848,9 +939,10 @@ static size_t LZ4F_decodeHeader(LZ4F_dctx_t* dctxPtr, const void* srcVoidPtr, si
     blockChecksumFlag = (FLG>>4) & _1BIT;
     contentSizeFlag = (FLG>>3) & _1BIT;
     contentChecksumFlag = (FLG>>2) & _1BIT;
+    dictIDFlag = FLG & _1BIT;
 
     /* Frame Header Size */
-    frameHeaderSize = contentSizeFlag ? maxFHSize : minFHSize;
+    frameHeaderSize = minFHSize + (contentSizeFlag * 8) + (dictIDFlag * 4);
 
     if (srcSize < frameHeaderSize)
     {
@@ -869,7 +961,7 @@ static size_t LZ4F_decodeHeader(LZ4F_dctx_t* dctxPtr, const void* srcVoidPtr, si
     /* validate */
     if (version != 1) return (size_t)-LZ4F_ERROR_headerVersion_wrong;        /* Version Number, only supported value */
     if (blockChecksumFlag != 0) return (size_t)-LZ4F_ERROR_blockChecksum_unsupported; /* Not supported for the time being */
-    if (((FLG>>0)&_2BITS) != 0) return (size_t)-LZ4F_ERROR_reservedFlag_set; /* Reserved bits */
+    if (((FLG>>1)&_1BIT) != 0) return (size_t)-LZ4F_ERROR_reservedFlag_set; /* Reserved bit */
     if (((BD>>7)&_1BIT) != 0) return (size_t)-LZ4F_ERROR_reservedFlag_set;   /* Reserved bit */
     if (blockSizeID < 4) return (size_t)-LZ4F_ERROR_maxBlockSize_invalid;    /* 4-7 only supported values for the time being */
     if (((BD>>0)&_4BITS) != 0) return (size_t)-LZ4F_ERROR_reservedFlag_set;  /* Reserved bits */
@@ -885,6 +977,9 @@ static size_t LZ4F_decodeHeader(LZ4F_dctx_t* dctxPtr, const void* srcVoidPtr, si
     dctxPtr->maxBlockSize = LZ4F_getBlockSize(blockSizeID);
     if (contentSizeFlag)
         dctxPtr->frameRemainingSize = dctxPtr->frameInfo.contentSize = LZ4F_readLE64(srcPtr+6);
+    else
+        dctxPtr->frameRemainingSize = dctxPtr->frameInfo.contentSize = 0;   /* do not inherit the size of a previous frame */
+    dctxPtr->frameInfo.dictID = dictIDFlag ? LZ4F_readLE32(srcPtr + frameHeaderSize - 5) : 0;
 
     /* init */
     if (contentChecksumFlag) XXH32_reset(&(dctxPtr->xxh), 0);
@@ -905,6 +1000,11 @@ static size_t LZ4F_decodeHeader(LZ4F_dctx_t* dctxPtr, const void* srcVoidPtr, si
     dctxPtr->tmpInTarget = 0;
     dctxPtr->dict = dctxPtr->tmpOutBuffer;
     dctxPtr->dictSize = 0;
+    if (dctxPtr->frameDict != NULL)   /* the first block, or every independent block, starts from the frame dictionary */
+    {
+        dctxPtr->dict = dctxPtr->frameDict;
+        dctxPtr->dictSize = dctxPtr->frameDictSize;
+    }
     dctxPtr->tmpOut = dctxPtr->tmpOutBuffer;
     dctxPtr->tmpOutStart = 0;
     dctxPtr->tmpOutSize = 0;
@@ -1240,7 +1340,7 @@ size_t LZ4F_decompress(LZ4F_decompressionContext_t decompressionContext,
                 int (*decoder)(const char*, char*, int, int, const char*, int);
                 int decodedSize;
 
-                if (dctxPtr->frameInfo.blockMode == LZ4F_blockLinked)
+                if ((dctxPtr->frameInfo.blockMode == LZ4F_blockLinked) || (dctxPtr->dictSize))
                     decoder = LZ4_decompress_safe_usingDict;
                 else
                     decoder = LZ4F_decompress_safe;
@@ -1265,7 +1365,7 @@ size_t LZ4F_decompress(LZ4F_decompressionContext_t decompressionContext,
                 int (*decoder)(const char*, char*, int, int, const char*, int);
                 int decodedSize;
 
-                if (dctxPtr->frameInfo.blockMode == LZ4F_blockLinked)
+                if ((dctxPtr->frameInfo.blockMode == LZ4F_blockLinked) || (dctxPtr->dictSize))
                     decoder = LZ4_decompress_safe_usingDict;
                 else
                     decoder = LZ4F_decompress_safe;
@@ -1437,7 +1537,7 @@ size_t LZ4F_decompress(LZ4F_decompressionContext_t decompressionContext,
     if ( (dctxPtr->frameInfo.blockMode==LZ4F_blockLinked)
         &&(dctxPtr->dict != dctxPtr->tmpOutBuffer)
         &&(!decompressOptionsPtr->stableDst)
-        &&((unsigned)(dctxPtr->dStage-1) < (unsigned)(dstage_getSuffix-1))
+        &&((unsigned)(dctxPtr->dStage-2) < (unsigned)(dstage_getSuffix-2))   /* not while waiting for the next frame header : dict is stale */
         )
     {
         if (dctxPtr->dStage == dstage_flushOut)
@@ -1477,3 +1577,37 @@ size_t LZ4F_decompress(LZ4F_decompressionContext_t decompressionContext,
     *dstSizePtr = (dstPtr - dstStart);
     return nextSrcSizeHint;
 }
+
+
+/* LZ4F_decompress_usingDict()
+* Same as LZ4F_decompress(), frames starting within srcBuffer are decoded with dict.
+* dict is also applied to a frame whose header was already decoded by LZ4F_getFrameInfo().
+*/
+size_t LZ4F_decompress_usingDict(LZ4F_decompressionContext_t decompressionContext,
+                       void* dstBuffer, size_t* dstSizePtr,
+                       const void* srcBuffer, size_t* srcSizePtr,
+                       const void* dict, size_t dictSize,
+                       const LZ4F_decompressOptions_t* decompressOptionsPtr)
+{
+    LZ4F_dctx_t* dctxPtr = (LZ4F_dctx_t*)decompressionContext;
+    size_t result;
+    if (dict == NULL) dictSize = 0;
+    if (dictSize > 64 KB)
+    {
+        dict = (const BYTE*)dict + dictSize - 64 KB;
+        dictSize = 64 KB;
+    }
+    if ((dctxPtr->dStage >= dstage_getCBlockSize) && (dctxPtr->dStage <= dstage_storeCBlock)
+        && (dctxPtr->dict == dctxPtr->tmpOutBuffer) && (dctxPtr->dictSize == 0))
+    {
+        /* header decoded, nothing regenerated yet */
+        dctxPtr->dict = (const BYTE*)dict;
+        dctxPtr->dictSize = dictSize;
+    }
+    dctxPtr->frameDict = (const BYTE*)dict;
+    dctxPtr->frameDictSize = dictSize;
+    result = LZ4F_decompress(decompressionContext, dstBuffer, dstSizePtr, srcBuffer, srcSizePtr, decompressOptionsPtr);
+    dctxPtr->frameDict = NULL;
+    dctxPtr->frameDictSize = 0;
+    return result;
+}
@@ -76,6 +76,42 @@ extern "C" {
 typedef enum { LZ4F_LIST_ERRORS(LZ4F_GENERATE_ENUM) } LZ4F_errorCodes;  /* enum is exposed, to handle specific errors; compare function result to -enum value */
 
 
+/**************************************
+ * Context reuse
+ * ************************************/
+size_t LZ4F_compressFrame_usingContext(LZ4F_compressionContext_t cctx, void* dstBuffer, size_t dstMaxSize, const void* srcBuffer, size_t srcSize, const LZ4F_preferences_t* preferencesPtr);
+/* LZ4F_compressFrame_usingContext() :
+ * Same as LZ4F_compressFrame(), but using cctx, created with LZ4F_createCompressionContext().
+ * Internal tables and buffers of cctx are reused, so there is no allocation once cctx is warm.
+ * Any unfinished frame within cctx is discarded.
+ */
+
+void LZ4F_resetDecompressionContext(LZ4F_decompressionContext_t dctx);
+/* LZ4F_resetDecompressionContext() :
+ * Bring dctx back to its initial state, ready to decode a new frame, without releasing its buffers.
+ * Can be used after an error.
+ */
+
+
+/**************************************
+ * Dictionary
+ * ************************************/
+size_t LZ4F_compressBegin_usingDict(LZ4F_compressionContext_t cctx, void* dstBuffer, size_t dstMaxSize, const void* dict, size_t dictSize, const LZ4F_preferences_t* preferencesPtr);
+size_t LZ4F_compressFrame_usingDict(LZ4F_compressionContext_t cctx, void* dstBuffer, size_t dstMaxSize, const void* srcBuffer, size_t srcSize, const void* dict, size_t dictSize, const LZ4F_preferences_t* preferencesPtr);
+/* LZ4F_compressBegin_usingDict(), LZ4F_compressFrame_usingDict() :
+ * Same as LZ4F_compressBegin() and LZ4F_compressFrame_usingContext(), every block can reference dict.
+ * Only the last 64 KB of dict are used. dict must stay valid until the frame is finished.
+ * preferencesPtr->frameInfo.dictID, when != 0, is written into the frame header.
+ */
+
+size_t LZ4F_decompress_usingDict(LZ4F_decompressionContext_t dctx, void* dstBuffer, size_t* dstSizePtr, const void* srcBuffer, size_t* srcSizePtr, const void* dict, size_t dictSize, const LZ4F_decompressOptions_t* decompressOptionsPtr);
+/* LZ4F_decompress_usingDict() :
+ * Same as LZ4F_decompress(), dict is used when a new frame starts within srcBuffer.
+ * It must be the dictionary the frame was compressed with, and stay valid until the frame is decoded.
+ * Use LZ4F_getFrameInfo() first to read the frame dictID and select dict accordingly.
+ */
+
+
 #if defined (__cplusplus)
 }
 #endif
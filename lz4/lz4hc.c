@@ -86,8 +86,6 @@ static const int g_maxCompressionLevel = 16;
 **************************************/
 typedef struct
 {
-    U32   hashTable[HASHTABLESIZE];
-    U16   chainTable[MAXD];
     const BYTE* end;        /* next block here to continue on current prefix */
     const BYTE* base;       /* All index relative to this position */
     const BYTE* dictBase;   /* alternate base for extDict */
@@ -96,27 +94,61 @@ typedef struct
     U32   lowLimit;         /* below that point, no more dict */
     U32   nextToUpdate;     /* index from which to continue dictionary update */
     U32   compressionLevel;
+} LZ4HC_window_t;
+
+#define LZ4HC_OPT_NUM          (1<<12)   /* positions priced per segment */
+#define TRAILING_LITERALS      3
+
+typedef struct
+{
+    int price;
+    int off;
+    int mlen;   /* 1 means literal */
+    int litlen;
+} LZ4HC_optimal_t;
+
+typedef struct
+{
+    U32   hashTable[HASHTABLESIZE];
+    U16   chainTable[MAXD];
+    LZ4HC_window_t window;
+    LZ4HC_optimal_t opt[LZ4HC_OPT_NUM + TRAILING_LITERALS];   /* prices of LZ4HC_compress_optimal, no allocation per block */
 } LZ4HC_Data_Structure;
 
+struct LZ4_streamHCParams_s
+{
+    LZ4HC_window_t window;
+    U32   chainLog;
+    U32   maxAttempts;
+    U32   hashTable[1];   /* (1<<(chainLog-1)) entries, then the chain table of (1<<chainLog) U16, allocated with the structure */
+};
+
 
 /**************************************
 *  Local Macros
 **************************************/
-#define HASH_FUNCTION(i)       (((i) * 2654435761U) >> ((MINMATCH*8)-HASH_LOG))
-//#define DELTANEXTU16(p)        chainTable[(p) & MAXD_MASK]   /* flexible, MAXD dependent */
-#define DELTANEXTU16(p)        chainTable[(U16)(p)]   /* faster */
+#define HASH_FUNCTION(i,hashLog) (((i) * 2654435761U) >> ((MINMATCH*8)-(hashLog)))
+#define DELTANEXTU16(p)        chainTable[(p) & chainMask]   /* same as (U16)(p) when chainLog is the constant DICTIONARY_LOGSIZE */
+#define CHAINTABLE(hashTable,chainLog) ((U16*)((hashTable) + (1 << ((chainLog)-1))))
 
-static U32 LZ4HC_hashPtr(const void* ptr) { return HASH_FUNCTION(LZ4_read32(ptr)); }
+static U32 LZ4HC_hashPtr(const void* ptr, U32 hashLog) { return HASH_FUNCTION(LZ4_read32(ptr), hashLog); }
 
 
 
 /**************************************
 *  HC Compression
 **************************************/
-static void LZ4HC_init (LZ4HC_Data_Structure* hc4, const BYTE* start)
+/*
+ * The functions below take the tables and their size apart from the window, so the same code
+ * runs the fixed LZ4HC_Data_Structure (chainLog is the constant DICTIONARY_LOGSIZE, folded when inlined)
+ * and the LZ4_streamHCParams_t chosen at runtime.
+ * The hash table has (1<<(chainLog-1)) entries, the chain table (1<<chainLog) :
+ * a chain table smaller than 64 KB also bounds the window, older positions are overwritten.
+ */
+static void LZ4HC_init (LZ4HC_window_t* hc4, U32* hashTable, U16* chainTable, const U32 chainLog, const BYTE* start)
 {
-    MEM_INIT((void*)hc4->hashTable, 0, sizeof(hc4->hashTable));
-    MEM_INIT(hc4->chainTable, 0xFF, sizeof(hc4->chainTable));
+    MEM_INIT((void*)hashTable, 0, sizeof(U32) << (chainLog-1));
+    MEM_INIT(chainTable, 0xFF, sizeof(U16) << chainLog);
     hc4->nextToUpdate = 64 KB;
     hc4->base = start - 64 KB;
     hc4->end = start;
@@ -127,17 +159,16 @@ static void LZ4HC_init (LZ4HC_Data_Structure* hc4, const BYTE* start)
 
 
 /* Update chains up to ip (excluded) */
-FORCE_INLINE void LZ4HC_Insert (LZ4HC_Data_Structure* hc4, const BYTE* ip)
+FORCE_INLINE void LZ4HC_Insert (LZ4HC_window_t* hc4, U32* HashTable, U16* chainTable, const U32 chainLog, const BYTE* ip)
 {
-    U16* chainTable = hc4->chainTable;
-    U32* HashTable  = hc4->hashTable;
+    const U32 chainMask = (1U << chainLog) - 1;
     const BYTE* const base = hc4->base;
     const U32 target = (U32)(ip - base);
     U32 idx = hc4->nextToUpdate;
 
     while(idx < target)
     {
-        U32 h = LZ4HC_hashPtr(base+idx);
+        U32 h = LZ4HC_hashPtr(base+idx, chainLog-1);
         size_t delta = idx - HashTable[h];
         if (delta>MAX_DISTANCE) delta = MAX_DISTANCE;
         DELTANEXTU16(idx) = (U16)delta;
@@ -149,25 +180,25 @@ FORCE_INLINE void LZ4HC_Insert (LZ4HC_Data_Structure* hc4, const BYTE* ip)
 }
 
 
-FORCE_INLINE int LZ4HC_InsertAndFindBestMatch (LZ4HC_Data_Structure* hc4,   /* Index table will be updated */
+FORCE_INLINE int LZ4HC_InsertAndFindBestMatch (LZ4HC_window_t* hc4,   /* Index table will be updated */
+                                               U32* const HashTable, U16* const chainTable, const U32 chainLog,
                                                const BYTE* ip, const BYTE* const iLimit,
                                                const BYTE** matchpos,
                                                const int maxNbAttempts)
 {
-    U16* const chainTable = hc4->chainTable;
-    U32* const HashTable = hc4->hashTable;
+    const U32 chainMask = (1U << chainLog) - 1;
     const BYTE* const base = hc4->base;
     const BYTE* const dictBase = hc4->dictBase;
     const U32 dictLimit = hc4->dictLimit;
-    const U32 lowLimit = (hc4->lowLimit + 64 KB > (U32)(ip-base)) ? hc4->lowLimit : (U32)(ip - base) - (64 KB - 1);
+    const U32 lowLimit = (hc4->lowLimit + chainMask + 1 > (U32)(ip-base)) ? hc4->lowLimit : (U32)(ip - base) - chainMask;
     U32 matchIndex;
     const BYTE* match;
     int nbAttempts=maxNbAttempts;
     size_t ml=0;
 
     /* HC4 match finder */
-    LZ4HC_Insert(hc4, ip);
-    matchIndex = HashTable[LZ4HC_hashPtr(ip)];
+    LZ4HC_Insert(hc4, HashTable, chainTable, chainLog, ip);
+    matchIndex = HashTable[LZ4HC_hashPtr(ip, chainLog-1)];
 
     while ((matchIndex>=lowLimit) && (nbAttempts))
     {
@@ -204,7 +235,10 @@ FORCE_INLINE int LZ4HC_InsertAndFindBestMatch (LZ4HC_Data_Structure* hc4,   /* I
 
 
 FORCE_INLINE int LZ4HC_InsertAndGetWiderMatch (
-    LZ4HC_Data_Structure* hc4,
+    LZ4HC_window_t* hc4,
+    U32* const HashTable,
+    U16* const chainTable,
+    const U32 chainLog,
     const BYTE* const ip,
     const BYTE* const iLowLimit,
     const BYTE* const iHighLimit,
@@ -213,12 +247,11 @@ FORCE_INLINE int LZ4HC_InsertAndGetWiderMatch (
     const BYTE** startpos,
     const int maxNbAttempts)
 {
-    U16* const chainTable = hc4->chainTable;
-    U32* const HashTable = hc4->hashTable;
+    const U32 chainMask = (1U << chainLog) - 1;
     const BYTE* const base = hc4->base;
     const U32 dictLimit = hc4->dictLimit;
     const BYTE* const lowPrefixPtr = base + dictLimit;
-    const U32 lowLimit = (hc4->lowLimit + 64 KB > (U32)(ip-base)) ? hc4->lowLimit : (U32)(ip - base) - (64 KB - 1);
+    const U32 lowLimit = (hc4->lowLimit + chainMask + 1 > (U32)(ip-base)) ? hc4->lowLimit : (U32)(ip - base) - chainMask;
     const BYTE* const dictBase = hc4->dictBase;
     U32   matchIndex;
     int nbAttempts = maxNbAttempts;
@@ -226,8 +259,8 @@ FORCE_INLINE int LZ4HC_InsertAndGetWiderMatch (
 
 
     /* First Match */
-    LZ4HC_Insert(hc4, ip);
-    matchIndex = HashTable[LZ4HC_hashPtr(ip)];
+    LZ4HC_Insert(hc4, HashTable, chainTable, chainLog, ip);
+    matchIndex = HashTable[LZ4HC_hashPtr(ip, chainLog-1)];
 
     while ((matchIndex>=lowLimit) && (nbAttempts))
     {
@@ -331,17 +364,19 @@ FORCE_INLINE int LZ4HC_encodeSequence (
 }
 
 
-static int LZ4HC_compress_generic (
-    void* ctxvoid,
+FORCE_INLINE int LZ4HC_compress_body (
+    LZ4HC_window_t* ctx,
+    U32* const hashTable,
+    U16* const chainTable,
+    const U32 chainLog,
     const char* source,
     char* dest,
     int inputSize,
     int maxOutputSize,
-    int compressionLevel,
+    const int maxNbAttempts,
     limitedOutput_directive limit
     )
 {
-    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*) ctxvoid;
     const BYTE* ip = (const BYTE*) source;
     const BYTE* anchor = ip;
     const BYTE* const iend = ip + inputSize;
@@ -351,7 +386,6 @@ static int LZ4HC_compress_generic (
     BYTE* op = (BYTE*) dest;
     BYTE* const oend = op + maxOutputSize;
 
-    unsigned maxNbAttempts;
     int   ml, ml2, ml3, ml0;
     const BYTE* ref=NULL;
     const BYTE* start2=NULL;
@@ -363,9 +397,6 @@ static int LZ4HC_compress_generic (
 
 
     /* init */
-    if (compressionLevel > g_maxCompressionLevel) compressionLevel = g_maxCompressionLevel;
-    if (compressionLevel < 1) compressionLevel = LZ4HC_compressionLevel_default;
-    maxNbAttempts = 1 << (compressionLevel-1);
     ctx->end += inputSize;
 
     ip++;
@@ -373,7 +404,7 @@ static int LZ4HC_compress_generic (
     /* Main Loop */
     while (ip < mflimit)
     {
-        ml = LZ4HC_InsertAndFindBestMatch (ctx, ip, matchlimit, (&ref), maxNbAttempts);
+        ml = LZ4HC_InsertAndFindBestMatch (ctx, hashTable, chainTable, chainLog, ip, matchlimit, (&ref), maxNbAttempts);
         if (!ml) { ip++; continue; }
 
         /* saved, in case we would skip too much */
@@ -383,7 +414,7 @@ static int LZ4HC_compress_generic (
 
 _Search2:
         if (ip+ml < mflimit)
-            ml2 = LZ4HC_InsertAndGetWiderMatch(ctx, ip + ml - 2, ip + 1, matchlimit, ml, &ref2, &start2, maxNbAttempts);
+            ml2 = LZ4HC_InsertAndGetWiderMatch(ctx, hashTable, chainTable, chainLog, ip + ml - 2, ip + 1, matchlimit, ml, &ref2, &start2, maxNbAttempts);
         else ml2 = ml;
 
         if (ml2 == ml)  /* No better match */
@@ -434,7 +465,7 @@ _Search3:
         /* Now, we have start2 = ip+new_ml, with new_ml = min(ml, OPTIMAL_ML=18) */
 
         if (start2 + ml2 < mflimit)
-            ml3 = LZ4HC_InsertAndGetWiderMatch(ctx, start2 + ml2 - 3, start2, matchlimit, ml2, &ref3, &start3, maxNbAttempts);
+            ml3 = LZ4HC_InsertAndGetWiderMatch(ctx, hashTable, chainTable, chainLog, start2 + ml2 - 3, start2, matchlimit, ml2, &ref3, &start3, maxNbAttempts);
         else ml3 = ml2;
 
         if (ml3 == ml2) /* No better match : 2 sequences to encode */
@@ -534,13 +565,327 @@ _Search3:
     return (int) (((char*)op)-dest);
 }
 
+/**************************************
+*  HC Optimal Parsing
+**************************************/
+/*
+ * Level LZ4HC_CLEVEL_OPT replaces the lazy sequence selection above by a shortest path search :
+ * the longest match found at each position of a segment prices every shorter length too,
+ * opt[] keeps the cheapest way, in output bytes, to reach each position, and the segment is
+ * encoded backward from its end once no match crosses it. The blocks remain standard LZ4.
+ */
+#define LZ4HC_OPT_SEARCHES     (1<<12)   /* chain positions tested per match search */
+
+/* output bytes of a run of litlen literals, without its token */
+FORCE_INLINE int LZ4HC_literalsPrice(int litlen)
+{
+    int price = litlen;
+    if (litlen >= (int)RUN_MASK) price += 1 + (litlen-(int)RUN_MASK)/255;
+    return price;
+}
+
+/* output bytes of a sequence : token, literals, offset, match length */
+FORCE_INLINE int LZ4HC_sequencePrice(int litlen, int mlen)
+{
+    int price = 1 + 2 + LZ4HC_literalsPrice(litlen);
+    if (mlen >= (int)(ML_MASK+MINMATCH)) price += 1 + (mlen-(int)(ML_MASK+MINMATCH))/255;
+    return price;
+}
+
+/* longest match at ip longer than minLen, 0 if none */
+FORCE_INLINE int LZ4HC_FindLongerMatch (LZ4HC_window_t* ctx, U32* const hashTable, U16* const chainTable, const U32 chainLog,
+                                        const BYTE* ip, const BYTE* const iHighLimit, int minLen, int* offset, const int maxNbAttempts)
+{
+    const BYTE* matchPtr = NULL;
+    const BYTE* startPtr = ip;
+    int longest = LZ4HC_InsertAndGetWiderMatch(ctx, hashTable, chainTable, chainLog, ip, ip, iHighLimit, minLen, &matchPtr, &startPtr, maxNbAttempts);
+    if (longest <= minLen) return 0;
+    *offset = (int)(ip - matchPtr);
+    return longest;
+}
+
+static int LZ4HC_compress_optimal (
+    LZ4HC_window_t* ctx,
+    U32* const hashTable,
+    U16* const chainTable,
+    const U32 chainLog,
+    LZ4HC_optimal_t* const opt,   /* LZ4HC_OPT_NUM + TRAILING_LITERALS entries */
+    const char* source,
+    char* dest,
+    int inputSize,
+    int maxOutputSize,
+    const int maxNbAttempts,
+    limitedOutput_directive limit
+    )
+{
+    const BYTE* ip = (const BYTE*) source;
+    const BYTE* anchor = ip;
+    const BYTE* const iend = ip + inputSize;
+    const BYTE* const mflimit = iend - MFLIMIT;
+    const BYTE* const matchlimit = (iend - LASTLITERALS);
+
+    BYTE* op = (BYTE*) dest;
+    BYTE* const oend = op + maxOutputSize;
+
+    const int sufficient_len = LZ4HC_OPT_NUM - 1;
+
+    /* init */
+    ctx->end += inputSize;
+    ip++;
+
+    /* Main Loop */
+    while (ip < mflimit)
+    {
+        const int llen = (int)(ip - anchor);
+        int best_mlen, best_off;
+        int cur, last_match_pos;
+        int firstOff = 0;
+        int firstML = LZ4HC_FindLongerMatch(ctx, hashTable, chainTable, chainLog, ip, matchlimit, MINMATCH-1, &firstOff, maxNbAttempts);
+        if (!firstML) { ip++; continue; }
+
+        if (firstML > sufficient_len)
+        {
+            /* good enough : immediate encoding */
+            if (LZ4HC_encodeSequence(&ip, &op, &anchor, firstML, ip - firstOff, limit, oend)) goto _overflow;
+            continue;
+        }
+
+        /* prices of the first positions (literals) */
+        for (cur = 0; cur < MINMATCH; cur++)
+        {
+            opt[cur].mlen = 1;
+            opt[cur].off = 0;
+            opt[cur].litlen = llen + cur;
+            opt[cur].price = LZ4HC_literalsPrice(llen + cur);
+        }
+        /* prices of the first match, at every length */
+        {
+            int mlen;
+            for (mlen = MINMATCH; mlen <= firstML; mlen++)
+            {
+                opt[mlen].mlen = mlen;
+                opt[mlen].off = firstOff;
+                opt[mlen].litlen = llen;
+                opt[mlen].price = LZ4HC_sequencePrice(llen, mlen);
+            }
+        }
+        last_match_pos = firstML;
+        {
+            int addLit;
+            for (addLit = 1; addLit <= TRAILING_LITERALS; addLit++)
+            {
+                opt[last_match_pos+addLit].mlen = 1;
+                opt[last_match_pos+addLit].off = 0;
+                opt[last_match_pos+addLit].litlen = addLit;
+                opt[last_match_pos+addLit].price = opt[last_match_pos].price + LZ4HC_literalsPrice(addLit);
+            }
+        }
+
+        /* check further positions */
+        for (cur = 1; cur < last_match_pos; cur++)
+        {
+            const BYTE* const curPtr = ip + cur;
+            int newOff = 0;
+            int newML;
+
+            if (curPtr >= mflimit) break;
+            /* no need to search if the next position costs no more, unless the price rises sharply after it */
+            if ((opt[cur+1].price <= opt[cur].price) && (opt[cur+MINMATCH].price < opt[cur].price + 3)) continue;
+
+            newML = LZ4HC_FindLongerMatch(ctx, hashTable, chainTable, chainLog, curPtr, matchlimit, MINMATCH-1, &newOff, maxNbAttempts);
+            if (!newML) continue;
+
+            if ((newML > sufficient_len) || (newML + cur >= LZ4HC_OPT_NUM))
+            {
+                /* immediate encoding */
+                best_mlen = newML;
+                best_off = newOff;
+                last_match_pos = cur + 1;
+                goto _encode;
+            }
+
+            /* before the match : literals from cur */
+            {
+                const int baseLitlen = opt[cur].litlen;
+                int litlen;
+                for (litlen = 1; litlen < MINMATCH; litlen++)
+                {
+                    const int price = opt[cur].price - LZ4HC_literalsPrice(baseLitlen) + LZ4HC_literalsPrice(baseLitlen+litlen);
+                    const int pos = cur + litlen;
+                    if (price < opt[pos].price)
+                    {
+                        opt[pos].mlen = 1;
+                        opt[pos].off = 0;
+                        opt[pos].litlen = baseLitlen+litlen;
+                        opt[pos].price = price;
+                    }
+                }
+            }
+
+            /* the match at cur, at every length */
+            {
+                int ml;
+                for (ml = MINMATCH; ml <= newML; ml++)
+                {
+                    const int pos = cur + ml;
+                    int price, ll;
+                    if (opt[cur].mlen == 1)
+                    {
+                        ll = opt[cur].litlen;
+                        price = ((cur > ll) ? opt[cur - ll].price : 0) + LZ4HC_sequencePrice(ll, ml);
+                    }
+                    else
+                    {
+                        ll = 0;
+                        price = opt[cur].price + LZ4HC_sequencePrice(0, ml);
+                    }
+
+                    if ((pos > last_match_pos + TRAILING_LITERALS) || (price <= opt[pos].price))
+                    {
+                        if ((ml == newML) && (last_match_pos < pos)) last_match_pos = pos;
+                        opt[pos].mlen = ml;
+                        opt[pos].off = newOff;
+                        opt[pos].litlen = ll;
+                        opt[pos].price = price;
+                    }
+                }
+            }
+
+            /* literals after the furthest match */
+            {
+                int addLit;
+                for (addLit = 1; addLit <= TRAILING_LITERALS; addLit++)
+                {
+                    opt[last_match_pos+addLit].mlen = 1;
+                    opt[last_match_pos+addLit].off = 0;
+                    opt[last_match_pos+addLit].litlen = addLit;
+                    opt[last_match_pos+addLit].price = opt[last_match_pos].price + LZ4HC_literalsPrice(addLit);
+                }
+            }
+        }
+
+        best_mlen = opt[last_match_pos].mlen;
+        best_off = opt[last_match_pos].off;
+        cur = last_match_pos - best_mlen;
+
+_encode:   /* cur, last_match_pos, best_mlen and best_off are set */
+        /* walk the cheapest path backward, storing at each step the sequence which starts there */
+        {
+            int candidate_pos = cur;
+            int selected_matchLength = best_mlen;
+            int selected_offset = best_off;
+            for (;;)
+            {
+                const int next_matchLength = opt[candidate_pos].mlen;
+                const int next_offset = opt[candidate_pos].off;
+                opt[candidate_pos].mlen = selected_matchLength;
+                opt[candidate_pos].off = selected_offset;
+                selected_matchLength = next_matchLength;
+                selected_offset = next_offset;
+                if (next_matchLength > candidate_pos) break;   /* first sequence of the segment */
+                candidate_pos -= next_matchLength;
+            }
+        }
+
+        /* encode the sequences forward */
+        {
+            int rPos = 0;
+            while (rPos < last_match_pos)
+            {
+                const int ml = opt[rPos].mlen;
+                const int offset = opt[rPos].off;
+                if (ml == 1) { ip++; rPos++; continue; }   /* literal */
+                rPos += ml;
+                if (LZ4HC_encodeSequence(&ip, &op, &anchor, ml, ip - offset, limit, oend)) goto _overflow;
+            }
+        }
+    }
+
+    /* Encode Last Literals */
+    {
+        int lastRun = (int)(iend - anchor);
+        if ((limit) && (((char*)op - dest) + lastRun + 1 + ((lastRun+255-RUN_MASK)/255) > (U32)maxOutputSize)) return 0;  /* Check output limit */
+        if (lastRun>=(int)RUN_MASK) { *op++=(RUN_MASK<<ML_BITS); lastRun-=RUN_MASK; for(; lastRun > 254 ; lastRun-=255) *op++ = 255; *op++ = (BYTE) lastRun; }
+        else *op++ = (BYTE)(lastRun<<ML_BITS);
+        memcpy(op, anchor, iend - anchor);
+        op += iend-anchor;
+    }
+
+    /* End */
+    return (int) (((char*)op)-dest);
+
+_overflow:
+    return 0;
+}
+
+
+int LZ4_maxAttemptsHC(int compressionLevel)
+{
+    if (compressionLevel > g_maxCompressionLevel) compressionLevel = g_maxCompressionLevel;
+    if (compressionLevel < 1) compressionLevel = LZ4HC_compressionLevel_default;
+    return 1 << (compressionLevel-1);
+}
+
+static int LZ4HC_compress_generic (
+    void* ctxvoid,
+    const char* source,
+    char* dest,
+    int inputSize,
+    int maxOutputSize,
+    int compressionLevel,
+    limitedOutput_directive limit
+    )
+{
+    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*) ctxvoid;
+    if (compressionLevel >= LZ4HC_CLEVEL_OPT)
+        return LZ4HC_compress_optimal(&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE, ctx->opt,
+                                      source, dest, inputSize, maxOutputSize, LZ4HC_OPT_SEARCHES, limit);
+    return LZ4HC_compress_body(&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE,
+                               source, dest, inputSize, maxOutputSize, LZ4_maxAttemptsHC(compressionLevel), limit);
+}
+
 
 int LZ4_sizeofStateHC(void) { return sizeof(LZ4HC_Data_Structure); }
 
 int LZ4_compress_HC_extStateHC (void* state, const char* src, char* dst, int srcSize, int maxDstSize, int compressionLevel)
 {
+    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*)state;
     if (((size_t)(state)&(sizeof(void*)-1)) != 0) return 0;   /* Error : state is not aligned for pointers (32 or 64 bits) */
-    LZ4HC_init ((LZ4HC_Data_Structure*)state, (const BYTE*)src);
+    LZ4HC_init (&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE, (const BYTE*)src);
+    if (maxDstSize < LZ4_compressBound(srcSize))
+        return LZ4HC_compress_generic (state, src, dst, srcSize, maxDstSize, compressionLevel, limitedOutput);
+    else
+        return LZ4HC_compress_generic (state, src, dst, srcSize, maxDstSize, compressionLevel, noLimit);
+}
+
+/*
+ * Same as LZ4HC_init, without clearing the tables : the new input is indexed above every
+ * index of the previous one, so older entries fall below lowLimit and are never followed,
+ * and the chain of a position is always written before being read.
+ * The tables are only cleared when indexes approach overflow, or on first use (base == NULL).
+ */
+static void LZ4HC_init_reuse (LZ4HC_window_t* hc4, U32* hashTable, U16* chainTable, const U32 chainLog, const BYTE* start)
+{
+    size_t startingOffset = (size_t)(hc4->end - hc4->base);
+    if ((hc4->base == NULL) || (startingOffset > 1 GB))
+    {
+        LZ4HC_init(hc4, hashTable, chainTable, chainLog, start);
+        return;
+    }
+    startingOffset += 64 KB;
+    hc4->nextToUpdate = (U32)startingOffset;
+    hc4->base = start - startingOffset;
+    hc4->end = start;
+    hc4->dictBase = start - startingOffset;
+    hc4->dictLimit = (U32)startingOffset;
+    hc4->lowLimit = (U32)startingOffset;
+}
+
+int LZ4_compress_HC_extStateHC_fastReset (void* state, const char* src, char* dst, int srcSize, int maxDstSize, int compressionLevel)
+{
+    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*)state;
+    if (((size_t)(state)&(sizeof(void*)-1)) != 0) return 0;   /* Error : state is not aligned for pointers (32 or 64 bits) */
+    LZ4HC_init_reuse (&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE, (const BYTE*)src);
     if (maxDstSize < LZ4_compressBound(srcSize))
         return LZ4HC_compress_generic (state, src, dst, srcSize, maxDstSize, compressionLevel, limitedOutput);
     else
@@ -567,31 +912,36 @@ int             LZ4_freeStreamHC (LZ4_streamHC_t* LZ4_streamHCPtr) { free(LZ4_st
 void LZ4_resetStreamHC (LZ4_streamHC_t* LZ4_streamHCPtr, int compressionLevel)
 {
     LZ4_STATIC_ASSERT(sizeof(LZ4HC_Data_Structure) <= sizeof(LZ4_streamHC_t));   /* if compilation fails here, LZ4_STREAMHCSIZE must be increased */
-    ((LZ4HC_Data_Structure*)LZ4_streamHCPtr)->base = NULL;
-    ((LZ4HC_Data_Structure*)LZ4_streamHCPtr)->compressionLevel = (unsigned)compressionLevel;
+    ((LZ4HC_Data_Structure*)LZ4_streamHCPtr)->window.base = NULL;
+    ((LZ4HC_Data_Structure*)LZ4_streamHCPtr)->window.compressionLevel = (unsigned)compressionLevel;
 }
 
-int LZ4_loadDictHC (LZ4_streamHC_t* LZ4_streamHCPtr, const char* dictionary, int dictSize)
+static int LZ4HC_loadDict_generic (LZ4HC_window_t* ctxPtr, U32* hashTable, U16* chainTable, const U32 chainLog, const char* dictionary, int dictSize)
 {
-    LZ4HC_Data_Structure* ctxPtr = (LZ4HC_Data_Structure*) LZ4_streamHCPtr;
     if (dictSize > 64 KB)
     {
         dictionary += dictSize - 64 KB;
         dictSize = 64 KB;
     }
-    LZ4HC_init (ctxPtr, (const BYTE*)dictionary);
-    if (dictSize >= 4) LZ4HC_Insert (ctxPtr, (const BYTE*)dictionary +(dictSize-3));
+    LZ4HC_init (ctxPtr, hashTable, chainTable, chainLog, (const BYTE*)dictionary);
+    if (dictSize >= 4) LZ4HC_Insert (ctxPtr, hashTable, chainTable, chainLog, (const BYTE*)dictionary +(dictSize-3));
     ctxPtr->end = (const BYTE*)dictionary + dictSize;
     return dictSize;
 }
 
+int LZ4_loadDictHC (LZ4_streamHC_t* LZ4_streamHCPtr, const char* dictionary, int dictSize)
+{
+    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*) LZ4_streamHCPtr;
+    return LZ4HC_loadDict_generic(&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE, dictionary, dictSize);
+}
+
 
 /* compression */
 
-static void LZ4HC_setExternalDict(LZ4HC_Data_Structure* ctxPtr, const BYTE* newBlock)
+static void LZ4HC_setExternalDict(LZ4HC_window_t* ctxPtr, U32* hashTable, U16* chainTable, const U32 chainLog, const BYTE* newBlock)
 {
     if (ctxPtr->end >= ctxPtr->base + 4)
-        LZ4HC_Insert (ctxPtr, ctxPtr->end-3);   /* Referencing remaining dictionary content */
+        LZ4HC_Insert (ctxPtr, hashTable, chainTable, chainLog, ctxPtr->end-3);   /* Referencing remaining dictionary content */
     /* Only one memory segment for extDict, so any previous extDict is lost at this stage */
     ctxPtr->lowLimit  = ctxPtr->dictLimit;
     ctxPtr->dictLimit = (U32)(ctxPtr->end - ctxPtr->base);
@@ -601,13 +951,13 @@ static void LZ4HC_setExternalDict(LZ4HC_Data_Structure* ctxPtr, const BYTE* newB
     ctxPtr->nextToUpdate = ctxPtr->dictLimit;   /* match referencing will resume from there */
 }
 
-static int LZ4_compressHC_continue_generic (LZ4HC_Data_Structure* ctxPtr,
-                                            const char* source, char* dest,
-                                            int inputSize, int maxOutputSize, limitedOutput_directive limit)
+/* prepares the window for source, the caller then compresses it with LZ4HC_compress_body() */
+static void LZ4HC_continue_prepare (LZ4HC_window_t* ctxPtr, U32* hashTable, U16* chainTable, const U32 chainLog,
+                                    const char* source, int inputSize)
 {
     /* auto-init if forgotten */
     if (ctxPtr->base == NULL)
-        LZ4HC_init (ctxPtr, (const BYTE*) source);
+        LZ4HC_init (ctxPtr, hashTable, chainTable, chainLog, (const BYTE*) source);
 
     /* Check overflow */
     if ((size_t)(ctxPtr->end - ctxPtr->base) > 2 GB)
@@ -615,12 +965,12 @@ static int LZ4_compressHC_continue_generic (LZ4HC_Data_Structure* ctxPtr,
         size_t dictSize = (size_t)(ctxPtr->end - ctxPtr->base) - ctxPtr->dictLimit;
         if (dictSize > 64 KB) dictSize = 64 KB;
 
-        LZ4_loadDictHC((LZ4_streamHC_t*)ctxPtr, (const char*)(ctxPtr->end) - dictSize, (int)dictSize);
+        LZ4HC_loadDict_generic(ctxPtr, hashTable, chainTable, chainLog, (const char*)(ctxPtr->end) - dictSize, (int)dictSize);
     }
 
     /* Check if blocks follow each other */
     if ((const BYTE*)source != ctxPtr->end)
-        LZ4HC_setExternalDict(ctxPtr, (const BYTE*)source);
+        LZ4HC_setExternalDict(ctxPtr, hashTable, chainTable, chainLog, (const BYTE*)source);
 
     /* Check overlapping input/dictionary space */
     {
@@ -634,24 +984,23 @@ static int LZ4_compressHC_continue_generic (LZ4HC_Data_Structure* ctxPtr,
             if (ctxPtr->dictLimit - ctxPtr->lowLimit < 4) ctxPtr->lowLimit = ctxPtr->dictLimit;
         }
     }
-
-    return LZ4HC_compress_generic (ctxPtr, source, dest, inputSize, maxOutputSize, ctxPtr->compressionLevel, limit);
 }
 
 int LZ4_compress_HC_continue (LZ4_streamHC_t* LZ4_streamHCPtr, const char* source, char* dest, int inputSize, int maxOutputSize)
 {
+    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*)LZ4_streamHCPtr;
+    LZ4HC_continue_prepare (&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE, source, inputSize);
     if (maxOutputSize < LZ4_compressBound(inputSize))
-        return LZ4_compressHC_continue_generic ((LZ4HC_Data_Structure*)LZ4_streamHCPtr, source, dest, inputSize, maxOutputSize, limitedOutput);
+        return LZ4HC_compress_generic (ctx, source, dest, inputSize, maxOutputSize, ctx->window.compressionLevel, limitedOutput);
     else
-        return LZ4_compressHC_continue_generic ((LZ4HC_Data_Structure*)LZ4_streamHCPtr, source, dest, inputSize, maxOutputSize, noLimit);
+        return LZ4HC_compress_generic (ctx, source, dest, inputSize, maxOutputSize, ctx->window.compressionLevel, noLimit);
 }
 
 
 /* dictionary saving */
 
-int LZ4_saveDictHC (LZ4_streamHC_t* LZ4_streamHCPtr, char* safeBuffer, int dictSize)
+static int LZ4HC_saveDict_generic (LZ4HC_window_t* streamPtr, char* safeBuffer, int dictSize)
 {
-    LZ4HC_Data_Structure* streamPtr = (LZ4HC_Data_Structure*)LZ4_streamHCPtr;
     int prefixSize = (int)(streamPtr->end - (streamPtr->base + streamPtr->dictLimit));
     if (dictSize > 64 KB) dictSize = 64 KB;
     if (dictSize < 4) dictSize = 0;
@@ -668,6 +1017,61 @@ int LZ4_saveDictHC (LZ4_streamHC_t* LZ4_streamHCPtr, char* safeBuffer, int dictS
     return dictSize;
 }
 
+int LZ4_saveDictHC (LZ4_streamHC_t* LZ4_streamHCPtr, char* safeBuffer, int dictSize)
+{
+    return LZ4HC_saveDict_generic(&((LZ4HC_Data_Structure*)LZ4_streamHCPtr)->window, safeBuffer, dictSize);
+}
+
+
+/**************************************
+*  Streams with a chosen chain table size
+**************************************/
+LZ4_streamHCParams_t* LZ4_createStreamHCParams(int chainLog, int maxAttempts)
+{
+    LZ4_streamHCParams_t* hc4;
+    if ((chainLog < LZ4HC_CHAINLOG_MIN) || (chainLog > LZ4HC_CHAINLOG_MAX)) return NULL;
+    if ((maxAttempts < 1) || (maxAttempts > LZ4HC_MAXATTEMPTS_MAX)) return NULL;
+    hc4 = (LZ4_streamHCParams_t*)ALLOCATOR(1, sizeof(LZ4_streamHCParams_t) + (sizeof(U32) << (chainLog-1)) + (sizeof(U16) << chainLog));
+    if (hc4 == NULL) return NULL;
+    hc4->chainLog = (U32)chainLog;
+    hc4->maxAttempts = (U32)maxAttempts;
+    hc4->window.base = NULL;
+    return hc4;
+}
+
+int LZ4_freeStreamHCParams (LZ4_streamHCParams_t* LZ4_streamHCPtr) { FREEMEM(LZ4_streamHCPtr); return 0; }
+
+void LZ4_resetStreamHCParams (LZ4_streamHCParams_t* LZ4_streamHCPtr)
+{
+    LZ4_streamHCPtr->window.base = NULL;
+}
+
+int LZ4_loadDictHCParams (LZ4_streamHCParams_t* LZ4_streamHCPtr, const char* dictionary, int dictSize)
+{
+    U32* const hashTable = LZ4_streamHCPtr->hashTable;
+    const U32 chainLog = LZ4_streamHCPtr->chainLog;
+    return LZ4HC_loadDict_generic(&LZ4_streamHCPtr->window, hashTable, CHAINTABLE(hashTable, chainLog), chainLog, dictionary, dictSize);
+}
+
+int LZ4_compress_HC_continueParams (LZ4_streamHCParams_t* LZ4_streamHCPtr, const char* source, char* dest, int inputSize, int maxOutputSize)
+{
+    LZ4HC_window_t* const window = &LZ4_streamHCPtr->window;
+    U32* const hashTable = LZ4_streamHCPtr->hashTable;
+    const U32 chainLog = LZ4_streamHCPtr->chainLog;
+    U16* const chainTable = CHAINTABLE(hashTable, chainLog);
+    const int maxNbAttempts = (int)LZ4_streamHCPtr->maxAttempts;
+    LZ4HC_continue_prepare (window, hashTable, chainTable, chainLog, source, inputSize);
+    if (maxOutputSize < LZ4_compressBound(inputSize))
+        return LZ4HC_compress_body (window, hashTable, chainTable, chainLog, source, dest, inputSize, maxOutputSize, maxNbAttempts, limitedOutput);
+    else
+        return LZ4HC_compress_body (window, hashTable, chainTable, chainLog, source, dest, inputSize, maxOutputSize, maxNbAttempts, noLimit);
+}
+
+int LZ4_saveDictHCParams (LZ4_streamHCParams_t* LZ4_streamHCPtr, char* safeBuffer, int dictSize)
+{
+    return LZ4HC_saveDict_generic(&LZ4_streamHCPtr->window, safeBuffer, dictSize);
+}
+
 
 /***********************************
 *  Deprecated Functions
@@ -692,18 +1096,19 @@ int LZ4_sizeofStreamStateHC(void) { return LZ4_STREAMHCSIZE; }
 
 int LZ4_resetStreamStateHC(void* state, char* inputBuffer)
 {
+    LZ4HC_Data_Structure* ctx = (LZ4HC_Data_Structure*)state;
     if ((((size_t)state) & (sizeof(void*)-1)) != 0) return 1;   /* Error : pointer is not aligned for pointer (32 or 64 bits) */
-    LZ4HC_init((LZ4HC_Data_Structure*)state, (const BYTE*)inputBuffer);
-    ((LZ4HC_Data_Structure*)state)->inputBuffer = (BYTE*)inputBuffer;
+    LZ4HC_init(&ctx->window, ctx->hashTable, ctx->chainTable, DICTIONARY_LOGSIZE, (const BYTE*)inputBuffer);
+    ctx->window.inputBuffer = (BYTE*)inputBuffer;
     return 0;
 }
 
 void* LZ4_createHC (char* inputBuffer)
 {
-    void* hc4 = ALLOCATOR(1, sizeof(LZ4HC_Data_Structure));
+    LZ4HC_Data_Structure* hc4 = (LZ4HC_Data_Structure*)ALLOCATOR(1, sizeof(LZ4HC_Data_Structure));
     if (hc4 == NULL) return NULL;   /* not enough memory */
-    LZ4HC_init ((LZ4HC_Data_Structure*)hc4, (const BYTE*)inputBuffer);
-    ((LZ4HC_Data_Structure*)hc4)->inputBuffer = (BYTE*)inputBuffer;
+    LZ4HC_init (&hc4->window, hc4->hashTable, hc4->chainTable, DICTIONARY_LOGSIZE, (const BYTE*)inputBuffer);
+    hc4->window.inputBuffer = (BYTE*)inputBuffer;
     return hc4;
 }
 
@@ -726,6 +1131,6 @@ int LZ4_compressHC2_limitedOutput_continue (void* LZ4HC_Data, const char* source
 char* LZ4_slideInputBufferHC(void* LZ4HC_Data)
 {
     LZ4HC_Data_Structure* hc4 = (LZ4HC_Data_Structure*)LZ4HC_Data;
-    int dictSize = LZ4_saveDictHC((LZ4_streamHC_t*)LZ4HC_Data, (char*)(hc4->inputBuffer), 64 KB);
-    return (char*)(hc4->inputBuffer + dictSize);
+    int dictSize = LZ4_saveDictHC((LZ4_streamHC_t*)LZ4HC_Data, (char*)(hc4->window.inputBuffer), 64 KB);
+    return (char*)(hc4->window.inputBuffer + dictSize);
 }
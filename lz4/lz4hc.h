@@ -56,12 +56,16 @@ LZ4_compress_HC :
       srcSize  : Max supported value is LZ4_MAX_INPUT_SIZE (see "lz4.h")
       compressionLevel : Recommended values are between 4 and 9, although any value between 0 and 16 will work.
                          0 means "use default value" (see lz4hc.c).
-                         Values >16 behave the same as 16.
+                         LZ4HC_CLEVEL_OPT (17) selects optimal parsing : slower, smaller blocks, same decoding speed.
+                         Values >17 behave the same as 17.
       return : the number of bytes written into buffer 'dst'
             or 0 if compression fails.
 */
 
 
+#define LZ4HC_CLEVEL_OPT 17
+
+
 /* Note :
    Decompression functions are provided within LZ4 source code (see "lz4.h") (BSD license)
 */
@@ -82,11 +86,21 @@ LZ4_compress_HC_extStateHC() :
    It just uses externally allocated memory for stateHC.
 */
 
+int LZ4_compress_HC_extStateHC_fastReset(void* state, const char* src, char* dst, int srcSize, int maxDstSize, int compressionLevel);
+/*
+LZ4_compress_HC_extStateHC_fastReset() :
+   Same as LZ4_compress_HC_extStateHC(), for a state compressing many inputs in turn.
+   It does not clear the 256 KB of tables before each input, so its cost follows the input size :
+   entries left by previous inputs are recognized as stale and ignored.
+   The first use of a state must find it zeroed (memset or calloc), or previously used by an HC function.
+   The output is identical to LZ4_compress_HC_extStateHC().
+*/
+
 
 /**************************************
 *  Streaming Compression
 **************************************/
-#define LZ4_STREAMHCSIZE        262192
+#define LZ4_STREAMHCSIZE        327776
 #define LZ4_STREAMHCSIZE_SIZET (LZ4_STREAMHCSIZE / sizeof(size_t))
 typedef struct { size_t table[LZ4_STREAMHCSIZE_SIZET]; } LZ4_streamHC_t;
 /*
@@ -136,6 +150,31 @@ int LZ4_saveDictHC (LZ4_streamHC_t* streamHCPtr, char* safeBuffer, int maxDictSi
 */
 
 
+/*
+  LZ4_streamHCParams_t
+  Same as LZ4_streamHC_t, with the search cost chosen at creation instead of derived from a compression level :
+    chainLog    : the chain table has 2^chainLog entries (2 bytes each), the hash table 2^(chainLog-1) (4 bytes each),
+                  from LZ4HC_CHAINLOG_MIN (4 KB of tables) to LZ4HC_CHAINLOG_MAX (256 KB, as LZ4_streamHC_t).
+                  A chain table smaller than 64 KB also restricts matches to the last 2^chainLog bytes.
+    maxAttempts : number of chain positions tested per search, from 1 to LZ4HC_MAXATTEMPTS_MAX, which visits
+                  the whole chain. Compression level L searches LZ4_maxAttemptsHC(L) = 2^(L-1) positions.
+  LZ4_createStreamHCParams returns NULL if a parameter is not supported, or if allocation fails.
+  The other functions behave as their LZ4_streamHC_t counterparts.
+*/
+#define LZ4HC_CHAINLOG_MIN 10
+#define LZ4HC_CHAINLOG_MAX 16
+#define LZ4HC_MAXATTEMPTS_MAX (1<<16)
+typedef struct LZ4_streamHCParams_s LZ4_streamHCParams_t;
+
+int LZ4_maxAttemptsHC(int compressionLevel);
+LZ4_streamHCParams_t* LZ4_createStreamHCParams(int chainLog, int maxAttempts);
+int  LZ4_freeStreamHCParams (LZ4_streamHCParams_t* streamHCPtr);
+void LZ4_resetStreamHCParams (LZ4_streamHCParams_t* streamHCPtr);
+int  LZ4_loadDictHCParams (LZ4_streamHCParams_t* streamHCPtr, const char* dictionary, int dictSize);
+int  LZ4_compress_HC_continueParams (LZ4_streamHCParams_t* streamHCPtr, const char* src, char* dst, int srcSize, int maxDstSize);
+int  LZ4_saveDictHCParams (LZ4_streamHCParams_t* streamHCPtr, char* safeBuffer, int maxDictSize);
+
+
 
 /**************************************
 *  Deprecated Functions
@@ -12,4 +12,160 @@ test_frame(string.rep("0123456789", 100000))
 test_frame(readfile("../lua_lz4.c"))
 test_frame(readfile("../LICENSE"))
 
+-- content size in header, concatenated frames, empty input
+local s = readfile("../LICENSE")
+local e = lz4.compress(s, { content_checksum = true })
+assert(lz4.decompress(e..e) == s..s)
+assert(lz4.decompress("") == "")
+
+-- frame info
+local info = lz4.frame_info(lz4.compress(s, { content_size = true, content_checksum = true, block_independent = true }))
+assert(info.content_size == #s and info.content_checksum and info.block_independent and not info.skippable)
+info = lz4.frame_info(lz4.compress(s))
+assert(info.content_size == nil and not info.content_checksum)
+assert(lz4.decompress(lz4.compress(s, { content_size = true })) == s)
+local sized = lz4.compress(s, { content_size = true })
+assert(lz4.decompress(sized .. sized .. e) == s .. s .. s)
+assert(lz4.decompress(lz4.compress("", { content_size = true }) .. sized) == s)
+local part = lz4.decompress(sized:sub(1, -100))
+assert(#part < #s and s:sub(1, #part) == part)
+assert(not pcall(lz4.frame_info, "not a frame"))
+
+-- cached contexts recover from errors
+assert(not pcall(lz4.decompress, "not a frame"))
+for level = 0, 16, 4 do
+  local s = readfile("../LICENSE")
+  assert(lz4.decompress(lz4.compress(s, { compression_level = level })) == s)
+end
+
+-- optimal parsing, linked blocks reference the previous ones
+local s = readfile("../lua_lz4.c")..readfile("../LICENSE")
+for _, independent in ipairs({ false, true }) do
+  local o = { block_size = lz4.block_64KB, block_independent = independent }
+  o.compression_level = 16
+  local e16 = lz4.compress(s, o)
+  o.compression_level = 17
+  local e17 = lz4.compress(s, o)
+  assert(lz4.decompress(e17) == s and #e17 < #e16)
+  assert(lz4.decompress(lz4.compress(e17, o)) == e17)   -- incompressible blocks are stored
+end
+
+-- multi-threaded compression
+local s = readfile("../lua_lz4.c"):rep(8)..string.rep("0123456789", 50000)
+for _, level in ipairs({ 0, 9 }) do
+  local e = lz4.compress(s, { threads = 4, compression_level = level, content_checksum = true, content_size = true })
+  local info = lz4.frame_info(e)
+  assert(info.block_independent and info.content_size == #s)
+  assert(lz4.decompress(e) == s)
+end
+assert(lz4.decompress(lz4.compress(s, { threads = 3, block_size = lz4.block_256KB })) == s)
+assert(lz4.decompress(lz4.compress(s:sub(1, 1000), { threads = 2 })) == s:sub(1, 1000))
+assert(not pcall(lz4.compress, s, { threads = 0 }))
+
+-- multi-threaded decompression
+local e = lz4.compress(s, { threads = 4, content_checksum = true })
+assert(lz4.decompress(e, { threads = 4 }) == s)
+assert(lz4.decompress(e..e, { threads = 4 }) == s..s)
+assert(lz4.decompress(lz4.compress(s, { block_independent = true, content_size = true }), { threads = 2 }) == s)
+assert(lz4.decompress(lz4.compress(s), { threads = 2 }) == s)
+local bad = e:sub(1, -2)..string.char((e:byte(-1) + 1) % 256)
+assert(not pcall(lz4.decompress, bad, { threads = 4 }))
+
+-- dictionary
+local dict = readfile("../LICENSE")
+local m = dict:sub(200, 600)
+local e = lz4.compress(m, { dictionary = dict })
+assert(#e < #lz4.compress(m) / 2 and lz4.frame_info(e).dictionary_id == nil)
+assert(lz4.decompress(e, { dictionary = lz4.new_dictionary(dict) }) == m)
+assert(not pcall(lz4.decompress, e))
+local s = dict:rep(100)
+for _, independent in ipairs({ false, true }) do
+  for _, level in ipairs({ 0, 9, 17 }) do
+    local e = lz4.compress(s, { dictionary = dict, dictionary_id = 42, block_independent = independent, compression_level = level, content_checksum = true })
+    assert(lz4.frame_info(e).dictionary_id == 42)
+    assert(lz4.decompress(e, { dictionary = dict, threads = 2 }) == s)
+  end
+end
+assert(not pcall(lz4.compress, m, { dictionary_id = 42 }))
+lz4.register_dictionary(42, dict)
+local e = lz4.compress(m, { dictionary_id = 42 })
+assert(lz4.decompress(e) == m and lz4.decompress(e..e) == m..m)
+local buf = lz4.new_buffer()
+assert(lz4.decompress_into(buf, e) == #m and buf:sub() == m)
+-- concatenated frames with their own dictionaries
+local dict2 = readfile("../lua_lz4.c"):sub(1, 30000)
+local m2 = dict2:sub(1000, 1600)
+lz4.register_dictionary(43, dict2)
+local e2 = lz4.compress(m2, { dictionary_id = 43, content_size = true })
+for _, frames in ipairs({ { e, e2 }, { e2, e, e2 }, { e2, lz4.compress(m), e } }) do
+  local input, output = {}, {}
+  for i, f in ipairs(frames) do
+    input[i] = f
+    output[i] = lz4.decompress(f)
+  end
+  input, output = table.concat(input), table.concat(output)
+  assert(lz4.decompress(input) == output)
+  buf = lz4.new_buffer()
+  assert(lz4.decompress_into(buf, input) == #output and buf:sub() == output)
+  local job = lz4.decompress_job(input, { step_size = 100 })
+  while not job:step() do end
+  assert(job:result() == output)
+end
+assert(not pcall(lz4.decompress, e .. e2, { dictionary = dict }))
+lz4.register_dictionary(43, nil)
+assert(not pcall(lz4.decompress, e .. e2))
+lz4.register_dictionary(42, nil)
+assert(not pcall(lz4.decompress, e))
+assert(not pcall(lz4.register_dictionary, 0, dict))
+
+-- pool
+local pool = lz4.pool(3)
+assert(pool:size() == 3)
+local inputs = { "", "Hello, World!!", readfile("../lua_lz4.c"), string.rep("0123456789", 100000), dict:rep(20) }
+local jobs = {}
+for i, s in ipairs(inputs) do
+  jobs[i] = pool:compress_async(s, { compression_level = (i % 2) * 9, content_checksum = true })
+end
+for i, s in ipairs(inputs) do
+  local e = jobs[i]:wait()
+  assert(lz4.decompress(e) == s and jobs[i]:done() and jobs[i]:poll() == e)
+  local d = pool:decompress_async(e..e)
+  while not d:done() do end
+  assert(d:poll() == s..s)
+  local buf = lz4.new_buffer()
+  assert(d:wait(buf) == 2 * #s and buf:sub() == s..s)
+  assert(d:poll(buf, 2 * #s) == 2 * #s and buf:sub() == s..s..s..s)
+end
+lz4.register_dictionary(7, dict)
+local e = pool:compress_async(m, { dictionary_id = 7 }):wait()
+lz4.register_dictionary(7, nil)
+assert(lz4.decompress(e, { dictionary = dict }) == m)
+assert(pool:decompress_async(e, { dictionary = dict }):wait() == m)
+assert(not pcall(pool.decompress_async, pool, e))
+lz4.register_dictionary(7, dict)
+lz4.register_dictionary(8, dict2)
+local e8 = lz4.compress(m2, { dictionary_id = 8 })
+assert(pool:decompress_async(e .. lz4.compress(m) .. e):wait() == m .. m .. m)
+assert(pool:decompress_async(e8 .. e8, { dictionary = dict2 }):wait() == m2 .. m2)
+local mixed = pool:decompress_async(e .. e8)
+assert(not pcall(mixed.wait, mixed))
+lz4.register_dictionary(7, nil)
+lz4.register_dictionary(8, nil)
+local bad = pool:decompress_async("not a frame")
+assert(not pcall(bad.wait, bad))
+-- jobs collected or still queued when the pool closes
+for i = 1, 20 do pool:compress_async(inputs[4], { compression_level = 9 }) end
+collectgarbage()
+local pending = {}
+for i = 1, 10 do pending[i] = pool:compress_async(inputs[4], { compression_level = 9 }) end
+pool:close()
+assert(pool:size() == 0 and not pcall(pool.compress_async, pool, "x"))
+for i = 1, 10 do
+  local ok, r = pcall(pending[i].wait, pending[i])
+  assert((ok and lz4.decompress(r) == inputs[4]) or (not ok and r:find("pool closed")))
+end
+pool = lz4.pool()
+assert(not pcall(lz4.pool, 0) and not pcall(pool.compress_async, pool, {}))
+pool:close()
+
 print("ok")
@@ -20,4 +20,158 @@ test_block(string.rep("0123456789", 100000))
 test_block(readfile("../lua_lz4.c"))
 test_block(readfile("../LICENSE"))
 
+-- literal runs and matches of every short offset, ending close to the end of output
+local x = 1
+local function noise(n)
+  local t = {}
+  for i = 1, n do x = (x * 16807) % 2147483647 t[i] = string.char(x % 256) end
+  return table.concat(t)
+end
+for offset = 1, 40 do
+  for _, length in ipairs({ 4, 31, 32, 33, 100, 1000 }) do
+    local period = noise(offset)
+    local s = noise(offset * 3)..period:rep(math.ceil(length / offset) + 1)..noise(5)
+    decompress(s, lz4.block_compress(s), #s)
+    s = s..noise(64)..s
+    decompress(s, lz4.block_compress_hc(s), #s)
+    decompress(s, lz4.block_compress_hc(s, 17), #s)
+  end
+end
+
+-- optimal parsing
+for _, s in ipairs({ readfile("../lua_lz4.c"), readfile("../LICENSE") }) do
+  local e = lz4.block_compress_hc(s, 17)
+  decompress(s, e, #s)
+  assert(#e < #lz4.block_compress_hc(s, 16))
+  assert(lz4.block_compress_hc(s, 100) == e)
+end
+
+-- the cached HC state gives the same blocks whatever was compressed before
+local small, large = "Hello, Hello, World!! Hello, World!!", readfile("../lua_lz4.c")
+local blocks = { lz4.block_compress_hc(small), lz4.block_compress_hc(large, 4), lz4.block_compress_hc(small, 17) }
+for _ = 1, 3 do
+  assert(lz4.block_compress_hc(large, 4) == blocks[2])
+  assert(lz4.block_compress_hc(small) == blocks[1])
+  assert(lz4.block_compress_hc(small, 17) == blocks[3])
+  assert(lz4.block_compress_hc("") == lz4.block_compress_hc("", 9))
+end
+decompress(small, blocks[1], #small)
+
+-- every CPU variant produces the same blocks
+local cpu = lz4.cpu_features()
+for _, k in ipairs({ "compress", "decompress", "count", "xxh32" }) do assert(type(cpu[k]) == "string") end
+assert(type(cpu.avx2) == "boolean")
+local inputs = { string.rep("0123456789", 100000), readfile("../lua_lz4.c"), noise(1000) }
+local period = noise(100)
+for length = 1, 100 do inputs[#inputs + 1] = period..period:sub(1, length).."\0"..noise(20) end   -- matches ending at every lane
+local blocks = {}
+for i, s in ipairs(inputs) do blocks[i] = lz4.block_compress(s) end
+for _, features in ipairs({ { avx2 = false }, { avx2 = false, sse2 = false }, {} }) do
+  local selected = lz4.cpu_features(features)
+  if features.avx2 == false then assert(not selected.avx2 and selected.compress ~= "avx2") end
+  if features.sse2 == false then assert(selected.compress == "scalar" and selected.decompress == "scalar") end
+  for i, s in ipairs(inputs) do
+    assert(lz4.block_compress(s) == blocks[i])
+    decompress(s, blocks[i], #s)
+    assert(lz4.decompress(lz4.compress(s)) == s)
+  end
+end
+assert(lz4.cpu_features().avx2 == cpu.avx2)
+assert(not pcall(lz4.cpu_features, { avx2 = 1 }))
+local pool = lz4.pool(1)
+assert(not pcall(lz4.cpu_features, { avx2 = false }) and lz4.cpu_features().avx2 == cpu.avx2)
+pool:close()
+assert(lz4.cpu_features({}).avx2 == cpu.avx2)
+
+-- batch
+local inputs, sizes = { "", "Hello, World!!", readfile("../LICENSE"), string.rep("0123456789", 1000) }, {}
+for i, s in ipairs(inputs) do sizes[i] = #s end
+local e = lz4.block_compress_batch(inputs)
+assert(#e == #inputs)
+for i, s in ipairs(inputs) do assert(lz4.block_decompress_safe(e[i], #s) == s) end
+local d = lz4.block_decompress_batch(e, sizes)
+for i, s in ipairs(inputs) do assert(d[i] == s) end
+assert(#lz4.block_compress_batch({}, 4) == 0)
+assert(not pcall(lz4.block_compress_batch, { "a", 1 }))
+assert(not pcall(lz4.block_decompress_batch, e, { 1, 2 }))
+
+-- dest size
+local s = readfile("../lua_lz4.c")
+local e, n = lz4.block_compress_dest_size(s, 1400)
+assert(#e <= 1400 and n > 0 and n < #s)
+assert(lz4.block_decompress_safe(e, n) == s:sub(1, n))
+e, n = lz4.block_compress_dest_size("Hello, World!!", 4096)
+assert(n == 14 and lz4.block_decompress_safe(e, n) == "Hello, World!!")
+for _, target in ipairs({ 64, 1400, 4096 }) do
+  local blocks, sizes = lz4.block_compress_slices(s, target)
+  for i = 1, #blocks do assert(#blocks[i] <= target) end
+  assert(table.concat(lz4.block_decompress_batch(blocks, sizes)) == s)
+end
+assert(#lz4.block_compress_slices("", 64) == 0)
+assert(not pcall(lz4.block_compress_slices, s, 1))
+
+-- dictionary
+local dict = readfile("../LICENSE")
+local prepared = lz4.new_dictionary(dict)
+assert(#prepared == #dict)
+for _, s in ipairs({ "", dict:sub(100, 400), "Permission is hereby granted, free of charge", readfile("../lua_lz4.c") }) do
+  local e1 = lz4.block_compress_dict(s, dict)
+  local e2 = lz4.block_compress_dict(s, prepared)
+  assert(e1 == e2)
+  assert(lz4.block_decompress_safe_dict(e1, #s, dict) == s)
+  assert(lz4.block_decompress_safe_dict(e2, #s, prepared) == s)
+end
+local s = dict:sub(1000, 1500)
+assert(#lz4.block_compress_dict(s, prepared) < #lz4.block_compress(s) / 4)
+local big = readfile("../lua_lz4.c"):rep(2)
+assert(#lz4.new_dictionary(big) == 65536)
+assert(lz4.block_decompress_safe_dict(lz4.block_compress_dict(s, big), #s, lz4.new_dictionary(big)) == s)
+
+-- dictionary training, messages of many schemas where the latest ones are not representative
+local x = 7
+local function random(n) x = (x * 16807) % 2147483647 return x % n end
+local schemas = {}
+for t = 1, 10 do
+  local keys = {}
+  for j = 1, 8 do keys[j] = string.format("field_%d_%d", t, random(100000)) end
+  schemas[t] = keys
+end
+local function message(t)
+  local fields = {}
+  for j, k in ipairs(schemas[t]) do fields[j] = string.format('"%s":%d', k, random(100000)) end
+  return '{"type":"event' .. t .. '",' .. table.concat(fields, ",") .. "}"
+end
+local samples, messages = {}, {}
+for i = 1, 1000 do samples[i] = message(1 + math.floor((i - 1) / 100)) end
+for i = 1, 100 do messages[i] = message(1 + random(10)) end
+local function ratio(dict)
+  local a, b = 0, 0
+  for _, s in ipairs(messages) do
+    local e = lz4.block_compress_dict(s, dict)
+    assert(lz4.block_decompress_safe_dict(e, #s, dict) == s)
+    a, b = a + #s, b + #e
+  end
+  return a / b
+end
+local trained = lz4.train_dictionary(samples, 4096)
+assert(#trained == 4096)
+assert(ratio(trained) > 1.25 * ratio(table.concat(samples):sub(-4096)))
+assert(#lz4.train_dictionary(samples) <= 65536)
+assert(lz4.train_dictionary({}) == "")
+assert(not pcall(lz4.train_dictionary, samples, 65537))
+-- short samples end in segments of less than 64 bytes, more of them than size / 64
+x = 3
+local words = { "alpha", "beta", "gamma", "delta", "sensor", "value", "temp", "id", "ts" }
+samples = {}
+for i = 1, 31 do
+  local t = {}
+  for j = 1, 4 + random(12) do t[j] = words[1 + random(9)] .. random(1000) .. "," end
+  samples[i] = table.concat(t)
+end
+for _, size in ipairs({ 750, 1000, 1621 }) do
+  local d = lz4.train_dictionary(samples, size)
+  assert(#d <= size and #d > size / 2)
+  assert(lz4.block_decompress_safe_dict(lz4.block_compress_dict(samples[1], d), #samples[1], d) == samples[1])
+end
+
 print("ok")
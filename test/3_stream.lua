@@ -46,4 +46,153 @@ for _, s in ipairs(data) do
   print(#e1.."/"..#e2.."/"..#b1.."/"..#b2.."/"..#s)
 end
 
+-- hash table size
+local text = readfile("../lua_lz4.c") .. readfile("../LICENSE")
+local sizes = {}
+for _, hash_log in ipairs({ 10, 12, 14, 16, 18 }) do
+  local cs = lz4.new_compression_stream(nil, nil, { hash_log = hash_log })
+  local ds = lz4.new_decompression_stream()
+  local n = 0
+  for i = 1, #text, 4096 do
+    local s = text:sub(i, i + 4095)
+    local e = cs:compress(s)
+    assert(ds:decompress_safe(e, #s) == s)
+    n = n + #e
+  end
+  sizes[hash_log] = n
+end
+assert(sizes[10] > sizes[12] and sizes[12] > sizes[18])
+local default, sized = lz4.new_compression_stream(), lz4.new_compression_stream(65536, 1, { hash_log = 12 })
+assert(default:compress(text) == sized:compress(text))
+assert(not pcall(lz4.new_compression_stream, nil, nil, { hash_log = 11 }))
+assert(not pcall(lz4.new_compression_stream, nil, nil, { hash_log = 20 }))
+
+-- HC search depth and chain table size
+sizes = {}
+for _, o in ipairs({ { 1, 16 }, { 16, 16 }, { 65536, 16 }, { 65536, 10 }, { 4, 12 } }) do
+  local cs = lz4.new_compression_stream_hc(nil, nil, { max_attempts = o[1], chain_log = o[2] })
+  local ds = lz4.new_decompression_stream()
+  local n = 0
+  for i = 1, #text, 4096 do
+    local s = text:sub(i, i + 4095)
+    local e = cs:compress(s)
+    assert(ds:decompress_safe(e, #s) == s)
+    n = n + #e
+  end
+  sizes[o[1] .. "/" .. o[2]] = n
+end
+assert(sizes["1/16"] > sizes["16/16"] and sizes["16/16"] >= sizes["65536/16"] and sizes["65536/10"] > sizes["65536/16"])
+for level, attempts in pairs({ [0] = 256, [4] = 8, [9] = 256, [16] = 32768 }) do
+  local s = text:sub(1, 60000)
+  local leveled = lz4.new_compression_stream_hc(nil, level)
+  local explicit = lz4.new_compression_stream_hc(nil, nil, { max_attempts = attempts })
+  assert(leveled:compress(s) == lz4.block_compress_hc(s, level))
+  assert(explicit:compress(s) == lz4.block_compress_hc(s, level))
+end
+assert(not pcall(lz4.new_compression_stream_hc, nil, nil, { max_attempts = 0 }))
+assert(not pcall(lz4.new_compression_stream_hc, nil, nil, { max_attempts = 65537 }))
+assert(not pcall(lz4.new_compression_stream_hc, nil, nil, { chain_log = 9 }))
+assert(not pcall(lz4.new_compression_stream_hc, nil, nil, { chain_log = 17 }))
+
+-- writing into the ring buffer, the same blocks as compress()
+for _, o in ipairs({
+  { 65536, { 1000, 4096, 30000 } },
+  { 100000, { 1000, 4096, 30000 } },
+  { 1024, { 1000, 1024 } },
+  { 100000, { 70000, 20000, 12000, 33000, 20000 } },
+  { 200000, { 70000, 100000, 5000, 90000 } },
+}) do
+  local ring, sizes = o[1], o[2]
+  local cs, cs2 = lz4.new_compression_stream(ring), lz4.new_compression_stream(ring)
+  local ds, ds2 = lz4.new_decompression_stream(ring), lz4.new_decompression_stream(ring)
+  local pos, n = 1, 0
+  while pos <= #text do
+    n = n % #sizes + 1
+    local size = sizes[n]
+    local s = text:sub(pos, pos + size - 1)
+    local view = cs:writable(size)
+    assert(#view == 0 and view:capacity() == size)
+    if n == 1 then
+      assert(view:write(s) == #s)
+    else
+      view:write(s:sub(1, 10))
+      view:write(s:sub(11))
+    end
+    local e = cs:commit()
+    assert(#view == 0 and view:capacity() == 0)
+    assert(e == cs2:compress(s))
+    assert(ds:decompress_safe(e, #s) == s)
+    assert(ds2:decompress_fast(e, #s) == s)
+    pos = pos + size
+  end
+  assert(cs:compress("Hello, World!!") ~= nil)
+end
+-- blocks shorter than their view are placed by their length, bytes written past them are ignored
+for _, o in ipairs({ { 65536, false }, { 100000, false }, { 65536, true }, { 100000, true } }) do
+  local ring, overwrite = o[1], o[2]
+  local cs, cs2, ds = lz4.new_compression_stream(ring), lz4.new_compression_stream(ring), lz4.new_decompression_stream(ring)
+  local pos, n = 1, 0
+  while pos <= #text do
+    n = n + 1
+    local capacity = ({ 30000, 65536, 4096, 50000 })[n % 4 + 1]
+    local size = math.min(({ 1000, 20000, 4096, 35000, 100 })[n % 5 + 1], capacity)
+    local s = text:sub(pos, pos + size - 1)
+    local view = cs:writable(capacity)
+    view:write(s)
+    if overwrite then view:write(("x"):rep(capacity - #view)) end
+    local e = cs:commit(#s)
+    assert(e == cs2:compress(s))
+    assert(ds:decompress_safe(e, #s) == s)
+    pos = pos + size
+  end
+end
+local cs, ds = lz4.new_compression_stream(), lz4.new_decompression_stream()
+local s = lz4.block_compress(text:sub(1, 20000))
+local view = cs:writable(20000)
+assert(lz4.block_decompress_into(view, s, 20000) == 20000)
+assert(ds:decompress_safe(cs:commit(12345), 12345) == text:sub(1, 12345))
+view = cs:writable(100)
+view:write("Hello")
+cs:reset()
+assert(#view == 0 and not pcall(cs.commit, cs))
+view = cs:writable(10)
+assert(not pcall(view.write, view, "Hello, World!!"))
+assert(not pcall(cs.commit, cs, 11))
+assert(cs:writable(10) == view)
+assert(not pcall(cs.writable, cs, 0))
+assert(not pcall(cs.writable, cs, 65537))
+
+-- views of decoded blocks
+for _, ring in ipairs({ 65536, 1024, 200000 }) do
+  local cs, ds, ref = lz4.new_compression_stream(ring), lz4.new_decompression_stream(ring), lz4.new_decompression_stream(ring)
+  local previous
+  for i = 1, #text, 7000 do
+    local s = text:sub(i, i + 6999)
+    local e = cs:compress(s)
+    assert(ref:decompress_safe(e, #s) == s)
+    local view = (i % 2 == 1) and ds:decompress_safe_view(e, #s) or ds:decompress_fast_view(e, #s)
+    if previous then assert(not pcall(previous.len, previous)) end
+    assert(#view == #s and view:len() == #s and view:sub() == s)
+    for _, k in ipairs({ { 1, 10 }, { -20, -1 }, { 0, 5 }, { 100, 50 }, { #s - 2, #s + 10 }, { -#s - 5, 3 } }) do
+      assert(view:sub(k[1], k[2]) == s:sub(k[1], k[2]))
+      assert(table.concat({ view:byte(k[1], k[2]) }, ",") == table.concat({ s:byte(k[1], k[2]) }, ","))
+    end
+    assert(view:byte() == s:byte() and view:byte(-1) == s:byte(-1) and view:byte(#s + 1) == nil)
+    for _, needle in ipairs({ "lua", "static int", s:sub(-30), "\0not there", "" }) do
+      for _, init in ipairs({ 1, math.min(100, #s), -50, #s + 1 }) do
+        local a1, b1 = view:find(needle, init)
+        local a2, b2 = s:find(needle, init, true)
+        assert(a1 == a2 and b1 == b2)
+      end
+    end
+    previous = view
+  end
+  ds:reset()
+  assert(not pcall(previous.sub, previous))
+end
+assert(not pcall(lz4.new_decompression_stream().decompress_safe_view, lz4.new_decompression_stream(), "\255", 10))
+
+local buf = lz4.new_buffer()
+assert(buf:write("Hello") == 5 and buf:write(buf) == 10 and buf:write("!", 5) == 6 and buf:sub() == "Hello!")
+
 print("ok")
@@ -0,0 +1,139 @@
+local lz4 = require("lz4")
+local readfile = require("readfile")
+
+local function compress_chunks(s, chunk_size, options)
+  local fc = lz4.new_frame_compressor(options)
+  local t = { fc:begin() }
+  for i = 1, #s, chunk_size do
+    t[#t + 1] = fc:update(s:sub(i, i + chunk_size - 1))
+  end
+  t[#t + 1] = fc:flush()
+  t[#t + 1] = fc:finish()
+  return table.concat(t)
+end
+
+local function test_frame_compressor(s)
+  local e1 = compress_chunks(s, 1000)
+  assert(lz4.decompress(e1) == s)
+  local e2 = compress_chunks(s, 70000, { block_independent = true, content_checksum = true })
+  assert(lz4.decompress(e2) == s)
+  local e3 = compress_chunks(s, 4096, { compression_level = 9, auto_flush = true })
+  assert(lz4.decompress(e3) == s)
+  print(#e1.."/"..#e2.."/"..#e3.."/"..#s)
+end
+
+test_frame_compressor(string.rep("0123456789", 100000))
+test_frame_compressor(readfile("../lua_lz4.c"))
+test_frame_compressor(readfile("../LICENSE"))
+
+-- declared content size
+local s = readfile("../LICENSE")
+local fc = lz4.new_frame_compressor()
+local e = fc:begin(#s)..fc:update(s)..fc:finish()
+assert(lz4.frame_info(e).content_size == #s)
+assert(lz4.decompress(e) == s)
+fc:begin(#s + 1)
+fc:update(s)
+assert(not pcall(fc.finish, fc))
+assert(not pcall(fc.begin, fc, -1))
+assert(lz4.decompress(fc:begin(0)..fc:finish()) == "")
+
+-- context is reusable after finish()
+local fc = lz4.new_frame_compressor()
+for _, s in ipairs({ "Hello, World!!", "", "lua-lz4 - LZ4 binding for Lua" }) do
+  local e = fc:begin()..fc:update(s)..fc:finish()
+  assert(lz4.decompress(e) == s)
+end
+assert(not pcall(fc.update, fc, "not begun"))
+
+local function decompress_chunks(e, chunk_size, max_output)
+  local fd = lz4.new_frame_decompressor()
+  local t = {}
+  local hint
+  for i = 1, #e, chunk_size do
+    local d
+    d, hint = fd:decompress(e:sub(i, i + chunk_size - 1), max_output)
+    assert(max_output == nil or #d <= max_output)
+    t[#t + 1] = d
+  end
+  while hint ~= 0 do
+    local d
+    d, hint = fd:decompress(nil, max_output)
+    assert(#d > 0)
+    t[#t + 1] = d
+  end
+  return table.concat(t)
+end
+
+local function test_frame_decompressor(s)
+  local e = lz4.compress(s, { content_checksum = true })
+  assert(decompress_chunks(e, 7) == s)
+  assert(decompress_chunks(e, 1000, 100) == s)
+  assert(decompress_chunks(e, #e, 4096) == s)
+  assert(decompress_chunks(e, #e) == s)
+end
+
+test_frame_decompressor(string.rep("0123456789", 100000))
+test_frame_decompressor(readfile("../lua_lz4.c"))
+test_frame_decompressor(readfile("../LICENSE"))
+
+-- concatenated frames are returned one by one
+local fd = lz4.new_frame_decompressor()
+local d, hint = fd:decompress(lz4.compress("Hello, World!!")..lz4.compress("lua-lz4"))
+assert(d == "Hello, World!!" and hint == 0)
+d, hint = fd:decompress()
+assert(d == "lua-lz4" and hint == 0)
+assert(not pcall(fd.decompress, fd, "not a frame"))
+
+-- jobs driven by coroutines, a step processes at most step_size bytes of input
+local function run(job, step_size)
+  local co = coroutine.wrap(function()
+    local steps, last = 0, 0
+    while true do
+      local done, n = job:step()
+      steps = steps + 1
+      assert(n >= last and n - last <= step_size + (steps == 1 and 19 or 0))  -- decompress_job reads the frame header
+      last = n
+      if done then return steps end
+      coroutine.yield()
+    end
+  end)
+  local steps
+  repeat steps = co() until steps
+  return steps
+end
+
+local dict = readfile("../LICENSE")
+for _, s in ipairs({ "", "Hello, World!!", readfile("../lua_lz4.c"), string.rep("0123456789", 100000) }) do
+  for _, options in ipairs({ {}, { compression_level = 9, content_checksum = true, content_size = true }, { block_independent = true, dictionary = dict } }) do
+    options.step_size = 4096
+    local job = lz4.compress_job(s, options)
+    local steps = run(job, 4096)
+    assert(steps == math.max(1, math.ceil(#s / 4096)))
+    local e = job:result()
+    options.step_size = nil
+    assert(lz4.decompress(e, options) == s)
+    options.step_size = 1000
+    job = lz4.decompress_job(e, options)
+    run(job, 1000)
+    assert(job:result() == s)
+    local buf = lz4.new_buffer()
+    assert(job:result(buf) == #s and buf:sub() == s)
+    assert(job:step())
+  end
+end
+lz4.register_dictionary(9, dict)
+local e = lz4.compress("Permission is hereby granted", { dictionary_id = 9 })
+local job = lz4.decompress_job(e .. e, { step_size = 7 })
+lz4.register_dictionary(9, nil)
+run(job, 7)
+assert(job:result() == "Permission is hereby grantedPermission is hereby granted")
+job = lz4.decompress_job("not a frame")
+assert(not pcall(job.step, job) and not pcall(job.step, job) and not pcall(job.result, job))
+job = lz4.compress_job(string.rep("x", 100))
+assert(not pcall(job.result, job))
+assert(job:step(10) == false and select(2, job:step(10)) == 20 and job:step() == true)
+assert(lz4.decompress(job:result()) == string.rep("x", 100))
+assert(not pcall(lz4.compress_job, "x", { step_size = 0 }))
+
+print("ok")
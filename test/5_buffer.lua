@@ -0,0 +1,40 @@
+local lz4 = require("lz4")
+local readfile = require("readfile")
+
+local function test_buffer(s)
+  local e = lz4.new_buffer(16)
+  local d = lz4.new_buffer()
+
+  local n = lz4.block_compress_into(e, s)
+  assert(n == #e and e:sub() == lz4.block_compress(s))
+  assert(lz4.block_decompress_into(d, e, #s) == #s and d:sub() == s)
+  assert(lz4.block_decompress_into(d, e:sub(), #s) == #s and d:sub() == s)
+
+  n = lz4.compress_into(e, s, 0, { content_size = true })
+  assert(n == #e and lz4.decompress(e:sub()) == s)
+  assert(lz4.decompress_into(d, e) == #s and d:sub() == s)
+  n = lz4.compress_into(e, s)
+  assert(lz4.decompress_into(d, e) == #s and d:sub() == s)
+
+  -- write at offset, keep previous content
+  assert(lz4.decompress_into(d, e, 5) == #s and #d == #s + 5)
+  assert(d:sub(1, 5) == s:sub(1, 5) and d:sub(6) == s)
+
+  print(#e.."/"..e:capacity().."/"..#d.."/"..d:capacity())
+end
+
+test_buffer(string.rep("0123456789", 100000))
+test_buffer(readfile("../lua_lz4.c"))
+test_buffer(readfile("../LICENSE"))
+
+local b = lz4.new_buffer(100)
+assert(#b == 0 and b:capacity() == 100 and b:sub() == "")
+assert(b:reserve(200) == 200 and b:reserve(10) == 200)
+lz4.block_decompress_into(b, lz4.block_compress("Hello, World!!"), 14)
+assert(b:sub(-7) == "World!!" and b:sub(1, 5) == "Hello" and b:sub(20) == "")
+assert(not pcall(lz4.block_decompress_into, b, b, 14))
+assert(not pcall(lz4.block_compress_into, b, "x", 15))
+b:clear()
+assert(#b == 0 and b:capacity() == 200)
+
+print("ok")
@@ -1,3 +1,5 @@
 dofile("1_frame.lua")
 dofile("2_block.lua")
 dofile("3_stream.lua")
+dofile("4_frame_stream.lua")
+dofile("5_buffer.lua")